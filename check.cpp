@@ -5,10 +5,13 @@
 #include <vector>
 #include <bitset>
 #include <random>
+#include <thread>
+#include <atomic>
 
 #include "quadrable.h"
 #include "quadrable/transport.h"
 #include "quadrable/debug.h"
+#include "quadrable/GroupCommit.h"
 
 
 
@@ -237,6 +240,52 @@ void doTests() {
         }
     });
 
+    test("key comparison", [&]{
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        auto sign = [](int n){ return (n > 0) - (n < 0); };
+
+        for (uint64_t i = 0; i < 10'000; i++) {
+            Key a = Key::hash(std::to_string(rnd()));
+            Key b = a;
+            size_t flip = rnd() % 257;
+            if (flip < 256) b.setBit(flip, !a.getBit(flip));
+
+            verify(sign(a.compare(b)) == sign(memcmp(a.data, b.data, sizeof(a.data))));
+            verify((a == b) == (flip == 256));
+        }
+
+        std::vector<Key> keys;
+        for (uint64_t i = 0; i < 1000; i++) keys.push_back(Key::hash(std::to_string(i)));
+        std::sort(keys.begin(), keys.end());
+
+        auto getKey = [](const Key &k) -> const Key & { return k; };
+
+        auto middle = partitionByBit(keys.begin(), keys.end(), 0, getKey);
+        verify(std::all_of(keys.begin(), middle, [](const Key &k){ return !k.getBit(0); }));
+        verify(std::all_of(middle, keys.end(), [](const Key &k){ return k.getBit(0); }));
+
+        verify(partitionByBit(keys.begin(), middle, 0, getKey) == middle);
+        verify(partitionByBit(middle, keys.end(), 0, getKey) == middle);
+        verify(partitionByBit(middle, middle, 0, getKey) == middle);
+
+        // Bidirectional iterators are scanned instead of binary searched
+
+        std::map<Key, int> keyMap;
+        for (auto &k : keys) keyMap.emplace(k, 0);
+
+        auto getMapKey = [](const auto &e) -> const Key & { return e.first; };
+
+        auto mapMiddle = partitionByBit(keyMap.begin(), keyMap.end(), 0, getMapKey);
+        verify(std::distance(keyMap.begin(), mapMiddle) == std::distance(keys.begin(), middle));
+
+        auto mapQuarter = partitionByBit(keyMap.begin(), mapMiddle, 1, getMapKey);
+        auto quarter = partitionByBit(keys.begin(), middle, 1, getKey);
+        verify(std::distance(keyMap.begin(), mapQuarter) == std::distance(keys.begin(), quarter));
+        verify(quarter != keys.begin() && quarter != middle);
+    });
+
 
     test("empty heads", [&]{
         verify(Key::null() == db.root(txn));
@@ -1108,10 +1157,295 @@ void doTests() {
         }, [&]{
             db.importProof(txn, proof, origRoot);
 
-            // FIXME: support creating a proof with enough information to do a deletion
-            //db.change().del("a").apply(txn);
+            // The proof doesn't say whether b is a leaf, so use a deletable proof (below) for this
             verifyThrow(db.change().del("a").apply(txn), "can't bubble a witness node");
         });
+
+        equivHeads("deletable proof can bubble up a sibling leaf", [&]{
+            db.change().put("a", "1").put("b", "2").apply(txn);
+
+            proof = proofRoundtrip(db.exportProof(txn, {
+                "a",
+            }, true));
+
+            origRoot = db.root(txn);
+
+            db.change().del("a").apply(txn);
+        }, [&]{
+            db.importProof(txn, proof, origRoot);
+
+            db.change().del("a").apply(txn);
+        });
+
+        equivHeads("witness sibling of a remaining branch doesn't need to bubble", [&]{
+            db.change().put("a", "1").put("b", "2").put("c", "3").put("d", "4").apply(txn);
+
+            proof = proofRoundtrip(db.exportProof(txn, {
+                "a",
+                "b",
+            }));
+
+            origRoot = db.root(txn);
+
+            db.change().del("a").apply(txn);
+        }, [&]{
+            db.importProof(txn, proof, origRoot);
+
+            db.change().del("a").apply(txn);
+        });
+    });
+
+
+    test("deletable proofs", [&]{
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        MemQuadrable full;
+        uint64_t extraStrands = 0;
+
+        for (int iter = 0; iter < 300; iter++) {
+            full.clear();
+
+            std::vector<std::string> keys;
+            {
+                auto c = full.change();
+                uint64_t numElems = 1 + rnd() % (rnd() % 2 ? 8 : 200);
+                for (uint64_t i = 0; i < numElems; i++) {
+                    keys.push_back(std::to_string(rnd() % 1000));
+                    c.put(keys.back(), "v" + keys.back());
+                }
+                full.apply(c);
+            }
+
+            // Prove some existing keys, and some that may not exist
+
+            std::vector<std::string> proveKeys;
+            uint64_t numProve = 1 + rnd() % 5;
+            for (uint64_t i = 0; i < numProve; i++) proveKeys.push_back(rnd() % 4 ? keys[rnd() % keys.size()] : std::to_string(rnd() % 1000));
+
+            auto origRoot = full.root();
+            auto proof = proofRoundtrip(full.exportProof(proveKeys, true));
+            extraStrands += proof.strands.size() - full.exportProof(proveKeys).strands.size();
+
+            MemQuadrable partial;
+            partial.importProof(proof, origRoot);
+
+            auto applyUpdates = [&](MemQuadrable &m){
+                auto c = m.change();
+                std::mt19937 rnd2(iter);
+                for (auto &k : proveKeys) {
+                    if (rnd2() % 4 == 0) c.put(k, "updated");
+                    else c.del(k);
+                }
+                m.apply(c);
+            };
+
+            applyUpdates(full);
+            applyUpdates(partial);
+
+            verify(full.root() == partial.root());
+        }
+
+        verify(extraStrands > 0);
+    });
+
+
+    test("batch proofs", [&]{
+        auto sameProof = [](const Proof &a, const Proof &b){
+            if (a.strands.size() != b.strands.size() || a.cmds.size() != b.cmds.size()) return false;
+
+            for (size_t i = 0; i < a.strands.size(); i++) {
+                auto &s1 = a.strands[i], &s2 = b.strands[i];
+                if (s1.strandType != s2.strandType || s1.depth != s2.depth || s1.keyHash != s2.keyHash || s1.val != s2.val || s1.key != s2.key) return false;
+            }
+
+            for (size_t i = 0; i < a.cmds.size(); i++) {
+                auto &c1 = a.cmds[i], &c2 = b.cmds[i];
+                if (c1.op != c2.op || c1.nodeOffset != c2.nodeOffset || c1.hash != c2.hash) return false;
+            }
+
+            return true;
+        };
+
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        MemQuadrable m;
+
+        for (int iter = 0; iter < 200; iter++) {
+            m.clear();
+
+            {
+                auto c = m.change();
+                uint64_t numElems = rnd() % 5 == 0 ? 0 : 1 + rnd() % (rnd() % 2 ? 8 : 300);
+                for (uint64_t i = 0; i < numElems; i++) {
+                    auto k = std::to_string(rnd() % 1000);
+                    c.put(k, "v" + k);
+                }
+                m.apply(c);
+            }
+
+            // Key sets overlap, and may be empty or contain keys that don't exist
+
+            std::vector<std::vector<std::string>> keySets(1 + rnd() % 20);
+            for (auto &keySet : keySets) {
+                uint64_t numKeys = rnd() % 6;
+                for (uint64_t i = 0; i < numKeys; i++) keySet.push_back(std::to_string(rnd() % 1000));
+            }
+
+            for (bool deletable : { false, true }) {
+                auto proofs = m.exportProofBatch(keySets, deletable);
+                verify(proofs.size() == keySets.size());
+
+                for (size_t i = 0; i < keySets.size(); i++) {
+                    verify(sameProof(proofs[i], m.exportProof(keySets[i], deletable)));
+                }
+            }
+        }
+
+        {
+            db.checkout();
+            auto c = db.change();
+            for (int i = 0; i < 1000; i++) c.put(std::to_string(i), std::to_string(i));
+            c.apply(txn);
+
+            auto origRoot = db.root(txn);
+
+            std::vector<std::vector<std::string>> keySets = { { "1", "2", "3" }, { "2", "nope" }, {}, { "999" }, { "1", "2", "3" } };
+            auto proofs = db.exportProofBatch(txn, keySets);
+
+            for (size_t i = 0; i < keySets.size(); i++) {
+                verify(sameProof(proofs[i], db.exportProof(txn, keySets[i])));
+            }
+
+            verify(proofs[2].strands.size() == 0 && proofs[2].cmds.size() == 0);
+
+            auto proof = proofRoundtrip(proofs[1]);
+
+            db.checkout();
+            db.importProof(txn, proof, origRoot);
+
+            std::string_view val;
+            verify(db.get(txn, "2", val) && val == "2");
+            verify(!db.get(txn, "nope", val));
+            verifyThrow(db.get(txn, "3", val), "incomplete tree");
+
+            // Witnesses are still rejected
+
+            verifyThrow(db.exportProofBatch(txn, { { "2" }, { "3" } }), "incomplete tree");
+        }
+    });
+
+
+    test("proof updater", [&]{
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        MemQuadrable full;
+        uint64_t numThrown = 0;
+
+        for (int iter = 0; iter < 300; iter++) {
+            full.clear();
+
+            std::vector<std::string> keys;
+            {
+                auto c = full.change();
+                uint64_t numElems = rnd() % 10 == 0 ? 0 : 1 + rnd() % (rnd() % 2 ? 8 : 200);
+                for (uint64_t i = 0; i < numElems; i++) {
+                    keys.push_back(std::to_string(rnd() % 1000));
+                    c.put(keys.back(), "v" + keys.back());
+                }
+                full.apply(c);
+            }
+
+            std::vector<std::string> proveKeys;
+            uint64_t numProve = 1 + rnd() % 6;
+            for (uint64_t i = 0; i < numProve; i++) proveKeys.push_back(keys.size() && rnd() % 4 ? keys[rnd() % keys.size()] : std::to_string(rnd() % 1000));
+
+            auto origRoot = full.root();
+            auto proof = proofRoundtrip(full.exportProof(proveKeys, rnd() % 2));
+
+            Quadrable::ProofUpdater updater(proof, origRoot);
+            verify(updater.root() == origRoot);
+
+            MemQuadrable partial;
+            partial.importProof(proof, origRoot);
+
+            // Several rounds, to check that deferred hashing picks up every modified node
+
+            uint64_t numRounds = 1 + rnd() % 3;
+            bool thrown = false;
+
+            for (uint64_t round = 0; round < numRounds && !thrown; round++) {
+                std::mt19937 rnd2(iter * 10 + round);
+
+                auto makeChanges = [&](auto &&c){
+                    for (auto &k : proveKeys) {
+                        if (rnd2() % 3 == 0) c.put(k, "updated" + std::to_string(round));
+                        else if (rnd2() % 2) c.del(k);
+                    }
+                    return c;
+                };
+
+                std::string partialErr, updaterErr;
+
+                try { auto c = makeChanges(partial.change()); partial.apply(c); } catch (std::exception &e) { partialErr = e.what(); }
+
+                rnd2.seed(iter * 10 + round);
+                try { auto c = makeChanges(db.change()); updater.apply(c); } catch (std::exception &e) { updaterErr = e.what(); }
+
+                verify(partialErr == updaterErr);
+
+                if (partialErr.size()) {
+                    thrown = true;
+                    numThrown++;
+                    break;
+                }
+
+                rnd2.seed(iter * 10 + round);
+                auto c = makeChanges(full.change());
+                full.apply(c);
+
+                verify(updater.root() == full.root());
+                verify(partial.root() == full.root());
+            }
+
+            if (thrown) continue;
+
+            // The updated proof can be imported and has the updated values
+
+            auto updatedProof = proofRoundtrip(updater.exportProof());
+
+            MemQuadrable fromUpdated;
+            fromUpdated.importProof(updatedProof, full.root());
+
+            for (auto &k : proveKeys) {
+                std::string_view v1, v2;
+                bool found = full.get(k, v1);
+                verify(fromUpdated.get(k, v2) == found);
+                if (found) verify(v1 == v2);
+            }
+
+            Quadrable::ProofUpdater updater2(updatedProof, full.root());
+            verify(updater2.root() == full.root());
+        }
+
+        verify(numThrown > 0);
+
+        {
+            db.checkout();
+            db.change().put(Key::fromInteger(1), "a").put(Key::fromInteger(2), "b").apply(txn);
+
+            auto proof = proofRoundtrip(db.exportProofRaw(txn, { Key::fromInteger(1) }));
+
+            Quadrable::ProofUpdater updater(proof);
+            verify(updater.root() == db.root(txn));
+            verifyThrow(Quadrable::ProofUpdater(proof, std::string(32, 'x')), "proof invalid");
+
+            auto c = db.change();
+            c.putReuse(Key::fromInteger(1), 1);
+            verifyThrow(updater.apply(c), "can't reuse nodes");
+        }
     });
 
 
@@ -1312,90 +1646,1630 @@ void doTests() {
 
 
 
-    test("memStore basic", [&]{
-        MemStore m;
+    test("compact proof encoding", [&]{
+        db.checkout();
 
-        db.withMemStore(m, [&]{
-            db.checkout();
-            db.writeToMemStore = true;
+        {
+            auto c = db.change();
+            for (uint64_t i = 1; i < 2000; i++) {
+                c.put(quadrable::Key::fromInteger(i), std::to_string(i));
+                c.put(std::string("str") + std::to_string(i), std::to_string(i));
+            }
+            c.apply(txn);
+        }
 
-            db.change()
-              .put("A", "res1")
-              .put("B", "res2")
-              .apply(txn);
+        auto origRoot = db.root(txn);
+        auto origNodeId = db.getHeadNodeId(txn);
 
-            verify(db.getHeadNodeId(txn) >= firstMemStoreNodeId);
+        auto check = [&](const Proof &proof){
+            auto regular = quadrable::transport::encodeProof(proof);
+            auto compact = quadrable::transport::encodeProof(proof, quadrable::transport::EncodingType::CompactHashedKeys);
+            verify(compact.size() <= regular.size());
 
-            std::string_view val;
-            verify(db.get(txn, "A", val));
-            verify(val == "res1");
-            verify(db.get(txn, "B", val));
-            verify(val == "res2");
+            auto decoded = quadrable::transport::decodeProof(compact);
+            verify(quadrable::transport::encodeProof(decoded) == regular);
 
-            auto stats = db.stats(txn);
-            verify(stats.numLeafNodes == 2);
-        });
+            db.checkout();
+            db.importProof(txn, decoded, origRoot);
+        };
 
-        db.writeToMemStore = false;
+        check(db.exportProofRange(txn, origNodeId, quadrable::Key::fromInteger(100), quadrable::Key::fromInteger(300)));
+        db.checkout(origNodeId);
+        check(db.exportProof(txn, { "str1", "str50", "str51", "str1999", "nonexistent" }));
+
+        {
+            Proof empty;
+            verify(quadrable::transport::decodeProof(quadrable::transport::encodeProof(empty, quadrable::transport::EncodingType::CompactHashedKeys)).strands.size() == 0);
+        }
     });
 
-    test("memStore forking from lmdb", [&]{
-        MemStore m;
 
-        db.checkout("memStore-test");
 
-        db.change()
-          .put("A", "res1")
-          .put("B", "res2")
-          .apply(txn);
+    test("chain compaction", [&]{
+        auto lastInteriorNodeId = [&]{
+            auto cursor = lmdb::cursor::open(txn, db.dbi_nodesInterior);
+            std::string_view k, v;
+            verify(cursor.get(k, v, MDB_LAST));
+            return lmdb::from_sv<uint64_t>(k);
+        };
 
-        uint64_t origNode = db.getHeadNodeId(txn);
+        std::vector<uint64_t> nums = { 0, 1, 2, 3, 1000, 1001, 1'000'000'000, 1'000'000'001 };
 
-        db.withMemStore(m, [&]{
-            db.checkout("memStore-test");
-            db.writeToMemStore = true;
+        db.checkout();
 
-            verifyThrow(db.change().put("C", "res3").apply(txn), "attempted to store MemStore node into LMDB");
+        {
+            auto c = db.change();
+            for (auto n : nums) c.put(quadrable::Key::fromInteger(n), std::to_string(n));
+            c.put("hello", "world");
+            c.apply(txn);
+        }
 
-            db.fork(txn);
-            db.change().put("C", "res3").apply(txn);
+        auto origRoot = db.root(txn);
+        auto origNodeId = db.getHeadNodeId(txn);
+        auto origStats = db.stats(txn);
+        auto origProof = quadrable::transport::encodeProof(db.exportProofRaw(txn, { quadrable::Key::fromInteger(1001), quadrable::Key::fromInteger(5) }));
 
-            verify(db.getHeadNodeId(txn) >= firstMemStoreNodeId);
+        uint64_t firstNewNodeId = lastInteriorNodeId() + 1;
 
-            std::string_view val;
-            verify(db.get(txn, "A", val));
-            verify(val == "res1");
-            verify(db.get(txn, "B", val));
-            verify(val == "res2");
-            verify(db.get(txn, "C", val));
-            verify(val == "res3");
+        db.compactChains(txn);
+        auto compactedNodeId = db.getHeadNodeId(txn);
+        verify(compactedNodeId != origNodeId);
+        verify(db.root(txn) == origRoot);
 
-            auto stats = db.stats(txn);
-            verify(stats.numLeafNodes == 3);
-        });
+        auto compactedStats = db.stats(txn);
+        verify(compactedStats.numNodes == origStats.numNodes);
+        verify(compactedStats.maxDepth == origStats.maxDepth);
+        verify(compactedStats.numBytes < origStats.numBytes);
 
-        db.writeToMemStore = false;
+        // Idempotent
+        verify(db.compactChains(txn).nodeId == compactedNodeId);
 
-        db.checkout(origNode);
+        std::string_view val;
+        for (auto n : nums) {
+            verify(db.getRaw(txn, quadrable::Key::fromInteger(n).sv(), val));
+            verify(val == std::to_string(n));
+        }
+        verify(db.get(txn, "hello", val) && val == "world");
+        verify(!db.getRaw(txn, quadrable::Key::fromInteger(5).sv(), val));
 
-        auto stats = db.stats(txn);
-        verify(stats.numLeafNodes == 2);
-    });
+        // Proofs are byte-identical
+        verify(quadrable::transport::encodeProof(db.exportProofRaw(txn, { quadrable::Key::fromInteger(1001), quadrable::Key::fromInteger(5) })) == origProof);
 
-    test("memStore-only env", [&]{
-        quadrable::Quadrable db2;
-        db2.addMemStore();
-        db2.writeToMemStore = true;
-        lmdb::txn txn2(nullptr);
+        // Updates inside a chain keep the untouched levels in the chain record
+        auto update = [&]{
+            auto c = db.change();
+            c.put(quadrable::Key::fromInteger(500'000), "A");
+            c.del(quadrable::Key::fromInteger(1001));
+            c.apply(txn);
+        };
 
-        db2.checkout();
+        db.checkout(origNodeId);
+        db.fork(txn);
+        update();
+        auto updatedRoot = db.root(txn);
+        uint64_t origUpdatedNodeId = db.getHeadNodeId(txn);
 
-        db2.change()
-           .put("A", "res1")
-           .put("B", "res2")
-           .apply(txn2);
+        db.checkout(compactedNodeId);
+        db.fork(txn);
+        update();
+        verify(db.root(txn) == updatedRoot);
+        uint64_t updatedNodeId = db.getHeadNodeId(txn);
 
-        std::string_view val;
+        // Traversals parse every level of a chain from one read of its record
+        {
+            auto reads = [&](auto f){
+                uint64_t before = db.nodesRead;
+                f();
+                return db.nodesRead - before;
+            };
+
+            auto getReads = [&](uint64_t nodeId){
+                return reads([&]{ db.checkout(nodeId); verify(db.getRaw(txn, quadrable::Key::fromInteger(1'000'000'001).sv(), val)); });
+            };
+
+            uint64_t origGetReads = getReads(origNodeId), compactedGetReads = getReads(compactedNodeId);
+            verify(compactedGetReads * 4 < origGetReads);
+
+            uint64_t origDiffReads = reads([&]{ db.diff(txn, origNodeId, origUpdatedNodeId); });
+            uint64_t compactedDiffReads = reads([&]{ db.diff(txn, compactedNodeId, updatedNodeId); });
+            verify(compactedDiffReads < origDiffReads); // the updated tree's new levels are regular branches
+
+            db.checkout(updatedNodeId);
+        }
+
+        // GC of the compaction's records preserves chain records referenced only by their inner levels
+        {
+            quadrable::Quadrable::GarbageCollector gc(db);
+            gc.markTree(txn, updatedNodeId);
+            auto gcStats = gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= firstNewNodeId; });
+            verify(gcStats.garbage > 0);
+            gc.deleteNodes(txn);
+        }
+
+        verify(db.root(txn) == updatedRoot);
+        verify(db.getRaw(txn, quadrable::Key::fromInteger(500'000).sv(), val) && val == "A");
+        verify(db.getRaw(txn, quadrable::Key::fromInteger(1'000'000'001).sv(), val));
+        verify(db.stats(txn).numLeafNodes == nums.size() + 1);
+    });
+
+
+
+    test("inline leaves", [&]{
+        auto lastNodeId = [&](lmdb::dbi dbi){
+            auto cursor = lmdb::cursor::open(txn, dbi);
+            std::string_view k, v;
+            verify(cursor.get(k, v, MDB_LAST));
+            return lmdb::from_sv<uint64_t>(k);
+        };
+
+        db.checkout();
+
+        {
+            auto c = db.change();
+            for (int i = 0; i < 200; i++) c.put(std::to_string(i), std::string(i % 64, 'x'));
+            c.put("big", std::string(1000, 'y'));
+            c.apply(txn);
+        }
+
+        uint64_t firstNewLeafNodeId = lastNodeId(db.dbi_nodesLeaf) - 200;
+        uint64_t firstNewInteriorNodeId = lastNodeId(db.dbi_nodesInterior) + 1;
+
+        auto origRoot = db.root(txn);
+        auto origNodeId = db.getHeadNodeId(txn);
+        auto origStats = db.stats(txn);
+        auto origProof = quadrable::transport::encodeProof(db.exportProof(txn, { "1", "big", "nonexistent" }));
+
+        auto getAll = [&]{
+            auto query = db.get(txn, { "0", "1", "63", "64", "199", "big", "nonexistent" });
+            verify(query["0"].exists && query["0"].val == "");
+            verify(query["63"].exists && query["63"].val == std::string(63, 'x'));
+            verify(query["64"].exists && query["64"].val == "");
+            verify(query["199"].exists && query["199"].val == std::string(199 % 64, 'x'));
+            verify(query["big"].exists && query["big"].val.size() == 1000);
+            verify(!query["nonexistent"].exists);
+        };
+
+        uint64_t origReads = db.nodesRead;
+        getAll();
+        origReads = db.nodesRead - origReads;
+
+        db.inlineLeaves(txn, 63);
+        auto inlinedNodeId = db.getHeadNodeId(txn);
+        verify(inlinedNodeId != origNodeId);
+        verify(db.root(txn) == origRoot);
+
+        auto inlinedStats = db.stats(txn);
+        verify(inlinedStats.numNodes == origStats.numNodes);
+        verify(inlinedStats.numLeafNodes == origStats.numLeafNodes);
+        verify(inlinedStats.maxDepth == origStats.maxDepth);
+
+        // Idempotent
+        verify(db.inlineLeaves(txn, 63).nodeId == inlinedNodeId);
+
+        uint64_t inlinedReads = db.nodesRead;
+        getAll();
+        inlinedReads = db.nodesRead - inlinedReads;
+        verify(inlinedReads < origReads);
+
+        {
+            uint64_t nodeId;
+            std::string_view val;
+            verify(db.get(txn, "5", val, &nodeId) && val == "xxxxx");
+            verify(nodeId >= quadrable::firstInteriorNodeId && (nodeId & quadrable::chainOffsetMask));
+            verify(db.get(txn, "big", val, &nodeId) && nodeId < quadrable::firstInteriorNodeId);
+        }
+
+        // Proofs are byte-identical
+        verify(quadrable::transport::encodeProof(db.exportProof(txn, { "1", "big", "nonexistent" })) == origProof);
+
+        // Updates split and delete inlined leaves
+        auto update = [&]{
+            db.change()
+              .put("new1", "A")
+              .put("new2", std::string(100, 'z'))
+              .put("7", "updated")
+              .del("8")
+              .apply(txn);
+        };
+
+        db.checkout(origNodeId);
+        db.fork(txn);
+        update();
+        auto updatedRoot = db.root(txn);
+
+        db.checkout(inlinedNodeId);
+        db.fork(txn);
+        update();
+        verify(db.root(txn) == updatedRoot);
+        uint64_t updatedNodeId = db.getHeadNodeId(txn);
+
+        // The separate records of the inlined leaves can be GCed, while inline branch records referenced only by their leaves are kept
+        {
+            quadrable::Quadrable::GarbageCollector gc(db);
+            gc.markTree(txn, updatedNodeId);
+            auto gcStats = gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= quadrable::firstInteriorNodeId ? nodeId >= firstNewInteriorNodeId : nodeId >= firstNewLeafNodeId; });
+            verify(gcStats.garbage > 150);
+            gc.deleteNodes(txn);
+        }
+
+        verify(db.root(txn) == updatedRoot);
+        getAll();
+
+        auto query = db.get(txn, { "new1", "new2", "7", "8" });
+        verify(query["new1"].val == "A");
+        verify(query["new2"].val.size() == 100);
+        verify(query["7"].val == "updated");
+        verify(!query["8"].exists);
+
+        // Chains can be compacted beneath inline branches
+        db.compactChains(txn);
+        verify(db.root(txn) == updatedRoot);
+        getAll();
+
+        // Tracked keys are copied to the inlined leaves
+        Quadrable dbk;
+        dbk.trackKeys = true;
+        dbk.init(txn);
+        dbk.checkout();
+
+        {
+            auto c = dbk.change();
+            for (int i = 0; i < 20; i++) c.put(std::string("key") + std::to_string(i), std::to_string(i));
+            c.apply(txn);
+        }
+
+        dbk.inlineLeaves(txn, 100);
+
+        uint64_t numKeyed = 0;
+
+        dbk.walkTree(txn, [&](auto &node, uint64_t){
+            if (!node.isLeaf()) return true;
+            verify(node.inlined);
+            std::string_view leafKey;
+            verify(dbk.getLeafKey(txn, node.nodeId, leafKey));
+            verify(Key::hash(leafKey) == node.key());
+            numKeyed++;
+            return true;
+        });
+
+        verify(numKeyed == 20);
+    });
+
+
+
+    test("page packing", [&]{
+        auto lastInteriorNodeId = [&]{
+            auto cursor = lmdb::cursor::open(txn, db.dbi_nodesInterior);
+            std::string_view k, v;
+            verify(cursor.get(k, v, MDB_LAST));
+            return lmdb::from_sv<uint64_t>(k);
+        };
+
+        db.checkout();
+
+        {
+            auto c = db.change();
+            for (int i = 0; i < 1000; i++) c.put(std::to_string(i), std::to_string(i * 7));
+            c.put(quadrable::Key::fromInteger(1), "int1");
+            c.put(quadrable::Key::fromInteger(2), "int2");
+            c.apply(txn);
+        }
+
+        auto origRoot = db.root(txn);
+        auto origNodeId = db.getHeadNodeId(txn);
+        auto origStats = db.stats(txn);
+        auto origProof = quadrable::transport::encodeProof(db.exportProof(txn, { "1", "500", "nonexistent" }));
+
+        std::set<std::string> keys;
+        for (int i = 0; i < 1000; i += 3) keys.insert(std::to_string(i));
+        keys.insert("nonexistent");
+
+        auto getAll = [&]{
+            auto query = db.get(txn, keys);
+            for (auto &[k, res] : query) {
+                if (k == "nonexistent") verify(!res.exists);
+                else verify(res.exists && res.val == std::to_string(std::stoi(k) * 7));
+            }
+
+            std::string_view val;
+            verify(db.getRaw(txn, quadrable::Key::fromInteger(2).sv(), val) && val == "int2");
+        };
+
+        auto reads = [&](auto f){
+            uint64_t before = db.nodesRead;
+            f();
+            return db.nodesRead - before;
+        };
+
+        auto seekAll = [&]{
+            for (auto &k : keys) {
+                if (k == "nonexistent") continue;
+                auto it = db.iterate(txn, Key::hash(k));
+                verify(!it.atEnd() && it.get().leafVal() == std::to_string(std::stoi(k) * 7));
+            }
+        };
+
+        uint64_t origReads = reads(getAll);
+        uint64_t origSeekReads = reads(seekAll);
+
+        verifyThrow(db.packPages(txn, 9), "page levels must be between 1 and 8");
+
+        for (uint64_t levels : { 4, 8 }) {
+            db.checkout(origNodeId);
+            db.fork(txn);
+
+            uint64_t firstNewNodeId = lastInteriorNodeId() + 1;
+
+            db.packPages(txn, levels);
+            auto packedNodeId = db.getHeadNodeId(txn);
+            verify(packedNodeId != origNodeId);
+            verify(db.root(txn) == origRoot);
+
+            auto packedStats = db.stats(txn);
+            verify(packedStats.numNodes == origStats.numNodes);
+            verify(packedStats.numLeafNodes == origStats.numLeafNodes);
+            verify(packedStats.maxDepth == origStats.maxDepth);
+
+            // Idempotent
+            verify(db.packPages(txn, levels).nodeId == packedNodeId);
+
+            uint64_t packedReads = reads(getAll);
+            verify(packedReads * 2 < origReads);
+
+            // Iterators and updates parse the branches within a page from one read of it
+            verify(reads(seekAll) * 2 < origSeekReads);
+
+            // Proofs are byte-identical
+            verify(quadrable::transport::encodeProof(db.exportProof(txn, { "1", "500", "nonexistent" })) == origProof);
+
+            // Updates inside a page keep referencing the untouched parts of it
+            auto update = [&]{
+                db.change()
+                  .put("new1", "A")
+                  .put("3", "21")
+                  .del("4")
+                  .apply(txn);
+            };
+
+            db.checkout(origNodeId);
+            db.fork(txn);
+            uint64_t origUpdateReads = reads(update);
+            auto updatedRoot = db.root(txn);
+
+            db.checkout(packedNodeId);
+            db.fork(txn);
+            verify(reads(update) < origUpdateReads);
+            verify(db.root(txn) == updatedRoot);
+            uint64_t updatedNodeId = db.getHeadNodeId(txn);
+
+            {
+                quadrable::Quadrable::GarbageCollector gc(db);
+                gc.markTree(txn, updatedNodeId);
+                gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= firstNewNodeId; });
+                gc.deleteNodes(txn);
+            }
+
+            verify(db.root(txn) == updatedRoot);
+            keys.erase("4");
+            getAll();
+            keys.insert("4");
+
+            // Re-packing the updated tree
+            db.packPages(txn, levels);
+            verify(db.root(txn) == updatedRoot);
+        }
+    });
+
+
+
+    test("compact leaves", [&]{
+        auto build = [&]{
+            db.checkout();
+            auto c = db.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::string(i % 10, 'v'));
+            c.apply(txn);
+        };
+
+        build();
+        auto origRoot = db.root(txn);
+        auto origStats = db.stats(txn);
+        auto origProof = quadrable::transport::encodeProof(db.exportProof(txn, { "1", "2", "nonexistent" }));
+
+        db.omitLeafHashes = true;
+        build();
+        db.omitLeafHashes = false;
+
+        verify(db.root(txn) == origRoot);
+
+        auto compactStats = db.stats(txn);
+        verify(compactStats.numNodes == origStats.numNodes);
+        verify(compactStats.numBytes == origStats.numBytes - 100 * 32);
+
+        uint64_t nodeId;
+        std::string_view val;
+        verify(db.get(txn, "5", val, &nodeId) && val == "vvvvv");
+
+        {
+            Quadrable::ParsedNode node(&db, txn, nodeId);
+            verify(node.nodeType == quadrable::NodeType::Leaf && node.leafHashOmitted);
+            verify(node.raw.size() == 8 + 32 + 5);
+            verify(node.nodeHash() == Quadrable::BuiltNode::newLeaf(&db, txn, Key::hash("5"), "vvvvv").nodeHash.sv());
+        }
+
+        verify(quadrable::transport::encodeProof(db.exportProof(txn, { "1", "2", "nonexistent" })) == origProof);
+
+        // Updates mix the two formats
+        db.fork(txn);
+        db.change().put("new", "A").put("7", "B").del("8").apply(txn);
+        auto updatedRoot = db.root(txn);
+
+        build();
+        db.change().put("new", "A").put("7", "B").del("8").apply(txn);
+        verify(db.root(txn) == updatedRoot);
+
+        // Compact leaves can be inlined
+        db.omitLeafHashes = true;
+        build();
+        db.omitLeafHashes = false;
+        db.inlineLeaves(txn, 100);
+        verify(db.root(txn) == origRoot);
+        verify(db.get(txn, "9", val) && val == "vvvvvvvvv");
+        verify(quadrable::transport::encodeProof(db.exportProof(txn, { "1", "2", "nonexistent" })) == origProof);
+    });
+
+
+
+    test("dedup", [&]{
+        Quadrable dbd;
+        dbd.dedupNodes = true;
+        dbd.init(txn);
+
+        auto lastNodeId = [&](lmdb::dbi dbi){
+            auto cursor = lmdb::cursor::open(txn, dbi);
+            std::string_view k, v;
+            return cursor.get(k, v, MDB_LAST) ? lmdb::from_sv<uint64_t>(k) : 0;
+        };
+
+        uint64_t firstNewLeafNodeId = lastNodeId(dbd.dbi_nodesLeaf) + 1;
+        uint64_t firstNewInteriorNodeId = lastNodeId(dbd.dbi_nodesInterior) + 1;
+
+        auto build = [&](std::string_view head){
+            dbd.checkout(head);
+            auto c = dbd.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::to_string(i * 3));
+            c.apply(txn);
+        };
+
+        build("dedupA");
+        auto nodeIdA = dbd.getHeadNodeId(txn);
+
+        // Independently importing the same data re-uses the existing nodes
+
+        uint64_t nodesWritten = dbd.nodesWritten;
+        build("dedupB");
+        verify(dbd.nodesWritten == nodesWritten);
+        verify(dbd.getHeadNodeId(txn) == nodeIdA);
+
+        // A modification shares all untouched sub-trees
+
+        dbd.checkout("dedupC");
+        {
+            auto c = dbd.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), i == 50 ? "modified" : std::to_string(i * 3));
+            c.apply(txn);
+        }
+        verify(dbd.nodesWritten - nodesWritten <= dbd.stats(txn).maxDepth + 2);
+
+        // Partial trees from proofs are stored separately, since they contain witnesses
+
+        auto proof = dbd.exportProof(txn, { "1", "2" });
+        dbd.checkout("dedupD");
+        dbd.importProof(txn, proof);
+        verify(dbd.rootKey(txn) == dbd.rootKey(txn, dbd.getHeadNodeId(txn, "dedupC")));
+        verify(dbd.getHeadNodeId(txn) != dbd.getHeadNodeId(txn, "dedupC"));
+        std::string_view val;
+        verifyThrow(dbd.get(txn, "3", val), "encountered witness node");
+
+        // Offline pass collapses trees written without the index
+
+        dbd.dedupNodes = false;
+        build("dedupE");
+        build("dedupF");
+        dbd.dedupNodes = true;
+
+        verify(dbd.getHeadNodeId(txn, "dedupE") != nodeIdA);
+        verify(dbd.getHeadNodeId(txn, "dedupF") != nodeIdA);
+
+        dbd.dedupHeads(txn);
+
+        verify(dbd.getHeadNodeId(txn, "dedupE") == nodeIdA);
+        verify(dbd.getHeadNodeId(txn, "dedupF") == nodeIdA);
+        verify(dbd.rootKey(txn, dbd.getHeadNodeId(txn, "dedupD")) == dbd.rootKey(txn, dbd.getHeadNodeId(txn, "dedupC")));
+
+        dbd.checkout("dedupF");
+        verify(dbd.get(txn, "99", val) && val == "297");
+
+        {
+            Quadrable::GarbageCollector gc(dbd);
+            gc.markAllHeads(txn);
+            auto gcStats = gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= firstInteriorNodeId ? nodeId >= firstNewInteriorNodeId : nodeId >= firstNewLeafNodeId; });
+            verify(gcStats.garbage >= 2 * 199);
+            gc.deleteNodes(txn);
+        }
+
+        // Index entries of collected nodes are removed
+
+        {
+            auto cursor = lmdb::cursor::open(txn, dbd.dbi_dedup);
+            std::string_view k, v;
+            for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+                Quadrable::ParsedNode node(&dbd, txn, lmdb::from_sv<uint64_t>(v));
+                verify(node.nodeId < firstInteriorNodeId ? node.nodeHash() == k : Key::hash(node.raw).sv() == k);
+            }
+        }
+
+        dbd.checkout("dedupB");
+        verify(dbd.get(txn, "99", val) && val == "297");
+
+        // Flushing a MemStore without a base replaces leaf witnesses with indexed leaves, but not branch witnesses
+
+        {
+            std::vector<std::string> keys = { "1", "2", "3", "4", "5" };
+            auto deletableProof = dbd.exportProof(txn, keys, true);
+            uint64_t numWitnessLeaves = 0;
+            for (auto &strand : deletableProof.strands) numWitnessLeaves += strand.strandType == ProofStrand::Type::WitnessLeaf;
+            verify(numWitnessLeaves > 0);
+
+            MemStore m;
+            uint64_t newNodeId;
+
+            dbd.withMemStore(m, [&]{
+                dbd.checkout();
+                dbd.writeToMemStore = true;
+                dbd.importProof(txn, deletableProof);
+                newNodeId = dbd.flushMemStore(txn, dbd.getHeadNodeId(txn)).nodeId;
+            });
+            dbd.writeToMemStore = false;
+
+            dbd.checkout(newNodeId);
+            verify(dbd.rootKey(txn) == dbd.rootKey(txn, nodeIdA));
+
+            uint64_t numFound = 0, numWitnesses = 0;
+
+            for (int i = 0; i < 100; i++) {
+                try {
+                    if (dbd.get(txn, std::to_string(i), val) && val == std::to_string(i * 3)) numFound++;
+                } catch (std::exception &) {
+                    numWitnesses++;
+                }
+            }
+
+            verify(numFound == keys.size() + numWitnessLeaves);
+            verify(numWitnesses > 0);
+        }
+
+        for (auto head : { "dedupA", "dedupB", "dedupC", "dedupD", "dedupE", "dedupF" }) dbd.dbi_head.del(txn, head);
+    });
+
+
+
+    test("dedup compacted trees", [&]{
+        Quadrable dbd;
+        dbd.dedupNodes = true;
+        dbd.init(txn);
+
+        auto lastNodeId = [&](lmdb::dbi dbi){
+            auto cursor = lmdb::cursor::open(txn, dbi);
+            std::string_view k, v;
+            return cursor.get(k, v, MDB_LAST) ? lmdb::from_sv<uint64_t>(k) : 0;
+        };
+
+        uint64_t firstNewLeafNodeId = lastNodeId(dbd.dbi_nodesLeaf) + 1;
+        uint64_t firstNewInteriorNodeId = lastNodeId(dbd.dbi_nodesInterior) + 1;
+
+        auto build = [&](std::string_view head){
+            dbd.checkout(head);
+            auto c = dbd.change();
+            for (uint64_t i = 0; i < 4; i++) c.put(quadrable::Key::fromInteger(i), std::to_string(i));
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::to_string(i * 3));
+            c.apply(txn);
+        };
+
+        build("dedupChains");
+        dbd.compactChains(txn);
+
+        build("dedupPages");
+        dbd.packPages(txn, 8);
+
+        // Chain and page records can be larger than the maximum LMDB key size
+
+        {
+            size_t maxRecordSize = 0;
+            auto cursor = lmdb::cursor::open(txn, dbd.dbi_nodesInterior);
+            std::string_view k, v;
+            for (bool found = cursor.get(k, v, MDB_LAST); found && lmdb::from_sv<uint64_t>(k) >= firstNewInteriorNodeId; found = cursor.get(k, v, MDB_PREV)) {
+                maxRecordSize = std::max(maxRecordSize, v.size());
+            }
+            verify(maxRecordSize > 511);
+        }
+
+        dbd.dedupHeads(txn);
+
+        {
+            auto cursor = lmdb::cursor::open(txn, dbd.dbi_dedup);
+            std::string_view k, v;
+            for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) verify(k.size() == 32);
+        }
+
+        std::string_view val;
+
+        for (auto head : { "dedupChains", "dedupPages" }) {
+            dbd.checkout(head);
+            verify(dbd.get(txn, "99", val) && val == "297");
+            verify(dbd.getRaw(txn, quadrable::Key::fromInteger(3).sv(), val) && val == "3");
+        }
+
+        // Collecting the compacted records removes their index entries
+
+        dbd.checkout();
+        for (auto head : { "dedupChains", "dedupPages" }) dbd.dbi_head.del(txn, head);
+
+        {
+            Quadrable::GarbageCollector gc(dbd);
+            gc.markAllHeads(txn);
+            auto gcStats = gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= firstInteriorNodeId ? nodeId >= firstNewInteriorNodeId : nodeId >= firstNewLeafNodeId; });
+            verify(gcStats.garbage > 0);
+            gc.deleteNodes(txn);
+        }
+
+        {
+            auto cursor = lmdb::cursor::open(txn, dbd.dbi_dedup);
+            std::string_view k, v;
+            for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+                uint64_t nodeId = lmdb::from_sv<uint64_t>(v);
+                verify(nodeId >= firstInteriorNodeId ? nodeId < firstNewInteriorNodeId : nodeId < firstNewLeafNodeId);
+            }
+        }
+    });
+
+
+
+    test("pruning", [&]{
+        auto lastNodeId = [&](lmdb::dbi dbi){
+            auto cursor = lmdb::cursor::open(txn, dbi);
+            std::string_view k, v;
+            return cursor.get(k, v, MDB_LAST) ? lmdb::from_sv<uint64_t>(k) : 0;
+        };
+
+        uint64_t firstNewLeafNodeId = lastNodeId(db.dbi_nodesLeaf) + 1;
+        uint64_t firstNewInteriorNodeId = lastNodeId(db.dbi_nodesInterior) + 1;
+
+        db.checkout("pruneFull");
+        {
+            auto c = db.change();
+            for (int i = 0; i < 200; i++) c.put(std::to_string(i), std::to_string(i * 5));
+            c.apply(txn);
+        }
+
+        auto origRoot = db.root(txn);
+        auto origStats = db.stats(txn);
+
+        // Keep the first half of the key-space
+
+        Key begin = Key::null();
+        Key end = Key::max();
+        end.setBit(0, 0);
+
+        auto inRange = [&](int i){ return Key::hash(std::to_string(i)) <= end; };
+
+        db.fork(txn, "pruneRange");
+        db.prune(txn, begin, end);
+        verify(db.root(txn) == origRoot);
+
+        auto stats = db.stats(txn);
+        verify(stats.numLeafNodes > 0 && stats.numLeafNodes < origStats.numLeafNodes);
+        verify(stats.numNodes < origStats.numNodes);
+
+        std::string_view val;
+        std::vector<std::string> keptKeys;
+
+        for (int i = 0; i < 200; i++) {
+            if (inRange(i)) {
+                verify(db.get(txn, std::to_string(i), val) && val == std::to_string(i * 5));
+                keptKeys.push_back(std::to_string(i));
+            } else {
+                verifyThrow(db.get(txn, std::to_string(i), val), "encountered witness node");
+            }
+        }
+
+        // Proofs and updates for kept keys are the same as on the full tree
+
+        auto pruneProof = transport::encodeProof(db.exportProof(txn, keptKeys));
+        db.checkout("pruneFull");
+        verify(pruneProof == transport::encodeProof(db.exportProof(txn, keptKeys)));
+
+        db.checkout("pruneRange");
+        db.change().put(keptKeys[0], "updated").del(keptKeys[1]).apply(txn);
+        auto prunedUpdatedRoot = db.root(txn);
+
+        db.fork(txn, "pruneCheck");
+        db.checkout("pruneFull");
+        db.fork(txn, "pruneCheck");
+        db.change().put(keptKeys[0], "updated").del(keptKeys[1]).apply(txn);
+        verify(db.root(txn) == prunedUpdatedRoot);
+
+        // Pruning everything leaves a single witness
+
+        db.checkout("pruneFull");
+        db.fork(txn, "pruneAll");
+        db.prune(txn, [](const Quadrable::ParsedNode &){ return false; });
+        verify(db.root(txn) == origRoot);
+        verify(db.stats(txn).numNodes == 1);
+        verify(db.stats(txn).numWitnessNodes == 1);
+
+        // Keeping selected leaves
+
+        db.checkout("pruneFull");
+        db.fork(txn, "pruneSome");
+        db.prune(txn, [](const Quadrable::ParsedNode &node){ return node.leafKeyHash() == Key::hash("5").sv() || node.leafKeyHash() == Key::hash("10").sv(); });
+        verify(db.root(txn) == origRoot);
+        verify(db.stats(txn).numLeafNodes == 2);
+        verify(db.get(txn, "5", val) && val == "25");
+        verify(db.get(txn, "10", val) && val == "50");
+        verifyThrow(db.get(txn, "11", val), "encountered witness node");
+
+        // Once the full tree is gone, GC frees the pruned nodes
+
+        for (auto head : { "pruneFull", "pruneCheck" }) db.dbi_head.del(txn, head);
+
+        {
+            Quadrable::GarbageCollector gc(db);
+            gc.markAllHeads(txn);
+            auto gcStats = gc.sweep(txn, [&](uint64_t nodeId){ return nodeId >= firstInteriorNodeId ? nodeId >= firstNewInteriorNodeId : nodeId >= firstNewLeafNodeId; });
+            verify(gcStats.garbage >= origStats.numLeafNodes - stats.numLeafNodes);
+            gc.deleteNodes(txn);
+        }
+
+        db.checkout("pruneSome");
+        verify(db.root(txn) == origRoot);
+        verify(db.get(txn, "10", val) && val == "50");
+
+        db.checkout("pruneRange");
+        verify(db.root(txn) == prunedUpdatedRoot);
+        verify(db.get(txn, keptKeys[0], val) && val == "updated");
+
+        for (auto head : { "pruneRange", "pruneAll", "pruneSome" }) db.dbi_head.del(txn, head);
+    });
+
+
+    test("head history", [&]{
+        Quadrable dbh;
+        dbh.keepHeadHistory = true;
+        dbh.init(txn);
+
+        auto lastNodeId = [&](lmdb::dbi dbi){
+            auto cursor = lmdb::cursor::open(txn, dbi);
+            std::string_view k, v;
+            return cursor.get(k, v, MDB_LAST) ? lmdb::from_sv<uint64_t>(k) : 0;
+        };
+
+        uint64_t firstNewLeafNodeId = lastNodeId(dbh.dbi_nodesLeaf) + 1;
+        uint64_t firstNewInteriorNodeId = lastNodeId(dbh.dbi_nodesInterior) + 1;
+        auto isNew = [&](uint64_t nodeId){ return nodeId >= firstInteriorNodeId ? nodeId >= firstNewInteriorNodeId : nodeId >= firstNewLeafNodeId; };
+
+        auto garbage = [&](bool markHistory){
+            Quadrable::GarbageCollector gc(dbh);
+            gc.markAllHeads(txn);
+            if (markHistory) gc.markAllHeadHistory(txn);
+            return gc.sweep(txn, isNew).garbage;
+        };
+
+        std::vector<std::string> roots;
+        std::string_view val;
+
+        dbh.checkout("historyA");
+        verify(dbh.getLatestHeadVersion(txn, "historyA") == 0);
+
+        for (int i = 0; i < 5; i++) {
+            dbh.change().put("v", std::to_string(i)).put(std::string("k") + std::to_string(i), "x").apply(txn);
+            roots.push_back(dbh.root(txn));
+        }
+
+        verify(dbh.getLatestHeadVersion(txn, "historyA") == 5);
+
+        {
+            auto history = dbh.getHeadHistory(txn, "historyA");
+            verify(history.size() == 5);
+            for (uint64_t i = 0; i < 5; i++) verify(history[i].version == i + 1);
+            verify(history.back().nodeId == dbh.getHeadNodeId(txn));
+        }
+
+        // New heads start at version 1
+
+        dbh.fork(txn, "historyB");
+        verify(dbh.getLatestHeadVersion(txn, "historyB") == 1);
+        verify(dbh.getHeadVersion(txn, "historyB", 1)->nodeId == dbh.getHeadNodeId(txn, "historyA"));
+
+        // Old versions are protected from GC only by their history entries
+
+        verify(garbage(true) == 0);
+        verify(garbage(false) > 0);
+
+        // Old versions can be checked out, and updates to detached heads aren't recorded
+
+        dbh.checkoutVersion(txn, "historyA", 2);
+        verify(dbh.root(txn) == roots[1]);
+        verify(dbh.get(txn, "v", val) && val == "1");
+        verify(!dbh.get(txn, "k2", val));
+
+        dbh.change().put("v", "detached").apply(txn);
+        verify(dbh.getLatestHeadVersion(txn, "historyA") == 5);
+
+        // Keep the last 2 versions of each head
+
+        {
+            Quadrable::RetentionPolicy policy;
+            policy.keepLast = 2;
+            verify(dbh.pruneHeadHistory(txn, policy) == 3);
+        }
+
+        verify(!dbh.getHeadVersion(txn, "historyA", 3));
+        verify(dbh.getHeadVersion(txn, "historyA", 4));
+        verify(dbh.getHeadVersion(txn, "historyB", 1));
+        verifyThrow(dbh.checkoutVersion(txn, "historyA", 1), "not found");
+
+        {
+            Quadrable::GarbageCollector gc(dbh);
+            gc.markAllHeads(txn);
+            gc.markAllHeadHistory(txn);
+            verify(gc.sweep(txn, isNew).garbage > 0);
+            gc.deleteNodes(txn);
+        }
+
+        dbh.checkoutVersion(txn, "historyA", 4);
+        verify(dbh.root(txn) == roots[3]);
+        verify(dbh.get(txn, "v", val) && val == "3");
+
+        // Numbering continues after pruning. Versions replaced within the time window are kept.
+
+        dbh.checkout("historyA");
+        for (int i = 5; i < 8; i++) dbh.change().put("v", std::to_string(i)).apply(txn);
+        verify(dbh.getLatestHeadVersion(txn, "historyA") == 8);
+
+        uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+        {
+            Quadrable::RetentionPolicy policy;
+            policy.keepLast = 1;
+            policy.keepSeconds = 3600;
+
+            verify(dbh.pruneHeadHistory(txn, policy, now) == 0);
+            verify(dbh.pruneHeadHistory(txn, policy, now + 7200) == 4);
+        }
+
+        {
+            auto history = dbh.getHeadHistory(txn, "historyA");
+            verify(history.size() == 1);
+            verify(history[0].version == 8);
+        }
+
+        for (auto head : { "historyA", "historyB" }) {
+            dbh.dbi_head.del(txn, head);
+            dbh.deleteHeadHistory(txn, head);
+            verify(dbh.getLatestHeadVersion(txn, head) == 0);
+        }
+    });
+
+
+    test("apply stats", [&]{
+        db.checkout();
+
+        ApplyStats stats;
+        {
+            auto c = db.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), "v");
+            c.apply(txn, &stats);
+        }
+
+        auto treeStats = db.stats(txn);
+        verify(stats.applies == 1);
+        verify(stats.leavesCreated == 100);
+        verify(stats.branchesCreated == treeStats.numBranchNodes);
+        verify(stats.bytesWritten == treeStats.numBytes);
+        verify(stats.hashes == 2 * 100 + treeStats.numBranchNodes);
+        verify(stats.nodesReused == 0 && stats.nodesOrphaned == 0);
+        verify(stats.wallTimeNs >= stats.hashTimeNs);
+
+        // Created and orphaned counts match the difference between the trees
+
+        auto nodeIds = [&]{
+            std::set<uint64_t> output;
+            db.walkTree(txn, [&](Quadrable::ParsedNode &node, uint64_t){
+                if (!node.isEmpty()) output.insert(node.nodeId);
+                return true;
+            });
+            return output;
+        };
+
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        for (int iter = 0; iter < 50; iter++) {
+            auto before = nodeIds();
+
+            ApplyStats s;
+            {
+                auto c = db.change();
+                uint64_t numUpdates = 1 + rnd() % 20;
+                for (uint64_t i = 0; i < numUpdates; i++) {
+                    auto k = std::to_string(rnd() % 150);
+                    if (rnd() % 3 == 0) c.del(k);
+                    else c.put(k, std::to_string(rnd()));
+                }
+                c.apply(txn, &s);
+            }
+
+            auto after = nodeIds();
+
+            uint64_t created = 0, orphaned = 0;
+            for (auto id : after) if (!before.count(id)) created++;
+            for (auto id : before) if (!after.count(id)) orphaned++;
+
+            verify(s.leavesCreated + s.branchesCreated == created);
+            verify(s.nodesOrphaned == orphaned);
+            verify(s.nodesReused <= s.branchesCreated + 1);
+
+            stats.add(s);
+        }
+
+        verify(stats.applies == 51);
+
+        // Stats aren't collected unless requested
+        uint64_t nodesWritten = db.nodesWritten;
+        db.put(txn, "a", "b");
+        verify(db.nodesWritten > nodesWritten);
+        verify(stats.applies == 51);
+    });
+
+
+
+    test("memStore basic", [&]{
+        MemStore m;
+
+        db.withMemStore(m, [&]{
+            db.checkout();
+            db.writeToMemStore = true;
+
+            db.change()
+              .put("A", "res1")
+              .put("B", "res2")
+              .apply(txn);
+
+            verify(db.getHeadNodeId(txn) >= firstMemStoreNodeId);
+
+            std::string_view val;
+            verify(db.get(txn, "A", val));
+            verify(val == "res1");
+            verify(db.get(txn, "B", val));
+            verify(val == "res2");
+
+            auto stats = db.stats(txn);
+            verify(stats.numLeafNodes == 2);
+        });
+
+        db.writeToMemStore = false;
+    });
+
+    test("memStore forking from lmdb", [&]{
+        MemStore m;
+
+        db.checkout("memStore-test");
+
+        db.change()
+          .put("A", "res1")
+          .put("B", "res2")
+          .apply(txn);
+
+        uint64_t origNode = db.getHeadNodeId(txn);
+
+        db.withMemStore(m, [&]{
+            db.checkout("memStore-test");
+            db.writeToMemStore = true;
+
+            verifyThrow(db.change().put("C", "res3").apply(txn), "attempted to store MemStore node into LMDB");
+
+            db.fork(txn);
+            db.change().put("C", "res3").apply(txn);
+
+            verify(db.getHeadNodeId(txn) >= firstMemStoreNodeId);
+
+            std::string_view val;
+            verify(db.get(txn, "A", val));
+            verify(val == "res1");
+            verify(db.get(txn, "B", val));
+            verify(val == "res2");
+            verify(db.get(txn, "C", val));
+            verify(val == "res3");
+
+            auto stats = db.stats(txn);
+            verify(stats.numLeafNodes == 3);
+        });
+
+        db.writeToMemStore = false;
+
+        db.checkout(origNode);
+
+        auto stats = db.stats(txn);
+        verify(stats.numLeafNodes == 2);
+    });
+
+    test("memStore arena", [&]{
+        MemStore m;
+
+        std::string large(MemStore::chunkSize, 'L');
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; i < 10'000; i++) {
+            auto nodeRaw = i % 1000 == 999 ? large : std::to_string(i) + std::string(40 + i % 30, 'x');
+            verify(m.add(nodeRaw) == firstMemStoreNodeId + i);
+            total += nodeRaw.size();
+        }
+
+        verify(m.size() == 10'000);
+        verify(m.bytesAllocated() >= total && m.bytesAllocated() < total + total / 10);
+
+        std::string_view v;
+        verify(m.get(firstMemStoreNodeId + 1234, v) && v == "1234" + std::string(40 + 1234 % 30, 'x'));
+        verify(m.get(firstMemStoreNodeId + 2999, v) && v == large);
+        verify(!m.get(firstMemStoreNodeId + 10'000, v));
+        verify(!m.get(1, v));
+
+        // Views stay valid as the arena grows
+        verify(m.get(firstMemStoreNodeId, v));
+        for (int i = 0; i < 5'000; i++) m.add(std::string(100, 'y'));
+        verify(v == "0" + std::string(40, 'x'));
+
+        m.clear();
+        verify(m.size() == 0 && m.bytesAllocated() == 0);
+        verify(m.add(std::string(48, 'z')) == firstMemStoreNodeId);
+    });
+
+    test("flush memStore", [&]{
+        db.checkout("flushBase");
+        {
+            auto c = db.change();
+            for (int i = 0; i < 1000; i++) c.put(std::to_string(i), std::to_string(i));
+            c.apply(txn);
+        }
+        uint64_t baseNodeId = db.getHeadNodeId(txn);
+        uint64_t maxDepth = db.stats(txn).maxDepth;
+
+        auto proof = db.exportProof(txn, { "1", "2", "3", "500", "new" });
+
+        db.fork(txn, "flushExpected");
+        db.change().put("1", "A").put("500", "B").put("new", "C").apply(txn);
+        auto expectedRoot = db.root(txn);
+
+        MemStore m;
+        uint64_t memNodeId;
+
+        db.withMemStore(m, [&]{
+            db.checkout();
+            db.writeToMemStore = true;
+            db.importProof(txn, proof);
+            db.change().put("1", "A").put("500", "B").put("new", "C").apply(txn);
+            memNodeId = db.getHeadNodeId(txn);
+            verify(memNodeId >= firstMemStoreNodeId);
+        });
+
+        std::string_view val;
+
+        // With a base tree, witnesses are replaced and unmodified sub-trees are shared
+
+        {
+            uint64_t newNodeId;
+            uint64_t nodesWritten = db.nodesWritten;
+
+            db.withMemStore(m, [&]{
+                db.writeToMemStore = true;
+                newNodeId = db.flushMemStore(txn, memNodeId, baseNodeId).nodeId;
+                verify(db.writeToMemStore);
+            });
+            db.writeToMemStore = false;
+
+            verify(newNodeId < firstMemStoreNodeId);
+            verify(db.nodesWritten - nodesWritten <= 3 * (maxDepth + 2));
+
+            db.checkout("flushed");
+            db.setHeadNodeId(txn, newNodeId);
+            verify(db.root(txn) == expectedRoot);
+            verify(db.get(txn, "1", val) && val == "A");
+            verify(db.get(txn, "new", val) && val == "C");
+            verify(db.get(txn, "999", val) && val == "999");
+        }
+
+        // Without, the tree is still partial
+
+        {
+            uint64_t newNodeId;
+
+            db.withMemStore(m, [&]{
+                newNodeId = db.flushMemStore(txn, memNodeId).nodeId;
+            });
+
+            db.checkout(newNodeId);
+            verify(db.root(txn) == expectedRoot);
+            verify(db.get(txn, "500", val) && val == "B");
+            verifyThrow(db.get(txn, "999", val), "encountered witness node");
+        }
+
+        // Trees forked from LMDB reference the existing nodes
+
+        {
+            MemStore m2;
+            uint64_t newNodeId;
+
+            db.withMemStore(m2, [&]{
+                db.checkout(baseNodeId);
+                db.writeToMemStore = true;
+                db.change().put("1", "A").put("500", "B").put("new", "C").apply(txn);
+                newNodeId = db.flushMemStore(txn, db.getHeadNodeId(txn)).nodeId;
+            });
+            db.writeToMemStore = false;
+
+            db.checkout(newNodeId);
+            verify(db.root(txn) == expectedRoot);
+            verify(db.get(txn, "999", val) && val == "999");
+        }
+
+        for (auto head : { "flushBase", "flushExpected", "flushed" }) db.dbi_head.del(txn, head);
+    });
+
+    test("staged commits", [&]{
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        for (int iter = 0; iter < 200; iter++) {
+            std::set<std::string> baseKeys;
+
+            db.checkout();
+            {
+                auto c = db.change();
+                uint64_t numElems = rnd() % 300;
+                for (uint64_t i = 0; i < numElems; i++) {
+                    auto k = std::to_string(rnd() % 400);
+                    c.put(k, "base" + k);
+                    baseKeys.insert(k);
+                }
+                c.apply(txn);
+            }
+            uint64_t baseNodeId = db.getHeadNodeId(txn);
+
+            // Batches overlap with each other. Deletions are only of keys in the base, so none are no-ops against the snapshot.
+
+            using Batch = std::vector<std::pair<std::string, std::optional<std::string>>>;
+            std::vector<Batch> batches(1 + rnd() % 4);
+
+            for (size_t b = 0; b < batches.size(); b++) {
+                uint64_t numUpdates = 1 + rnd() % (rnd() % 2 ? 5 : 100);
+                for (uint64_t i = 0; i < numUpdates; i++) {
+                    auto k = std::to_string(rnd() % 400);
+                    if (rnd() % 3 == 0 && baseKeys.count(k)) batches[b].emplace_back(k, std::nullopt);
+                    else batches[b].emplace_back(k, "v" + std::to_string(iter) + "_" + std::to_string(b) + "_" + std::to_string(i));
+                }
+            }
+
+            auto toUpdateSet = [&](const Batch &batch){
+                auto c = db.change();
+                for (auto &[k, v] : batch) {
+                    if (v) c.put(k, *v);
+                    else c.del(k);
+                }
+                return c;
+            };
+
+            uint64_t nodesWritten = db.nodesWritten;
+            std::vector<Quadrable::PreparedUpdate> prepared;
+            for (auto &batch : batches) {
+                auto c = toUpdateSet(batch);
+                prepared.emplace_back(db.prepare(txn, baseNodeId, c));
+            }
+            verify(db.nodesWritten == nodesWritten);
+            verify(db.getHeadNodeId(txn) == baseNodeId);
+            verify(!db.writeToMemStore);
+
+            for (auto &p : prepared) db.commitPrepared(txn, p);
+            auto mergedRoot = db.root(txn);
+            auto mergedLeaves = db.stats(txn).numLeafNodes; // no MemStore nodes remain referenced
+
+            verifyThrow(db.commitPrepared(txn, prepared[0]), "already committed");
+
+            db.checkout(baseNodeId);
+            for (auto &batch : batches) {
+                auto c = toUpdateSet(batch);
+                c.apply(txn);
+            }
+
+            verify(mergedRoot == db.root(txn));
+            verify(mergedLeaves == db.stats(txn).numLeafNodes);
+        }
+    });
+
+    test("group commit", [&]{
+        std::string gcDir = dbDir + "groupCommit/";
+        ::system(("mkdir -p " + gcDir + " ; rm -f " + gcDir + "*.mdb").c_str());
+
+        lmdb::env env2 = lmdb::env::create();
+        env2.set_max_dbs(64);
+        env2.set_mapsize(1UL * 1024UL * 1024UL * 1024UL);
+        env2.open(gcDir.c_str(), MDB_CREATE, 0664);
+
+        Quadrable dbg;
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, 0);
+            dbg.init(txn2);
+            txn2.commit();
+        }
+
+        uint64_t numThreads = 4, numPerThread = 500;
+        uint64_t groupNodesWritten;
+        MemQuadrable expected;
+
+        {
+            GroupCommit gc(dbg, env2, 200, std::chrono::milliseconds(20));
+
+            std::vector<std::vector<std::future<GroupCommitResult>>> futures(numThreads);
+            std::vector<std::thread> threads;
+
+            for (uint64_t t = 0; t < numThreads; t++) {
+                threads.emplace_back([&, t]{
+                    for (uint64_t i = 0; i < numPerThread; i++) futures[t].push_back(gc.put(std::to_string(t * numPerThread + i), "val" + std::to_string(i)));
+                });
+            }
+
+            for (auto &th : threads) th.join();
+            gc.flush();
+
+            for (uint64_t t = 0; t < numThreads; t++) {
+                for (uint64_t i = 0; i < numPerThread; i++) expected.put(std::to_string(t * numPerThread + i), "val" + std::to_string(i));
+            }
+
+            std::set<uint64_t> leafNodeIds;
+            uint64_t maxBatchSize = 0;
+
+            for (auto &f : futures) {
+                for (auto &fut : f) {
+                    auto res = fut.get();
+                    verify(res.nodeId != 0 && res.nodeId < firstInteriorNodeId);
+                    verify(res.root.size() == 32);
+                    leafNodeIds.insert(res.nodeId);
+                    maxBatchSize = std::max(maxBatchSize, res.batchSize);
+                }
+            }
+
+            verify(leafNodeIds.size() == numThreads * numPerThread);
+            verify(maxBatchSize > 1 && maxBatchSize <= 200);
+            verify(gc.numBatches() < numThreads * numPerThread / 2);
+
+            groupNodesWritten = dbg.nodesWritten;
+
+            // Window expiry commits a partial batch without a flush
+
+            auto delFut = gc.del("0");
+            auto delRes = delFut.get();
+            verify(delRes.batchSize == 1);
+            verify(delRes.nodeId != 0);
+            expected.del("0");
+
+            verifyThrow(gc.put("", "val"), "zero-length keys not allowed");
+        }
+
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+            verify(dbg.root(txn2) == expected.root());
+            std::string_view val;
+            verify(dbg.get(txn2, "1999", val) && val == "val499");
+            verify(!dbg.get(txn2, "0", val));
+        }
+
+        // Far fewer nodes are written than when applying each update separately
+
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, 0);
+            dbg.checkout("individual");
+            uint64_t nodesWritten = dbg.nodesWritten;
+            for (uint64_t i = 0; i < numThreads * numPerThread; i++) dbg.put(txn2, std::to_string(i), "val");
+            verify(groupNodesWritten * 2 < dbg.nodesWritten - nodesWritten);
+            txn2.abort();
+        }
+
+        // An update that can't be applied only fails its own future
+
+        {
+            std::vector<std::string> goodKeys;
+            for (int i = 0; i < 31; i++) goodKeys.push_back(std::to_string(1000 + i));
+            std::string badKey;
+            Proof proof;
+
+            {
+                auto txn2 = lmdb::txn::begin(env2, nullptr, 0);
+                dbg.checkout("master");
+                uint64_t fullNodeId = dbg.getHeadNodeId(txn2);
+
+                // Find a proved key whose deletion in the partial tree would need a witness to bubble up
+                for (int i = 10; i < 1000 && badKey.empty(); i++) {
+                    std::string candidate = std::to_string(i);
+                    std::vector<std::string> keys = goodKeys;
+                    keys.push_back(candidate);
+
+                    proof = dbg.exportProof(txn2, fullNodeId, keys);
+                    dbg.checkout();
+                    dbg.importProof(txn2, proof);
+
+                    try {
+                        dbg.del(txn2, candidate);
+                    } catch (const std::runtime_error &e) {
+                        if (std::string(e.what()).find("can't bubble a witness node") != std::string::npos) badKey = candidate;
+                    }
+                }
+
+                verify(!badKey.empty());
+
+                dbg.checkout("partial");
+                dbg.importProof(txn2, proof);
+                txn2.commit();
+            }
+
+            {
+                GroupCommit gc(dbg, env2, 100, std::chrono::seconds(10));
+
+                std::vector<std::future<GroupCommitResult>> goodFutures;
+                std::future<GroupCommitResult> badFuture;
+
+                for (size_t i = 0; i < goodKeys.size(); i++) {
+                    if (i == 5) badFuture = gc.del(badKey);
+                    goodFutures.push_back(gc.put(goodKeys[i], "updated"));
+                }
+
+                gc.flush();
+
+                verifyThrow(badFuture.get(), "can't bubble a witness node");
+
+                uint64_t maxBatchSize = 0;
+
+                for (auto &f : goodFutures) {
+                    auto res = f.get();
+                    verify(res.nodeId != 0);
+                    maxBatchSize = std::max(maxBatchSize, res.batchSize);
+                }
+
+                // The batch of 32 is bisected: 1 failed txn per level, plus one for each good half
+
+                verify(maxBatchSize == 16);
+                verify(gc.numBatches() == 1);
+                verify(gc.numTxns() == 1 + 2 * 5);
+
+                // A flush with nothing pending doesn't cut short the next window
+
+                gc.flush();
+                auto fut = gc.put(goodKeys[0], "updated again");
+                verify(fut.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+                gc.flush();
+                verify(fut.get().batchSize == 1);
+                verify(gc.numBatches() == 2);
+            }
+
+            auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+            std::string_view val;
+            for (auto &k : goodKeys) verify(dbg.get(txn2, k, val) && val == (k == goodKeys[0] ? "updated again" : "updated"));
+            verify(dbg.get(txn2, badKey, val));
+        }
+    });
+
+    test("snapshots", [&]{
+        db.checkout("snapshotA");
+        {
+            auto c = db.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::to_string(i * 2));
+            c.apply(txn);
+        }
+
+        auto origRoot = db.root(txn);
+        auto snap = db.snapshot(txn);
+
+        db.change().put("1", "modified").del("2").apply(txn);
+
+        // Pinned to the root at the time it was created
+
+        std::string_view val;
+        uint64_t nodesRead = db.nodesRead;
+
+        verify(snap.root() == origRoot);
+        verify(snap.get("1", val) && val == "2");
+        verify(snap.get("2", val) && val == "4");
+        verify(!snap.get("100", val));
+
+        auto query = snap.get({ "3", "4", "nope" });
+        verify(query["3"].exists && query["3"].val == "6");
+        verify(query["4"].exists && query["4"].val == "8");
+        verify(!query["nope"].exists);
+
+        auto iterateKeys = [](auto &&it){
+            std::vector<std::string> output;
+            for (; !it.atEnd(); it.next()) output.emplace_back(it.get().leafKeyHash());
+            return output;
+        };
+
+        auto snapKeys = iterateKeys(snap.iterate(Key::null()));
+        verify(snapKeys.size() > 0);
+
+        {
+            auto proof = snap.exportProof({ "1", "2", "nope" });
+            MemQuadrable m;
+            m.importProof(proof, origRoot);
+            verify(m.get("1", val) && val == "2");
+            verify(!m.get("nope", val));
+        }
+
+        verify(db.nodesRead == nodesRead);
+
+        db.checkout(snap.getNodeId());
+        verify(snapKeys == iterateKeys(db.iterate(txn, Key::null())));
+        db.checkout("snapshotA");
+
+        verify(db.get(txn, "1", val) && val == "modified");
+        verify(!db.get(txn, "2", val));
+
+        db.dbi_head.del(txn, "snapshotA");
+
+        // Concurrent readers sharing one Quadrable instance, each with its own read txn
+
+        std::string snapDir = dbDir + "snapshot/";
+        ::system(("mkdir -p " + snapDir + " ; rm -f " + snapDir + "*.mdb").c_str());
+
+        lmdb::env env2 = lmdb::env::create();
+        env2.set_max_dbs(64);
+        env2.set_mapsize(1UL * 1024UL * 1024UL * 1024UL);
+        env2.open(snapDir.c_str(), MDB_CREATE, 0664);
+
+        Quadrable dbs;
+        uint64_t numKeys = 500;
+        uint64_t nodeIdA, nodeIdB;
+        std::string rootA, rootB;
+
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, 0);
+            dbs.init(txn2);
+
+            dbs.checkout("a");
+            auto c = dbs.change();
+            for (uint64_t i = 0; i < numKeys; i++) c.put(std::to_string(i), "a" + std::to_string(i));
+            c.apply(txn2);
+            nodeIdA = dbs.getHeadNodeId(txn2);
+            rootA = dbs.root(txn2);
+
+            dbs.fork(txn2, "b");
+            auto c2 = dbs.change();
+            for (uint64_t i = 0; i < numKeys; i += 2) c2.put(std::to_string(i), "b" + std::to_string(i));
+            c2.apply(txn2);
+            nodeIdB = dbs.getHeadNodeId(txn2);
+            rootB = dbs.root(txn2);
+
+            txn2.commit();
+        }
+
+        std::vector<std::string> keysA, keysB;
+
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+            keysA = iterateKeys(dbs.snapshot(txn2, nodeIdA).iterate(Key::null()));
+            keysB = iterateKeys(dbs.snapshot(txn2, nodeIdB).iterate(Key::null()));
+        }
+
+        std::atomic<uint64_t> failures = 0;
+        std::vector<std::thread> threads;
+        nodesRead = dbs.nodesRead;
+
+        for (uint64_t t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]{
+                try {
+                    auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+                    bool isB = t % 2;
+                    auto s = dbs.snapshot(txn2, isB ? nodeIdB : nodeIdA);
+
+                    for (int round = 0; round < 5; round++) {
+                        if (s.root() != (isB ? rootB : rootA)) failures++;
+
+                        for (uint64_t i = 0; i < numKeys; i++) {
+                            std::string_view v;
+                            std::string expected = (isB && i % 2 == 0 ? "b" : "a") + std::to_string(i);
+                            if (!s.get(std::to_string(i), v) || v != expected) failures++;
+                        }
+
+                        if (iterateKeys(s.iterate(Key::null())) != (isB ? keysB : keysA)) failures++;
+
+                        auto proof = s.exportProof({ std::to_string(round), "nope" });
+                        MemQuadrable m;
+                        m.importProof(proof, isB ? rootB : rootA);
+                    }
+                } catch (std::exception &) {
+                    failures++;
+                }
+            });
+        }
+
+        for (auto &th : threads) th.join();
+
+        verify(failures == 0);
+        verify(dbs.nodesRead == nodesRead);
+
+        // A writer can apply updates (to head "b") through the same instance while the snapshots are read
+
+        threads.clear();
+        std::atomic<bool> writerDone = false;
+
+        for (uint64_t t = 0; t < 2; t++) {
+            threads.emplace_back([&, t]{
+                try {
+                    auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+                    bool isB = t % 2;
+                    auto s = dbs.snapshot(txn2, isB ? nodeIdB : nodeIdA);
+
+                    do {
+                        if (s.root() != (isB ? rootB : rootA)) failures++;
+                        if (iterateKeys(s.iterate(Key::null())) != (isB ? keysB : keysA)) failures++;
+
+                        std::string_view v;
+                        if (!s.get("7", v) || v != "a7") failures++;
+                    } while (!writerDone);
+                } catch (std::exception &) {
+                    failures++;
+                }
+            });
+        }
+
+        threads.emplace_back([&]{
+            try {
+                for (uint64_t round = 0; round < 20; round++) {
+                    auto txn2 = lmdb::txn::begin(env2, nullptr, 0);
+                    auto c = dbs.change();
+                    for (uint64_t i = 0; i < numKeys; i += 7) c.put(std::to_string(i), "w" + std::to_string(round));
+                    c.apply(txn2);
+                    txn2.commit();
+                }
+            } catch (std::exception &) {
+                failures++;
+            }
+
+            writerDone = true;
+        });
+
+        for (auto &th : threads) th.join();
+
+        verify(failures == 0);
+
+        {
+            auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+            std::string_view v;
+            verify(dbs.get(txn2, "7", v) && v == "w19");
+            verify(dbs.snapshot(txn2, nodeIdA).root() == rootA);
+        }
+    });
+
+    test("memStore-only env", [&]{
+        quadrable::Quadrable db2;
+        db2.addMemStore();
+        db2.writeToMemStore = true;
+        lmdb::txn txn2(nullptr);
+
+        db2.checkout();
+
+        db2.change()
+           .put("A", "res1")
+           .put("B", "res2")
+           .apply(txn2);
+
+        std::string_view val;
         verify(db2.get(txn2, "A", val));
         verify(val == "res1");
         verify(db2.get(txn2, "B", val));
@@ -1406,9 +3280,78 @@ void doTests() {
 
 
 
+    test("addMemStore sets writeToMemStore", [&]{
+        quadrable::Quadrable db2;
+        db2.addMemStore(false);
+        verify(!db2.writeToMemStore);
+        verifyThrow(db2.addMemStore(), "memStore already installed");
+        db2.removeMemStore();
+
+        db2.addMemStore();
+        verify(db2.writeToMemStore);
+        db2.removeMemStore();
+        verify(!db2.writeToMemStore);
+    });
+
+    test("MemQuadrable", [&]{
+        MemQuadrable mq;
+
+        {
+            auto c = mq.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::to_string(i * 2));
+            mq.apply(c);
+        }
+
+        verify(mq.getHeadNodeId() >= firstMemStoreNodeId);
+        verify(mq.stats().numLeafNodes == 100);
+
+        std::string_view val;
+        verify(mq.get("7", val) && val == "14");
+        verify(!mq.get("100", val));
+
+        // Same root as the LMDB-backed tree
+
+        db.checkout("memQuadrableRef");
+        {
+            auto c = db.change();
+            for (int i = 0; i < 100; i++) c.put(std::to_string(i), std::to_string(i * 2));
+            c.apply(txn);
+        }
+        verify(mq.root() == db.root(txn));
+
+        // Verify a proof in a second instance, and update it
+
+        auto proof = quadrable::transport::decodeProof(quadrable::transport::encodeProof(mq.exportProof({ "7", "8", "nonexistent" })));
+
+        MemQuadrable verifier;
+        verifier.importProof(proof, mq.root());
+        verify(verifier.get("8", val) && val == "16");
+        verifyThrow(verifier.get("9", val), "encountered witness node");
+
+        verifier.put("7", "updated");
+        verifier.put("8", "updated");
+        mq.put("7", "updated");
+        mq.put("8", "updated");
+        verify(verifier.root() == mq.root());
+
+        auto origNodeId = mq.getHeadNodeId();
+        mq.checkout();
+        verify(mq.root() == Key::null().str());
+        mq.checkout(origNodeId);
+        verify(mq.get("7", val) && val == "updated");
+
+        mq.clear();
+        verify(mq.getHeadNodeId() == 0);
+        mq.put("a", "b");
+        verify(mq.getHeadNodeId() == firstMemStoreNodeId);
+    });
+
+
+
     test("sync fuzz", [&]{
         std::mt19937 rnd;
         rnd.seed(0);
+        bool budgetCutOff = false; // some round had more unresolved witnesses than the budget allowed requests for
 
         for (uint trialIter = 0; trialIter < 500; trialIter++) {
             uint64_t numElems = rnd() % 800;
@@ -1456,19 +3399,40 @@ void doTests() {
 
             std::vector<uint64_t> nodeIdsSeenDuringScan;
             std::vector<uint64_t> nodeIdsSeenDuringDiff;
+            SyncMetrics providerMetrics;
 
             auto cb = [&](auto dt, const auto &node){
                 nodeIdsSeenDuringScan.push_back(node.nodeId);
             };
 
+            uint64_t reqBytes = 0;
+            sync.countWitnesses = trialIter % 2;
+
             while(1) {
                 auto reqs = syncRequestsRoundtrip(sync.getReqs(txn, (rnd() % 1000) + 100, cb));
+                reqBytes += quadrable::transport::encodeSyncRequests(reqs).size();
+
+                if (sync.countWitnesses) {
+                    verify(sync.metrics.witnessesRemaining >= reqs.size());
+                    if (sync.metrics.witnessesRemaining > reqs.size()) budgetCutOff = true;
+                } else {
+                    verify(sync.metrics.witnessesRemaining == 0);
+                }
+
                 if (reqs.size() == 0) break;
 
-                auto resps = syncResponsesRoundtrip(db.handleSyncRequests(txn, newNodeId, reqs, (rnd() % 10000) + 2000));
+                auto resps = syncResponsesRoundtrip(db.handleSyncRequests(txn, newNodeId, reqs, (rnd() % 10000) + 2000, &providerMetrics));
                 sync.addResps(txn, reqs, resps);
             }
 
+            verify(sync.metrics.roundTrips == providerMetrics.roundTrips);
+            verify(sync.metrics.fragments == providerMetrics.fragments);
+            verify(sync.metrics.strands == providerMetrics.strands);
+            verify(sync.metrics.hashCmds == providerMetrics.hashCmds);
+            verify(sync.metrics.witnessesRemaining == 0);
+            verify(sync.metrics.reqBytes == reqBytes);
+            verify(sync.metrics.reconcile.calls == sync.metrics.roundTrips + 1);
+
             db.writeToMemStore = false;
 
             db.checkout(sync.nodeIdShadow);
@@ -1506,6 +3470,331 @@ void doTests() {
             std::sort(nodeIdsSeenDuringDiff.begin(), nodeIdsSeenDuringDiff.end());
             verify(nodeIdsSeenDuringDiff == nodeIdsSeenDuringScan);
         }
+
+        verify(budgetCutOff);
+    });
+
+    test("sync session resume", [&]{
+        std::mt19937 rnd;
+        rnd.seed(1);
+
+        for (uint trialIter = 0; trialIter < 50; trialIter++) {
+            db.checkout();
+
+            {
+                auto c = db.change();
+                for (uint64_t i = 0; i < 500; i++) {
+                    auto n = rnd() % 1000;
+                    c.put(quadrable::Key::fromInteger(n), std::to_string(n));
+                }
+                c.apply(txn);
+            }
+
+            uint64_t origNodeId = db.getHeadNodeId(txn);
+            db.fork(txn);
+
+            {
+                auto chg = db.change();
+                for (uint64_t i = 0; i < rnd() % 100; i++) {
+                    auto n = rnd() % 1000;
+                    if (rnd() % 2 == 0) chg.put(quadrable::Key::fromInteger(n), std::to_string(n) + " new");
+                    else chg.del(quadrable::Key::fromInteger(n));
+                }
+                chg.apply(txn);
+            }
+
+            uint64_t newNodeId = db.getHeadNodeId(txn);
+            auto newKey = db.rootKey(txn);
+
+            {
+                Quadrable::Sync sync(&db);
+                sync.laterDepthLimit = 2;
+                sync.init(txn, origNodeId);
+                sync.save(txn, "session");
+            }
+
+            while (1) {
+                // Simulate a restart before every round-trip
+                Quadrable::Sync sync(&db);
+                sync.resume(txn, "session");
+                verify(sync.laterDepthLimit == 2);
+
+                auto reqs = syncRequestsRoundtrip(sync.getReqs(txn, (rnd() % 500) + 100));
+                if (reqs.size() == 0) {
+                    verify(db.rootKey(txn, sync.nodeIdShadow) == newKey);
+                    break;
+                }
+
+                auto resps = syncResponsesRoundtrip(db.handleSyncRequests(txn, newNodeId, reqs, (rnd() % 5000) + 1000));
+                sync.addResps(txn, reqs, resps);
+                sync.save(txn, "session");
+            }
+
+            db.deleteSyncSession(txn, "session");
+        }
+
+        Quadrable::Sync sync(&db);
+        verifyThrow(sync.resume(txn, "session"), "sync session not found");
+    });
+
+    test("sync full keys", [&]{
+        Quadrable dbk;
+        dbk.trackKeys = true;
+        dbk.init(txn);
+        dbk.checkout();
+
+        {
+            auto c = dbk.change();
+            for (uint64_t i = 0; i < 300; i++) c.put(std::string("key") + std::to_string(i), std::to_string(i));
+            c.apply(txn);
+        }
+
+        uint64_t origNodeId = dbk.getHeadNodeId(txn);
+        dbk.fork(txn);
+
+        {
+            auto c = dbk.change();
+            for (uint64_t i = 0; i < 300; i += 7) c.put(std::string("key") + std::to_string(i), "modified");
+            for (uint64_t i = 300; i < 320; i++) c.put(std::string("key") + std::to_string(i), std::to_string(i));
+            c.apply(txn);
+        }
+
+        uint64_t newNodeId = dbk.getHeadNodeId(txn);
+
+        Quadrable::Sync sync(&dbk);
+        sync.fullKeys = true;
+        sync.init(txn, origNodeId);
+
+        while (1) {
+            auto reqs = syncRequestsRoundtrip(sync.getReqs(txn, 1000));
+            if (reqs.size() == 0) break;
+            verify(reqs[0].fullKeys);
+
+            auto resps = quadrable::transport::decodeSyncResponses(quadrable::transport::encodeSyncResponses(reqs, dbk.handleSyncRequests(txn, newNodeId, reqs, 5000)));
+            sync.addResps(txn, reqs, resps);
+        }
+
+        uint64_t numKeyed = 0;
+
+        sync.diff(txn, origNodeId, sync.nodeIdShadow, [&](auto dt, const auto &node){
+            if (dt == Quadrable::DiffType::Deleted) return;
+            std::string_view leafKey;
+            verify(dbk.getLeafKey(txn, node.nodeId, leafKey));
+            verify(Key::hash(leafKey) == node.key());
+            numKeyed++;
+        });
+
+        verify(numKeyed == 43 + 20);
+
+        auto reqs = sync.getReqs(txn);
+        reqs.emplace_back(SyncRequest{ Key::null(), 0, 4, false, true });
+        verifyThrow(db.handleSyncRequests(txn, newNodeId, reqs), "key tracking not enabled");
+    });
+
+    test("iblt reconcile", [&]{
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        for (uint trialIter = 0; trialIter < 100; trialIter++) {
+            uint64_t numElems = rnd() % 800;
+            uint64_t maxElem = 1000;
+            uint64_t numAlterations = rnd() % 40;
+
+            db.checkout();
+
+            {
+                auto c = db.change();
+                for (uint64_t i = 0; i < numElems; i++) {
+                    auto n = rnd() % maxElem;
+                    c.put(quadrable::Key::fromInteger(n), std::to_string(n));
+                }
+                c.apply(txn);
+            }
+
+            uint64_t origNodeId = db.getHeadNodeId(txn);
+            db.fork(txn);
+
+            {
+                auto chg = db.change();
+
+                for (uint64_t i = 0; i < numAlterations; i++) {
+                    auto n = rnd() % maxElem;
+                    if (rnd() % 2 == 0) chg.put(quadrable::Key::fromInteger(n), std::to_string(n) + " new");
+                    else chg.del(quadrable::Key::fromInteger(n));
+                }
+
+                chg.apply(txn);
+            }
+
+            uint64_t newNodeId = db.getHeadNodeId(txn);
+            auto newKey = db.rootKey(txn);
+
+            // Incrementally maintained IBLT matches one built from scratch
+
+            auto maintained = db.buildIBLT(txn, origNodeId, 256);
+            db.updateIBLT(txn, maintained, origNodeId, newNodeId);
+            auto rebuilt = db.buildIBLT(txn, newNodeId, 256);
+            for (size_t i = 0; i < rebuilt.cells.size(); i++) {
+                verify(maintained.cells[i].count == rebuilt.cells[i].count);
+                verify(maintained.cells[i].nodeHashSum == rebuilt.cells[i].nodeHashSum);
+            }
+
+            Quadrable::Reconcile reconcile(&db);
+            reconcile.init(txn, origNodeId);
+
+            auto estimator = transport::decodeStrataEstimator(transport::encodeStrataEstimator(reconcile.getEstimator(txn)));
+            auto resp = transport::decodeReconcileResponse(transport::encodeReconcileResponse(db.handleReconcileRequest(txn, newNodeId, estimator)));
+
+            if (!reconcile.addIBLT(txn, resp)) {
+                // Estimates are probabilistic: retry with a generously sized IBLT
+                resp = ReconcileResponse{ newKey, db.buildIBLT(txn, newNodeId, IBLT::subtableSizeFor(numAlterations * 2)) };
+                verify(reconcile.addIBLT(txn, resp));
+            }
+
+            auto keys = transport::decodeReconcileKeys(transport::encodeReconcileKeys(reconcile.getKeys()));
+            verify(keys.size() <= numAlterations);
+
+            auto proof = proofRoundtrip(db.exportProofRaw(txn, newNodeId, keys));
+            reconcile.addProof(txn, proof);
+
+            verify(db.rootKey(txn, reconcile.nodeIdReconciled) == newKey);
+        }
+    });
+
+
+
+    test("node stores", [&]{
+        db.checkout("nodeStoreRef");
+        {
+            auto c = db.change();
+            for (int i = 0; i < 200; i++) c.put(std::to_string(i), std::string(i % 50, 'v'));
+            c.apply(txn);
+        }
+        auto refRoot = db.root(txn);
+
+        auto exercise = [&](NodeStore &store){
+            Quadrable dbs;
+            dbs.init(txn);
+            dbs.setNodeStore(&store);
+            dbs.checkout();
+
+            auto lmdbEntries = [&]{
+                uint64_t n = 0;
+                std::string_view k, v;
+                for (auto *dbi : { &dbs.dbi_nodesLeaf, &dbs.dbi_nodesInterior }) {
+                    auto cursor = lmdb::cursor::open(txn, *dbi);
+                    for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) n++;
+                }
+                return n;
+            };
+            auto origLmdbEntries = lmdbEntries();
+
+            {
+                auto c = dbs.change();
+                for (int i = 0; i < 200; i++) c.put(std::to_string(i), std::string(i % 50, 'v'));
+                c.apply(txn);
+            }
+            verify(dbs.root(txn) == refRoot);
+            verify(dbs.getHeadNodeId(txn) != db.getHeadNodeId(txn));
+            verify(lmdbEntries() == origLmdbEntries);
+
+            std::string_view val;
+            verify(dbs.get(txn, "42", val) && val == std::string(42, 'v'));
+            verify(quadrable::transport::encodeProof(dbs.exportProof(txn, { "1", "nonexistent" }))
+                == quadrable::transport::encodeProof(db.exportProof(txn, { "1", "nonexistent" })));
+
+            auto origNodeId = dbs.getHeadNodeId(txn);
+            {
+                auto c = dbs.change();
+                c.del("42");
+                c.put("new", "val");
+                c.apply(txn);
+            }
+            verify(!dbs.get(txn, "42", val));
+
+            Quadrable::GarbageCollector gc(dbs);
+            gc.markTree(txn, dbs.getHeadNodeId(txn));
+            auto gcStats = gc.sweep(txn);
+            verify(gcStats.garbage > 0 && gcStats.garbage < gcStats.total);
+            gc.deleteNodes(txn);
+
+            verifyThrow(dbs.root(txn, origNodeId), "couldn't find nodeId");
+            verify(dbs.get(txn, "new", val) && val == "val");
+            verify(dbs.get(txn, "199", val) && val == std::string(49, 'v'));
+
+            return std::make_pair(dbs.getHeadNodeId(txn), dbs.root(txn));
+        };
+
+        {
+            HashNodeStore store;
+            exercise(store);
+        }
+
+        // The log is re-indexed when re-opened, and a partially written record at the end is discarded
+
+        std::string logPath = dbDir + "nodes.log";
+        ::unlink(logPath.c_str());
+
+        std::pair<uint64_t, std::string> head;
+        uint64_t logSize;
+
+        {
+            LogNodeStore store(logPath);
+            head = exercise(store);
+            store.flush();
+            logSize = store.logSize();
+        }
+
+        {
+            FILE *f = ::fopen(logPath.c_str(), "a");
+            ::fwrite("partial", 1, 7, f);
+            ::fclose(f);
+        }
+
+        {
+            LogNodeStore store(logPath);
+            verify(store.logSize() == logSize);
+
+            Quadrable dbs;
+            dbs.init(txn);
+            dbs.setNodeStore(&store);
+            dbs.checkout(head.first);
+            verify(dbs.root(txn) == head.second);
+
+            std::string_view val;
+            verify(dbs.get(txn, "new", val) && val == "val");
+            verify(!dbs.get(txn, "42", val));
+
+            auto c = dbs.change();
+            c.put("another", "val");
+            c.apply(txn);
+            verify(dbs.getHeadNodeId(txn) > head.first);
+
+            // Nodes can be read while another thread writes (which may rehash the index)
+
+            std::vector<uint64_t> nodeIds;
+            store.forEach(txn, [&](uint64_t nodeId){ nodeIds.push_back(nodeId); });
+
+            std::atomic<bool> done = false;
+            std::atomic<uint64_t> failures = 0;
+
+            std::thread reader([&]{
+                while (!done) {
+                    for (auto nodeId : nodeIds) {
+                        std::string_view v;
+                        if (!store.get(txn, nodeId, v) || v.size() < 40) failures++;
+                    }
+                }
+            });
+
+            for (int i = 0; i < 5000; i++) store.put(txn, store.allocateId(txn, i % 2), std::string(40, 'x'));
+
+            done = true;
+            reader.join();
+            verify(failures == 0);
+        }
+
+        ::unlink(logPath.c_str());
     });
 
 
@@ -8,13 +8,17 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <memory>
 #include <set>
+#include <deque>
 #include <unordered_set>
 #include <bitset>
 #include <iterator>
+#include <type_traits>
 #include <algorithm>
 #include <functional>
 #include <optional>
+#include <chrono>
 
 #include "lmdbxx/lmdb++.h"
 
@@ -27,5 +31,9 @@ using hoytech::from_hex;
 #include "quadrable/varint.h"
 #include "quadrable/utils.h"
 #include "quadrable/Key.h"
+#include "quadrable/IBLT.h"
 #include "quadrable/structsPublic.h"
+#include "quadrable/transport.h"
+#include "quadrable/NodeStore.h"
 #include "quadrable/Quadrable.h"
+#include "quadrable/MemQuadrable.h"
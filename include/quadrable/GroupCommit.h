@@ -0,0 +1,225 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+#include "quadrable.h"
+
+
+
+namespace quadrable {
+
+
+struct GroupCommitResult {
+    std::string root; // root of the head after the batch containing this update was committed
+    uint64_t headNodeId = 0;
+    uint64_t nodeId = 0; // as with UpdateSet's outputNodeId: the new leaf, or the deleted leaf (0 if unchanged)
+    uint64_t batchSize = 0; // number of updates committed in the same txn (smaller if the batch had to be split)
+};
+
+
+// Buffers single-key puts and dels (from any number of threads), and applies them to the current head of db
+// as one UpdateSet per batch, each in its own write txn. A batch is committed once it has maxBatchSize updates,
+// or maxDelay after its first update was submitted, whichever comes first. Each path from the root is therefore
+// rewritten once per batch instead of once per update.
+//
+// The returned futures become ready once the batch has been committed. The db instance is used by the committer
+// thread, so it should not be used elsewhere until the GroupCommit is destroyed. If a key is updated more than
+// once in the same batch, the last update wins, and the others get a nodeId of 0.
+//
+// If any update in a batch can't be applied (for example, a del in a partial tree that would need a witness to
+// bubble up), the batch is split in half and each half is retried, in the order they were submitted, until only the
+// failing updates' futures get the exception. A single bad update in a batch of n costs about 2*log2(n) txns.
+
+class GroupCommit {
+  public:
+    GroupCommit(Quadrable &db_, lmdb::env &env_, uint64_t maxBatchSize_ = 1000, std::chrono::microseconds maxDelay_ = std::chrono::milliseconds(1))
+        : db(db_), env(env_), maxBatchSize(maxBatchSize_), maxDelay(maxDelay_) {
+        if (maxBatchSize == 0) throw quaderr("maxBatchSize must be at least 1");
+        committer = std::thread([this]{ run(); });
+    }
+
+    ~GroupCommit() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+
+        cv.notify_all();
+        committer.join();
+    }
+
+    GroupCommit(const GroupCommit &) = delete;
+    GroupCommit &operator=(const GroupCommit &) = delete;
+
+    std::future<GroupCommitResult> put(std::string_view key, std::string_view val) {
+        return submit(key, std::string(val));
+    }
+
+    std::future<GroupCommitResult> del(std::string_view key) {
+        return submit(key, std::nullopt);
+    }
+
+    // Commits any pending updates without waiting for the window to close, and waits until they are committed
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t target = numSubmitted;
+        flushTarget = std::max(flushTarget, target);
+        cv.notify_all();
+        cvCommitted.wait(lock, [&]{ return numCommitted >= target; });
+    }
+
+    uint64_t numBatches() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return batchesCommitted;
+    }
+
+    // Write txns started, including those aborted when a batch had to be split
+
+    uint64_t numTxns() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return txnsStarted;
+    }
+
+  private:
+    struct Pending {
+        std::string key;
+        std::optional<std::string> val; // nullopt for deletion
+        std::promise<GroupCommitResult> promise;
+        uint64_t nodeId = 0;
+    };
+
+    Quadrable &db;
+    lmdb::env &env;
+    uint64_t maxBatchSize;
+    std::chrono::microseconds maxDelay;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable cvCommitted;
+    std::vector<Pending> pending;
+    std::chrono::steady_clock::time_point windowStart;
+    uint64_t numSubmitted = 0;
+    uint64_t numTaken = 0; // updates moved from pending into a batch
+    uint64_t numCommitted = 0;
+    uint64_t flushTarget = 0; // updates up to this number should be committed without waiting for the window
+    uint64_t batchesCommitted = 0;
+    uint64_t txnsStarted = 0;
+    bool stopping = false;
+    std::thread committer;
+
+    std::future<GroupCommitResult> submit(std::string_view key, std::optional<std::string> val) {
+        if (key.size() == 0) throw quaderr("zero-length keys not allowed");
+
+        std::future<GroupCommitResult> output;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (stopping) throw quaderr("GroupCommit is stopping");
+
+            if (pending.empty()) windowStart = std::chrono::steady_clock::now();
+
+            pending.emplace_back(Pending{ std::string(key), std::move(val), {}, 0 });
+            output = pending.back().promise.get_future();
+            numSubmitted++;
+
+            // The committer needs waking to start the window's timer, or when the batch is full
+            if (pending.size() > 1 && pending.size() < maxBatchSize) return output;
+        }
+
+        cv.notify_all();
+        return output;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            if (pending.empty()) {
+                if (stopping) return;
+                cv.wait(lock);
+                continue;
+            }
+
+            auto ready = [&]{ return pending.size() >= maxBatchSize || flushTarget > numTaken || stopping; };
+
+            // Otherwise wait for the window to close
+            if (!ready()) cv.wait_until(lock, windowStart + maxDelay, ready);
+
+            std::vector<Pending> batch;
+
+            if (pending.size() <= maxBatchSize) {
+                std::swap(batch, pending);
+            } else {
+                // Updates submitted while the previous batch was being committed start the next window
+                auto split = pending.begin() + static_cast<ptrdiff_t>(maxBatchSize);
+                batch.assign(std::make_move_iterator(pending.begin()), std::make_move_iterator(split));
+                pending.erase(pending.begin(), split);
+                windowStart = std::chrono::steady_clock::now();
+            }
+
+            numTaken += batch.size();
+
+            lock.unlock();
+            uint64_t txns = commitBatch(batch.begin(), batch.end());
+            lock.lock();
+
+            numCommitted += batch.size();
+            batchesCommitted++;
+            txnsStarted += txns;
+            cvCommitted.notify_all();
+        }
+    }
+
+    // Returns the number of txns used
+
+    uint64_t commitBatch(std::vector<Pending>::iterator begin, std::vector<Pending>::iterator end) {
+        try {
+            commitUpdates(begin, end);
+            return 1;
+        } catch (...) {
+            if (std::next(begin) == end) {
+                begin->promise.set_exception(std::current_exception());
+                return 1;
+            }
+        }
+
+        auto middle = begin + (end - begin) / 2;
+        return 1 + commitBatch(begin, middle) + commitBatch(middle, end);
+    }
+
+    // Applies the updates in a single txn, and sets their promises' values once it is committed. If this throws, no
+    // promises have been set and the txn has been aborted.
+
+    void commitUpdates(std::vector<Pending>::iterator begin, std::vector<Pending>::iterator end) {
+        auto txn = lmdb::txn::begin(env);
+
+        auto changes = db.change();
+
+        for (auto p = begin; p != end; ++p) {
+            p->nodeId = 0;
+            if (p->val) changes.put(p->key, *p->val, &p->nodeId);
+            else changes.del(p->key, &p->nodeId);
+        }
+
+        changes.apply(txn);
+
+        GroupCommitResult result;
+        result.headNodeId = db.getHeadNodeId(txn);
+        result.root = db.root(txn, result.headNodeId);
+        result.batchSize = static_cast<uint64_t>(end - begin);
+
+        txn.commit();
+
+        for (auto p = begin; p != end; ++p) {
+            result.nodeId = p->nodeId;
+            p->promise.set_value(result);
+        }
+    }
+};
+
+
+}
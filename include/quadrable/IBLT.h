@@ -0,0 +1,310 @@
+#pragma once
+
+namespace quadrable {
+
+
+// Invertible Bloom Lookup Table over the leaves of a tree. Each element is a (keyHash, nodeHash) pair.
+// Since a leaf's nodeHash commits to both its keyHash and valHash, two leaves with the same key but
+// different values are distinct elements, so a modified value shows up as one element on each side.
+
+class IBLT {
+  public:
+    static const uint64_t numHashes = 3;
+
+    struct Cell {
+        int64_t count = 0;
+        Key keyHashSum = Key::null();
+        Key nodeHashSum = Key::null();
+        uint64_t checkSum = 0;
+
+        bool isEmpty() const {
+            return count == 0 && checkSum == 0 && keyHashSum == Key::null() && nodeHashSum == Key::null();
+        }
+    };
+
+    struct Element {
+        Key keyHash;
+        Key nodeHash;
+    };
+
+    std::vector<Cell> cells;
+
+    IBLT(uint64_t subtableSize_ = 0) : cells(subtableSize_ * numHashes) {}
+
+    // Smallest power-of-two subtable size that should decode the given number of differences with high probability.
+    // Power-of-two sizes let a large, incrementally maintained IBLT be folded down to the requested size.
+
+    static uint64_t subtableSizeFor(uint64_t numDifferences) {
+        uint64_t minCells = numDifferences * 2 + 24;
+        uint64_t subtableSize = 8;
+        while (subtableSize * numHashes < minCells) subtableSize *= 2;
+        return subtableSize;
+    }
+
+    uint64_t subtableSize() const {
+        return cells.size() / numHashes;
+    }
+
+    void insert(const Key &keyHash, const Key &nodeHash) {
+        update(keyHash, nodeHash, 1);
+    }
+
+    void erase(const Key &keyHash, const Key &nodeHash) {
+        update(keyHash, nodeHash, -1);
+    }
+
+    void subtract(const IBLT &other) {
+        if (other.cells.size() != cells.size()) throw quaderr("IBLT size mismatch");
+
+        for (size_t i = 0; i < cells.size(); i++) {
+            auto &c = cells[i];
+            auto &o = other.cells[i];
+
+            c.count -= o.count;
+            xorInto(c.keyHashSum, o.keyHashSum);
+            xorInto(c.nodeHashSum, o.nodeHashSum);
+            c.checkSum ^= o.checkSum;
+        }
+    }
+
+    // Returns an IBLT with a smaller subtable size, which must evenly divide the current one
+
+    IBLT fold(uint64_t newSubtableSize) const {
+        uint64_t currSubtableSize = subtableSize();
+        if (newSubtableSize == 0 || newSubtableSize > currSubtableSize || currSubtableSize % newSubtableSize != 0) throw quaderr("invalid IBLT fold size");
+
+        IBLT output(newSubtableSize);
+
+        for (uint64_t j = 0; j < numHashes; j++) {
+            for (uint64_t i = 0; i < currSubtableSize; i++) {
+                auto &c = output.cells[j * newSubtableSize + (i % newSubtableSize)];
+                auto &o = cells[j * currSubtableSize + i];
+
+                c.count += o.count;
+                xorInto(c.keyHashSum, o.keyHashSum);
+                xorInto(c.nodeHashSum, o.nodeHashSum);
+                c.checkSum ^= o.checkSum;
+            }
+        }
+
+        return output;
+    }
+
+    // Peels a (usually subtracted) IBLT. Elements with positive counts are added to positive, negative to negative.
+    // Returns false if the table could not be completely decoded, in which case the outputs are incomplete.
+
+    bool decode(std::vector<Element> &positive, std::vector<Element> &negative) const {
+        IBLT t = *this;
+        std::deque<size_t> pending;
+
+        for (size_t i = 0; i < t.cells.size(); i++) {
+            if (t.isPure(i)) pending.push_back(i);
+        }
+
+        while (pending.size()) {
+            size_t i = pending.front();
+            pending.pop_front();
+
+            if (!t.isPure(i)) continue;
+
+            Element e{ t.cells[i].keyHashSum, t.cells[i].nodeHashSum };
+            int64_t count = t.cells[i].count;
+
+            if (count == 1) positive.push_back(e);
+            else negative.push_back(e);
+
+            t.update(e.keyHash, e.nodeHash, -count);
+
+            for (uint64_t j = 0; j < numHashes; j++) {
+                size_t index = t.cellIndex(e.nodeHash, j);
+                if (t.isPure(index)) pending.push_back(index);
+            }
+        }
+
+        return std::all_of(t.cells.begin(), t.cells.end(), [](const Cell &c){ return c.isEmpty(); });
+    }
+
+  private:
+    static uint64_t mix(uint64_t x) {
+        // splitmix64 finaliser: must be non-linear so that xor-ed checksums can't be forged by xor-ed hashes
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static uint64_t hashWord(const Key &nodeHash, uint64_t n) {
+        uint64_t w;
+        memcpy(&w, nodeHash.data + n * 8, 8);
+        return w;
+    }
+
+    static uint64_t checkSumOf(const Key &nodeHash) {
+        return mix(hashWord(nodeHash, 3) ^ mix(hashWord(nodeHash, 0)));
+    }
+
+    static void xorInto(Key &a, const Key &b) {
+        for (size_t i = 0; i < sizeof(a.data); i++) a.data[i] ^= b.data[i];
+    }
+
+    size_t cellIndex(const Key &nodeHash, uint64_t hashNum) const {
+        uint64_t subtableSize_ = subtableSize();
+        return hashNum * subtableSize_ + (hashWord(nodeHash, hashNum) % subtableSize_);
+    }
+
+    void update(const Key &keyHash, const Key &nodeHash, int64_t count) {
+        if (cells.size() == 0) throw quaderr("IBLT has no cells");
+
+        uint64_t checkSum = checkSumOf(nodeHash);
+
+        for (uint64_t j = 0; j < numHashes; j++) {
+            auto &c = cells[cellIndex(nodeHash, j)];
+
+            c.count += count;
+            xorInto(c.keyHashSum, keyHash);
+            xorInto(c.nodeHashSum, nodeHash);
+            c.checkSum ^= checkSum;
+        }
+    }
+
+    bool isPure(size_t i) const {
+        auto &c = cells[i];
+        if (c.count != 1 && c.count != -1) return false;
+        if (c.checkSum != checkSumOf(c.nodeHashSum)) return false;
+
+        for (uint64_t j = 0; j < numHashes; j++) {
+            if (cellIndex(c.nodeHashSum, j) == i) return true;
+        }
+
+        return false;
+    }
+
+    friend class StrataEstimator;
+};
+
+
+
+// Estimates the size of the symmetric difference between two sets, so that an IBLT can be sized
+// appropriately. Element i goes into stratum number trailingZeros(hash), and each stratum is a small
+// IBLT over a 64-bit element ID (the full IBLT cells aren't needed since elements are only counted).
+
+class StrataEstimator {
+  public:
+    static const uint64_t numStrata = 32;
+    static const uint64_t cellsPerStratum = 24;
+
+    struct Cell {
+        int64_t count = 0;
+        uint64_t idSum = 0;
+        uint64_t checkSum = 0;
+
+        bool isEmpty() const {
+            return count == 0 && idSum == 0 && checkSum == 0;
+        }
+    };
+
+    std::vector<Cell> cells;
+
+    StrataEstimator() : cells(numStrata * cellsPerStratum) {}
+
+    void insert(const Key &nodeHash) {
+        update(nodeHash, 1);
+    }
+
+    void erase(const Key &nodeHash) {
+        update(nodeHash, -1);
+    }
+
+    uint64_t estimateDifference(const StrataEstimator &other) const {
+        if (other.cells.size() != cells.size()) throw quaderr("StrataEstimator size mismatch");
+
+        uint64_t count = 0;
+
+        for (uint64_t stratum = numStrata; stratum-- > 0; ) {
+            std::vector<Cell> diff(cells.begin() + stratum * cellsPerStratum, cells.begin() + (stratum + 1) * cellsPerStratum);
+
+            for (uint64_t i = 0; i < cellsPerStratum; i++) {
+                auto &o = other.cells[stratum * cellsPerStratum + i];
+                diff[i].count -= o.count;
+                diff[i].idSum ^= o.idSum;
+                diff[i].checkSum ^= o.checkSum;
+            }
+
+            uint64_t decoded = 0;
+
+            if (!decodeStratum(diff, decoded)) return (2ULL << stratum) * std::max(count, uint64_t(1));
+
+            count += decoded;
+        }
+
+        return count;
+    }
+
+  private:
+    static uint64_t elementId(const Key &nodeHash) {
+        return IBLT::hashWord(nodeHash, 0);
+    }
+
+    static size_t cellIndex(uint64_t id, uint64_t hashNum) {
+        uint64_t subtableSize = cellsPerStratum / IBLT::numHashes;
+        return hashNum * subtableSize + (IBLT::mix(id + hashNum) % subtableSize);
+    }
+
+    void update(const Key &nodeHash, int64_t count) {
+        uint64_t id = elementId(nodeHash);
+        uint64_t stratum = std::min(static_cast<uint64_t>(__builtin_ctzll(IBLT::hashWord(nodeHash, 1) | (1ULL << 63))), numStrata - 1);
+        uint64_t checkSum = IBLT::mix(id);
+
+        for (uint64_t j = 0; j < IBLT::numHashes; j++) {
+            auto &c = cells[stratum * cellsPerStratum + cellIndex(id, j)];
+
+            c.count += count;
+            c.idSum ^= id;
+            c.checkSum ^= checkSum;
+        }
+    }
+
+    static bool isPure(const std::vector<Cell> &t, size_t i) {
+        auto &c = t[i];
+        if (c.count != 1 && c.count != -1) return false;
+        if (c.checkSum != IBLT::mix(c.idSum)) return false;
+
+        for (uint64_t j = 0; j < IBLT::numHashes; j++) {
+            if (cellIndex(c.idSum, j) == i) return true;
+        }
+
+        return false;
+    }
+
+    static bool decodeStratum(std::vector<Cell> &t, uint64_t &decoded) {
+        bool progress = true;
+
+        while (progress) {
+            progress = false;
+
+            for (size_t i = 0; i < t.size(); i++) {
+                if (!isPure(t, i)) continue;
+
+                uint64_t id = t[i].idSum;
+                int64_t count = t[i].count;
+
+                for (uint64_t j = 0; j < IBLT::numHashes; j++) {
+                    auto &c = t[cellIndex(id, j)];
+                    c.count -= count;
+                    c.idSum ^= id;
+                    c.checkSum ^= IBLT::mix(id);
+                }
+
+                decoded++;
+                progress = true;
+            }
+        }
+
+        return std::all_of(t.begin(), t.end(), [](const Cell &c){ return c.isEmpty(); });
+    }
+};
+
+
+}
@@ -145,6 +145,26 @@ class Key {
         return std::string_view(reinterpret_cast<const char*>(data), sizeof(data));
     }
 
+    // Bits are numbered from the most significant bit of data[0], so words are loaded big-endian
+
+    uint64_t word(size_t i) const {
+        uint64_t w;
+        memcpy(&w, data + i * 8, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        return w;
+    }
+
+    int compare(const Key &other) const {
+        for (size_t i = 0; i < 4; i++) {
+            uint64_t a = word(i), b = other.word(i);
+            if (a != b) return a < b ? -1 : 1;
+        }
+
+        return 0;
+    }
+
     bool getBit(size_t n) const {
         return !!(data[n / 8] & (128 >> (n % 8)));
     }
@@ -166,23 +186,32 @@ class Key {
 };
 
 inline bool operator <(const Key &h1, const Key &h2) {
-    return memcmp(h1.data, h2.data, sizeof(h1.data)) < 0;
+    return h1.compare(h2) < 0;
 }
 
 inline bool operator <=(const Key &h1, const Key &h2) {
-    return memcmp(h1.data, h2.data, sizeof(h1.data)) <= 0;
+    return h1.compare(h2) <= 0;
 }
 
 inline bool operator >(const Key &h1, const Key &h2) {
-    return memcmp(h1.data, h2.data, sizeof(h1.data)) > 0;
+    return h1.compare(h2) > 0;
 }
 
 inline bool operator >=(const Key &h1, const Key &h2) {
-    return memcmp(h1.data, h2.data, sizeof(h1.data)) >= 0;
+    return h1.compare(h2) >= 0;
 }
 
 inline bool operator ==(const Key &h1, const Key &h2) {
-    return memcmp(h1.data, h2.data, sizeof(h1.data)) == 0;
+    uint64_t diff = 0;
+
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t a, b;
+        memcpy(&a, h1.data + i * 8, 8);
+        memcpy(&b, h2.data + i * 8, 8);
+        diff |= a ^ b;
+    }
+
+    return diff == 0;
 }
 
 inline bool operator ==(const Key &h1, std::string_view sv) {
@@ -199,4 +228,30 @@ inline bool operator !=(const Key &h1, std::string_view sv) {
 }
 
 
+
+// Given a range sorted by key, returns the first element with the bit at depth set. Since all keys in
+// the range share a prefix of depth bits, it's common that every element is on the same side, which is
+// detected by checking the first and last elements. Otherwise, random-access ranges are binary searched.
+// Other ranges (such as the std::map iterators used by UpdateSet and friends) are scanned, since advancing
+// their iterators is linear anyway.
+
+template <typename It, typename GetKey>
+inline It partitionByBit(It begin, It end, size_t depth, GetKey getKey) {
+    if (begin == end || getKey(*begin).getBit(depth)) return begin;
+
+    auto last = std::prev(end);
+    if (!getKey(*last).getBit(depth)) return end;
+
+    auto isLeft = [&](const auto &e){ return !getKey(e).getBit(depth); };
+
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>) {
+        return std::partition_point(std::next(begin), last, isLeft);
+    } else {
+        auto it = std::next(begin);
+        while (it != last && isLeft(*it)) ++it;
+        return it;
+    }
+}
+
+
 }
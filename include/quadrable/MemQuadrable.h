@@ -0,0 +1,69 @@
+#pragma once
+
+namespace quadrable {
+
+
+// A Quadrable that stores all of its nodes in an owned MemStore, and needs no LMDB environment or
+// transactions. Nothing is written to disk. Only a detached head is available: Use getHeadNodeId() and
+// checkout(nodeId) to switch between trees. For operations not wrapped here, use raw() and txn().
+
+class MemQuadrable {
+  public:
+    MemQuadrable() {
+        db.addMemStore(true);
+        db.checkout();
+    }
+
+    Quadrable &raw() { return db; }
+    lmdb::txn &txn() { return stubTxn; }
+
+
+    // Heads
+
+    uint64_t getHeadNodeId() { return db.getHeadNodeId(stubTxn); }
+    void checkout(uint64_t nodeId = 0) { db.checkout(nodeId); }
+
+    std::string root() { return db.root(stubTxn); }
+    Key rootKey() { return db.rootKey(stubTxn); }
+
+    // Frees all nodes (and so invalidates all nodeIds) and checks out the empty tree
+    void clear() {
+        db.removeMemStore();
+        db.addMemStore(true);
+        db.checkout();
+    }
+
+
+    // Updates
+
+    Quadrable::UpdateSet change() { return db.change(); }
+    void apply(Quadrable::UpdateSet &updates) { db.apply(stubTxn, updates); }
+
+    void put(std::string_view key, std::string_view val) { db.put(stubTxn, key, val); }
+    void del(std::string_view key) { db.del(stubTxn, key); }
+
+
+    // Reads
+
+    bool get(std::string_view key, std::string_view &val) { return db.get(stubTxn, key, val); }
+    GetMultiQuery get(std::set<std::string> keys) { return db.get(stubTxn, std::move(keys)); }
+
+    Quadrable::Stats stats() { return db.stats(stubTxn); }
+
+
+    // Proofs
+
+    Proof exportProof(const std::vector<std::string> &keys, bool deletable = false) { return db.exportProof(stubTxn, keys, deletable); }
+    Proof exportProofRaw(const std::vector<Key> &keys, bool deletable = false) { return db.exportProofRaw(stubTxn, keys, deletable); }
+    std::vector<Proof> exportProofBatch(const std::vector<std::vector<std::string>> &keySets, bool deletable = false) { return db.exportProofBatch(stubTxn, keySets, deletable); }
+
+    Quadrable::BuiltNode importProof(Proof &proof, std::string expectedRoot = "") { return db.importProof(stubTxn, proof, expectedRoot); }
+    Quadrable::BuiltNode mergeProof(Proof &proof) { return db.mergeProof(stubTxn, proof); }
+
+  private:
+    Quadrable db;
+    lmdb::txn stubTxn{nullptr};
+};
+
+
+}
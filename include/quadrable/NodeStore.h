@@ -0,0 +1,319 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace quadrable {
+
+
+// Storage for node records. All nodes outside of the MemStore nodeId range are read and written through a
+// NodeStore. Leaf nodeIds must be allocated from [1, firstInteriorNodeId) and interior nodeIds from
+// [firstInteriorNodeId, firstMemStoreNodeId), and are never re-used.
+//
+// The txn is always provided since heads, tracked keys, etc are still stored in LMDB, but stores other than
+// LmdbNodeStore are not transactional: Nodes written in an aborted txn remain (unreachable) until collected.
+// A string_view returned by get() must remain valid until the node is deleted or the txn ends.
+
+class NodeStore {
+  public:
+    virtual ~NodeStore() {}
+
+    virtual bool get(lmdb::txn &txn, uint64_t nodeId, std::string_view &output) = 0;
+    virtual uint64_t allocateId(lmdb::txn &txn, bool isLeaf) = 0;
+    virtual void put(lmdb::txn &txn, uint64_t nodeId, std::string_view nodeRaw) = 0;
+    virtual void del(lmdb::txn &txn, uint64_t nodeId) = 0;
+    virtual void forEach(lmdb::txn &txn, const std::function<void(uint64_t)> &cb) = 0; // for garbage collection
+};
+
+
+
+// The default store: Leaves and interior nodes in separate LMDB tables
+
+class LmdbNodeStore : public NodeStore {
+  public:
+    LmdbNodeStore(lmdb::dbi &dbi_nodesLeaf_, lmdb::dbi &dbi_nodesInterior_) : dbi_nodesLeaf(dbi_nodesLeaf_), dbi_nodesInterior(dbi_nodesInterior_) {}
+
+    bool get(lmdb::txn &txn, uint64_t nodeId, std::string_view &output) override {
+        return dbiFor(nodeId).get(txn, lmdb::to_sv<uint64_t>(nodeId), output);
+    }
+
+    uint64_t allocateId(lmdb::txn &txn, bool isLeaf) override {
+        auto cursor = lmdb::cursor::open(txn, isLeaf ? dbi_nodesLeaf : dbi_nodesInterior);
+        std::string_view k, v;
+
+        if (cursor.get(k, v, MDB_LAST)) {
+            return lmdb::from_sv<uint64_t>(k) + 1;
+        } else {
+            return isLeaf ? 1 : firstInteriorNodeId;
+        }
+    }
+
+    void put(lmdb::txn &txn, uint64_t nodeId, std::string_view nodeRaw) override {
+        dbiFor(nodeId).put(txn, lmdb::to_sv<uint64_t>(nodeId), nodeRaw);
+    }
+
+    void del(lmdb::txn &txn, uint64_t nodeId) override {
+        dbiFor(nodeId).del(txn, lmdb::to_sv<uint64_t>(nodeId));
+    }
+
+    void forEach(lmdb::txn &txn, const std::function<void(uint64_t)> &cb) override {
+        std::string_view k, v;
+
+        for (auto *dbi : { &dbi_nodesInterior, &dbi_nodesLeaf }) {
+            auto cursor = lmdb::cursor::open(txn, *dbi);
+            for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+                cb(lmdb::from_sv<uint64_t>(k));
+            }
+        }
+    }
+
+  private:
+    lmdb::dbi &dbi_nodesLeaf;
+    lmdb::dbi &dbi_nodesInterior;
+
+    lmdb::dbi &dbiFor(uint64_t nodeId) {
+        return nodeId >= firstInteriorNodeId ? dbi_nodesInterior : dbi_nodesLeaf;
+    }
+};
+
+
+
+// In-memory store, sharded by nodeId so that several writers can share it with little lock contention.
+// Nodes are lost when the store is destroyed, so heads referring to them must not outlive it.
+
+class HashNodeStore : public NodeStore {
+  public:
+    static const size_t numShards = 64;
+
+    bool get(lmdb::txn &, uint64_t nodeId, std::string_view &output) override {
+        auto &shard = shardFor(nodeId);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+
+        auto it = shard.nodes.find(nodeId);
+        if (it == shard.nodes.end()) return false;
+        output = it->second;
+        return true;
+    }
+
+    uint64_t allocateId(lmdb::txn &, bool isLeaf) override {
+        return isLeaf ? nextLeafNodeId++ : nextInteriorNodeId++;
+    }
+
+    void put(lmdb::txn &, uint64_t nodeId, std::string_view nodeRaw) override {
+        auto &shard = shardFor(nodeId);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+
+        shard.nodes.insert_or_assign(nodeId, std::string(nodeRaw));
+    }
+
+    void del(lmdb::txn &, uint64_t nodeId) override {
+        auto &shard = shardFor(nodeId);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+
+        shard.nodes.erase(nodeId);
+    }
+
+    void forEach(lmdb::txn &, const std::function<void(uint64_t)> &cb) override {
+        for (auto &shard : shards) {
+            std::vector<uint64_t> nodeIds;
+
+            {
+                std::lock_guard<std::mutex> guard(shard.mutex);
+                for (auto &[nodeId, nodeRaw] : shard.nodes) nodeIds.push_back(nodeId);
+            }
+
+            for (auto nodeId : nodeIds) cb(nodeId);
+        }
+    }
+
+  private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::string> nodes;
+    };
+
+    std::array<Shard, numShards> shards;
+    std::atomic<uint64_t> nextLeafNodeId = 1;
+    std::atomic<uint64_t> nextInteriorNodeId = firstInteriorNodeId;
+
+    Shard &shardFor(uint64_t nodeId) {
+        return shards[(nodeId ^ (nodeId >> 58)) % numShards];
+    }
+};
+
+
+
+// Append-only log file, read through a memory map. Every put/del appends a record, so writes are purely
+// sequential. The offsets of live records are kept in memory, and rebuilt by scanning the log on open.
+// Records are not synced to disk until flush() is called. This must happen before the LMDB txn that refers to
+// them (ie by updating a head) is committed, otherwise after a crash the head may point to records that were
+// lost. commit() does both. Threads may get() nodes while another thread is writing.
+//
+// Log record: [8 bytes: nodeId] [4 bytes: size, or 0xFFFFFFFF for a deletion] [size bytes: node]
+
+class LogNodeStore : public NodeStore {
+  public:
+    LogNodeStore(const std::string &path, uint64_t maxSize_ = 64ULL * 1024 * 1024 * 1024) : maxSize(maxSize_) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) throw quaderr("unable to open node log '", path, "': ", strerror(errno));
+
+        struct stat st;
+        if (::fstat(fd, &st)) throw quaderr("unable to stat node log: ", strerror(errno));
+        size = st.st_size;
+        if (size > maxSize) throw quaderr("node log larger than maxSize");
+
+        // Reserve address space for the maximum size, so the mapping never moves and views stay valid as the log grows
+        void *m = ::mmap(nullptr, maxSize, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+        if (m == MAP_FAILED) throw quaderr("unable to mmap node log: ", strerror(errno));
+        base = static_cast<const char *>(m);
+
+        scan();
+    }
+
+    ~LogNodeStore() {
+        ::munmap(const_cast<char *>(base), maxSize);
+        ::close(fd);
+    }
+
+    LogNodeStore(const LogNodeStore &) = delete;
+    LogNodeStore &operator=(const LogNodeStore &) = delete;
+
+    bool get(lmdb::txn &, uint64_t nodeId, std::string_view &output) override {
+        std::shared_lock<std::shared_mutex> guard(mutex);
+
+        auto it = index.find(nodeId);
+        if (it == index.end()) return false;
+        output = std::string_view(base + it->second.offset, it->second.size);
+        return true;
+    }
+
+    uint64_t allocateId(lmdb::txn &, bool isLeaf) override {
+        return isLeaf ? nextLeafNodeId++ : nextInteriorNodeId++;
+    }
+
+    void put(lmdb::txn &, uint64_t nodeId, std::string_view nodeRaw) override {
+        if (nodeRaw.size() >= deletionMarker) throw quaderr("node too large for node log");
+        std::unique_lock<std::shared_mutex> guard(mutex);
+
+        uint64_t offset = append(nodeId, uint32_t(nodeRaw.size()), nodeRaw);
+        index.insert_or_assign(nodeId, Location{ offset, uint32_t(nodeRaw.size()) });
+        noteNodeId(nodeId);
+    }
+
+    void del(lmdb::txn &, uint64_t nodeId) override {
+        std::unique_lock<std::shared_mutex> guard(mutex);
+
+        if (!index.erase(nodeId)) return;
+        append(nodeId, deletionMarker, "");
+    }
+
+    void forEach(lmdb::txn &, const std::function<void(uint64_t)> &cb) override {
+        std::vector<uint64_t> nodeIds;
+
+        {
+            std::shared_lock<std::shared_mutex> guard(mutex);
+            for (auto &[nodeId, loc] : index) nodeIds.push_back(nodeId);
+        }
+
+        for (auto nodeId : nodeIds) cb(nodeId);
+    }
+
+    void flush() {
+        if (::fdatasync(fd)) throw quaderr("unable to sync node log: ", strerror(errno));
+    }
+
+    // Syncs the log, then commits the txn, so that the committed heads only refer to durable records
+
+    void commit(lmdb::txn &txn) {
+        flush();
+        txn.commit();
+    }
+
+    uint64_t logSize() {
+        std::shared_lock<std::shared_mutex> guard(mutex);
+        return size;
+    }
+
+  private:
+    static const uint32_t deletionMarker = 0xFFFFFFFF;
+    static const uint64_t headerSize = 12;
+
+    struct Location {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    int fd = -1;
+    uint64_t maxSize;
+    uint64_t size = 0;
+    const char *base = nullptr;
+    std::shared_mutex mutex; // protects size and index
+    std::unordered_map<uint64_t, Location> index;
+    std::atomic<uint64_t> nextLeafNodeId = 1;
+    std::atomic<uint64_t> nextInteriorNodeId = firstInteriorNodeId;
+
+    void noteNodeId(uint64_t nodeId) {
+        auto &next = nodeId >= firstInteriorNodeId ? nextInteriorNodeId : nextLeafNodeId;
+        uint64_t curr = next;
+        while (curr <= nodeId && !next.compare_exchange_weak(curr, nodeId + 1)) {}
+    }
+
+    uint64_t append(uint64_t nodeId, uint32_t recordSize, std::string_view nodeRaw) {
+        if (size + headerSize + nodeRaw.size() > maxSize) throw quaderr("node log full");
+
+        std::string buf;
+        buf.reserve(headerSize + nodeRaw.size());
+        buf += lmdb::to_sv<uint64_t>(nodeId);
+        buf += lmdb::to_sv<uint32_t>(recordSize);
+        buf += nodeRaw;
+
+        for (size_t written = 0; written < buf.size(); ) {
+            ssize_t res = ::pwrite(fd, buf.data() + written, buf.size() - written, size + written);
+            if (res < 0 && errno == EINTR) continue;
+            if (res < 0) throw quaderr("unable to write node log: ", strerror(errno));
+            written += static_cast<size_t>(res);
+        }
+
+        uint64_t offset = size + headerSize;
+        size += buf.size();
+        return offset;
+    }
+
+    void scan() {
+        uint64_t offset = 0;
+
+        while (offset + headerSize <= size) {
+            uint64_t nodeId = lmdb::from_sv<uint64_t>(std::string_view(base + offset, 8));
+            uint32_t recordSize = lmdb::from_sv<uint32_t>(std::string_view(base + offset + 8, 4));
+
+            if (recordSize == deletionMarker) {
+                index.erase(nodeId);
+                offset += headerSize;
+            } else {
+                if (offset + headerSize + recordSize > size) break;
+                index.insert_or_assign(nodeId, Location{ offset + headerSize, recordSize });
+                offset += headerSize + recordSize;
+            }
+
+            noteNodeId(nodeId);
+        }
+
+        // Discard a partially written record at the end (ie from a crash)
+        if (offset != size) {
+            if (::ftruncate(fd, offset)) throw quaderr("unable to truncate node log: ", strerror(errno));
+            size = offset;
+        }
+    }
+};
+
+
+}
@@ -10,8 +10,16 @@ class Quadrable {
     lmdb::dbi dbi_nodesLeaf;
     lmdb::dbi dbi_nodesInterior;
     lmdb::dbi dbi_key;
+    lmdb::dbi dbi_syncSession;
+    lmdb::dbi dbi_dedup;
+    lmdb::dbi dbi_headHistory;
     bool trackKeys = false;
+    bool dedupNodes = false;
     bool writeToMemStore = false;
+    bool omitLeafHashes = false;
+    bool keepHeadHistory = false;
+    uint64_t nodesRead = 0;
+    uint64_t nodesWritten = 0;
 
   private:
 
@@ -20,6 +28,12 @@ class Quadrable {
     uint64_t detachedHeadNodeId = 0;
     MemStore *memStore = nullptr;
     bool memStoreOwned = false;
+    LmdbNodeStore lmdbNodeStore{dbi_nodesLeaf, dbi_nodesInterior};
+    NodeStore *nodeStore = &lmdbNodeStore;
+    ApplyStats *applyStats = nullptr; // only while an apply() is collecting stats
+    std::unordered_set<uint64_t> applyCreated;
+    std::unordered_set<uint64_t> applyReferenced;
+    static inline thread_local bool snapshotRead = false; // set while this thread reads through a Snapshot
 
   public:
 
@@ -28,6 +42,9 @@ class Quadrable {
     Quadrable() {
     }
 
+    Quadrable(const Quadrable &) = delete;
+    Quadrable &operator=(const Quadrable &) = delete;
+
     ~Quadrable() {
         if (memStore && memStoreOwned) {
             delete memStore;
@@ -41,22 +58,41 @@ class Quadrable {
         dbi_nodesLeaf = lmdb::dbi::open(txn, "quadrable_nodesLeaf", MDB_CREATE | MDB_INTEGERKEY);
         dbi_nodesInterior = lmdb::dbi::open(txn, "quadrable_nodesInterior", MDB_CREATE | MDB_INTEGERKEY);
         if (trackKeys) dbi_key = lmdb::dbi::open(txn, "quadrable_key", MDB_CREATE | MDB_INTEGERKEY);
+        dbi_syncSession = lmdb::dbi::open(txn, "quadrable_syncSession", MDB_CREATE);
+        if (dedupNodes) dbi_dedup = lmdb::dbi::open(txn, "quadrable_dedup", MDB_CREATE);
+        dbi_headHistory = lmdb::dbi::open(txn, "quadrable_headHistory", MDB_CREATE);
+    }
+
+    // Stores nodes in an alternate NodeStore instead of the LMDB node tables. Not owned: The store must
+    // outlive this object. Pass nullptr to revert to LMDB.
+
+    void setNodeStore(NodeStore *store) {
+        nodeStore = store ? store : &lmdbNodeStore;
     }
 
     #include "quadrable/impl/ParsedNode.h"
     #include "quadrable/impl/BuiltNode.h"
     #include "quadrable/impl/heads.h"
+    #include "quadrable/impl/history.h"
     #include "quadrable/impl/get.h"
     #include "quadrable/impl/update.h"
     #include "quadrable/impl/leafKeys.h"
     #include "quadrable/impl/Iterator.h"
     #include "quadrable/impl/proof.h"
+    #include "quadrable/impl/proofBatch.h"
+    #include "quadrable/impl/proofUpdate.h"
+    #include "quadrable/impl/snapshot.h"
     #include "quadrable/impl/sync.h"
+    #include "quadrable/impl/reconcile.h"
     #include "quadrable/impl/walk.h"
     #include "quadrable/impl/stats.h"
     #include "quadrable/impl/gc.h"
+    #include "quadrable/impl/compact.h"
     #include "quadrable/impl/diff.h"
+    #include "quadrable/impl/prune.h"
+    #include "quadrable/impl/dedup.h"
     #include "quadrable/impl/MemStore.h"
+    #include "quadrable/impl/staged.h"
     #include "quadrable/impl/internal.h"
 };
 
@@ -95,6 +95,22 @@ inline void dumpStats(quadrable::Quadrable &db, lmdb::txn &txn) {
     std::cout << std::flush;
 }
 
+inline void dumpApplyStats(const ApplyStats &stats) {
+    std::cout << "applies:         " << stats.applies << "\n";
+    std::cout << "leavesCreated:   " << stats.leavesCreated << "\n";
+    std::cout << "branchesCreated: " << stats.branchesCreated << "\n";
+    std::cout << "otherCreated:    " << stats.otherCreated << "\n";
+    std::cout << "bytesWritten:    " << stats.bytesWritten << "\n";
+    std::cout << "nodesReused:     " << stats.nodesReused << "\n";
+    std::cout << "nodesOrphaned:   " << stats.nodesOrphaned << "\n";
+    std::cout << "hashes:          " << stats.hashes << "\n";
+    std::cout << "hashTimeUs:      " << stats.hashTimeNs / 1000 << "\n";
+    std::cout << "storeTimeUs:     " << stats.storeTimeNs / 1000 << "\n";
+    std::cout << "wallTimeUs:      " << stats.wallTimeNs / 1000 << "\n";
+
+    std::cout << std::flush;
+}
+
 
 
 inline void dumpProof(const Proof &p) {
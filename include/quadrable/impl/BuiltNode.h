@@ -25,6 +25,9 @@ class BuiltNode {
         BuiltNode output;
 
         {
+            ApplyTimer t(db->applyStats, &ApplyStats::hashTimeNs);
+            if (db->applyStats) db->applyStats->hashes += 2;
+
             Key valHash = Key::hash(val);
             unsigned char nullChar = 0;
 
@@ -39,12 +42,17 @@ class BuiltNode {
 
         std::string nodeRaw;
 
-        nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::Leaf));
-        nodeRaw += output.nodeHash.sv();
+        if (db->omitLeafHashes) {
+            nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::CompactLeaf));
+        } else {
+            nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::Leaf));
+            nodeRaw += output.nodeHash.sv();
+        }
+
         nodeRaw += keyHash.sv();
         nodeRaw += val;
 
-        output.nodeId = db->writeNodeToDb(txn, nodeRaw, true);
+        output.nodeId = db->writeNodeToDb(txn, nodeRaw, true, &output.nodeHash);
         output.nodeType = NodeType::Leaf;
 
         db->setLeafKey(txn, output.nodeId, leafKey);
@@ -95,6 +103,9 @@ class BuiltNode {
         BuiltNode output;
 
         {
+            ApplyTimer t(db->applyStats, &ApplyStats::hashTimeNs);
+            if (db->applyStats) db->applyStats->hashes++;
+
             Hash h(sizeof(output.nodeHash.data));
             h.update(leftNode.nodeHash.data, sizeof(leftNode.nodeHash.data));
             h.update(rightNode.nodeHash.data, sizeof(rightNode.nodeHash.data));
@@ -125,8 +136,143 @@ class BuiltNode {
             nodeRaw += lmdb::to_sv<uint64_t>(0); // padding
         }
 
+        output.nodeId = db->writeNodeToDb(txn, nodeRaw, false, &output.nodeHash);
+
+        if (db->applyStats) {
+            db->noteApplyChild(leftNode.nodeId);
+            db->noteApplyChild(rightNode.nodeId);
+        }
+
+        return output;
+    }
+
+    // A run of single-child branches, top-most first. directions has bit i set if level i's child is on the right.
+
+    static BuiltNode newChain(Quadrable *db, lmdb::txn &txn, uint64_t directions, const std::vector<Key> &hashes, uint64_t childNodeId) {
+        if (hashes.size() < 2 || hashes.size() > maxChainLength) throw quaderr("invalid chain length");
+
+        std::string nodeRaw;
+
+        nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::Chain) | childNodeId << 4);
+        nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(hashes.size()) | directions << 8);
+
+        for (auto &h : hashes) nodeRaw += h.sv();
+
+        BuiltNode output;
+
+        output.nodeId = db->writeNodeToDb(txn, nodeRaw, false);
+        output.nodeHash = hashes[0];
+        output.nodeType = (directions & 1) ? NodeType::BranchRight : NodeType::BranchLeft;
+
+        return output;
+    }
+
+    // A branch with one or both of its leaf children stored inside its own record. leftLeafRaw/rightLeafRaw are
+    // the complete leaf records of the children to inline, or empty if that child is stored separately.
+
+    static BuiltNode newInlineBranch(Quadrable *db, lmdb::txn &txn, const BuiltNode &leftNode, const BuiltNode &rightNode, std::string_view leftLeafRaw, std::string_view rightLeafRaw) {
+        if (leftLeafRaw.size() == 0 && rightLeafRaw.size() == 0) throw quaderr("no leaves to inline");
+
+        BuiltNode output;
+
+        {
+            Hash h(sizeof(output.nodeHash.data));
+            h.update(leftNode.nodeHash.data, sizeof(leftNode.nodeHash.data));
+            h.update(rightNode.nodeHash.data, sizeof(rightNode.nodeHash.data));
+            h.final(output.nodeHash.data);
+        }
+
+        if (rightNode.nodeId == 0) output.nodeType = NodeType::BranchLeft;
+        else if (leftNode.nodeId == 0) output.nodeType = NodeType::BranchRight;
+        else output.nodeType = NodeType::BranchBoth;
+
+        uint64_t otherNodeId = leftLeafRaw.size() ? (rightLeafRaw.size() ? 0 : rightNode.nodeId) : leftNode.nodeId;
+        uint64_t w2 = (leftLeafRaw.size() ? 1 : 0) | (rightLeafRaw.size() ? 2 : 0) | uint64_t(leftLeafRaw.size()) << 8;
+
+        std::string nodeRaw;
+
+        nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::InlineBranch) | otherNodeId << 4);
+        nodeRaw += output.nodeHash.sv();
+        nodeRaw += lmdb::to_sv<uint64_t>(w2);
+        nodeRaw += leftLeafRaw;
+        nodeRaw += rightLeafRaw;
+
         output.nodeId = db->writeNodeToDb(txn, nodeRaw, false);
 
+        if (db->trackKeys) {
+            std::string_view leafKey;
+
+            if (leftLeafRaw.size() && db->getLeafKey(txn, leftNode.nodeId, leafKey)) db->setLeafKey(txn, output.nodeId | inlineLeftOffset, std::string(leafKey));
+            if (rightLeafRaw.size() && db->getLeafKey(txn, rightNode.nodeId, leafKey)) db->setLeafKey(txn, output.nodeId | inlineRightOffset, std::string(leafKey));
+        }
+
+        return output;
+    }
+
+    // A fragment of up to maxPageLevels levels of branches, stored in a single record. pageNodes must be in
+    // position order, starting with the root at position 0, and the parent of every other node must also be
+    // in the page. leftNodeId/rightNodeId are only used for children that are not in the page.
+
+    struct PageNode {
+        uint64_t position;
+        Key nodeHash;
+        uint64_t leftNodeId;
+        uint64_t rightNodeId;
+    };
+
+    static std::string encodePage(uint64_t levels, const std::vector<PageNode> &pageNodes) {
+        if (levels < 1 || levels > maxPageLevels) throw quaderr("invalid page levels");
+        if (pageNodes.size() == 0 || pageNodes[0].position != 0) throw quaderr("page has no root");
+
+        uint64_t numPositions = (1ULL << levels) - 1;
+        std::string bitmap((numPositions + 7) / 8, '\0');
+
+        for (size_t i = 0; i < pageNodes.size(); i++) {
+            auto &n = pageNodes[i];
+            if (n.position >= numPositions) throw quaderr("invalid page position");
+            if (i && n.position <= pageNodes[i - 1].position) throw quaderr("page nodes not in position order");
+            bitmap[n.position / 8] |= 1 << (n.position % 8);
+        }
+
+        auto present = [&](uint64_t pos){
+            return pos < numPositions && ((static_cast<unsigned char>(bitmap[pos / 8]) >> (pos % 8)) & 1);
+        };
+
+        std::string nodeRaw;
+
+        nodeRaw += lmdb::to_sv<uint64_t>(uint64_t(NodeType::Page) | levels << 4);
+        nodeRaw += bitmap;
+
+        for (auto &n : pageNodes) {
+            if (n.position && !present((n.position - 1) / 2)) throw quaderr("page node without parent");
+            nodeRaw += n.nodeHash.sv();
+        }
+
+        for (auto &n : pageNodes) {
+            if (!present(2 * n.position + 1)) nodeRaw += lmdb::to_sv<uint64_t>(n.leftNodeId);
+            if (!present(2 * n.position + 2)) nodeRaw += lmdb::to_sv<uint64_t>(n.rightNodeId);
+        }
+
+        return nodeRaw;
+    }
+
+    static BuiltNode newPage(Quadrable *db, lmdb::txn &txn, uint64_t levels, const std::vector<PageNode> &pageNodes) {
+        BuiltNode output;
+
+        output.nodeId = db->writeNodeToDb(txn, encodePage(levels, pageNodes), false);
+        output.nodeHash = pageNodes[0].nodeHash;
+
+        bool hasLeft = pageNodes[0].leftNodeId, hasRight = pageNodes[0].rightNodeId;
+
+        for (auto &n : pageNodes) {
+            if (n.position == 1) hasLeft = true;
+            if (n.position == 2) hasRight = true;
+        }
+
+        if (hasLeft && hasRight) output.nodeType = NodeType::BranchBoth;
+        else if (hasLeft) output.nodeType = NodeType::BranchLeft;
+        else output.nodeType = NodeType::BranchRight;
+
         return output;
     }
 
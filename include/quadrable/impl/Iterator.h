@@ -12,9 +12,15 @@ struct Iterator {
     lmdb::txn &txn;
     std::vector<ParsedNode> nodeStack;
     bool reverse;
+    bool snapshotRead = false; // pinned to rootNodeId, and doesn't update db's counters
+    uint64_t rootNodeId = 0;
 
-    Iterator(Quadrable *db_, lmdb::txn &txn_, const Key &target, bool reverse_ = false) : db(db_), txn(txn_), reverse(reverse_) {
-        nodeStack.emplace_back(db, txn, db->getHeadNodeId(txn));
+    Iterator(Quadrable *db_, lmdb::txn &txn_, const Key &target, bool reverse_ = false) : Iterator(db_, txn_, db_->getHeadNodeId(txn_), target, reverse_, false) {}
+
+    Iterator(Quadrable *db_, lmdb::txn &txn_, uint64_t rootNodeId_, const Key &target, bool reverse_, bool snapshotRead_) : db(db_), txn(txn_), reverse(reverse_), snapshotRead(snapshotRead_), rootNodeId(rootNodeId_) {
+        SnapshotReadGuard g(snapshotRead);
+
+        pushNode(rootNodeId);
 
         bool leftBias = false;
 
@@ -28,10 +34,10 @@ struct Iterator {
                     nextNodeId = nodeStack.back().rightNodeId;
                     leftBias = true;
                 }
-                nodeStack.emplace_back(db, txn, nextNodeId);
+                pushNode(nextNodeId);
                 break;
             } else {
-                nodeStack.emplace_back(db, txn, nextNodeId);
+                pushNode(nextNodeId);
             }
         }
 
@@ -39,7 +45,7 @@ struct Iterator {
             uint64_t nextNodeId;
             if (leftBias) nextNodeId = nodeStack.back().leftNodeId != 0 ? nodeStack.back().leftNodeId : nodeStack.back().rightNodeId;
             else nextNodeId = nodeStack.back().rightNodeId != 0 ? nodeStack.back().rightNodeId : nodeStack.back().leftNodeId;
-            nodeStack.emplace_back(db, txn, nextNodeId);
+            pushNode(nextNodeId);
         }
 
         if (nodeStack.back().isLeaf()) {
@@ -52,6 +58,8 @@ struct Iterator {
     }
 
     void next() {
+        SnapshotReadGuard g(snapshotRead);
+
         {
             uint64_t prevNodeId;
             uint64_t testNodeId;
@@ -65,14 +73,14 @@ struct Iterator {
 
         if (nodeStack.size() == 0) return;
 
-        nodeStack.emplace_back(db, txn, reverse ? nodeStack.back().leftNodeId : nodeStack.back().rightNodeId);
+        pushNode(reverse ? nodeStack.back().leftNodeId : nodeStack.back().rightNodeId);
 
         while (nodeStack.back().isBranch()) {
             uint64_t nextNodeId;
             if (reverse) nextNodeId = nodeStack.back().rightNodeId != 0 ? nodeStack.back().rightNodeId : nodeStack.back().leftNodeId;
             else nextNodeId = nodeStack.back().leftNodeId != 0 ? nodeStack.back().leftNodeId : nodeStack.back().rightNodeId;
 
-            nodeStack.emplace_back(db, txn, nextNodeId);
+            pushNode(nextNodeId);
         }
     }
 
@@ -100,16 +108,28 @@ struct Iterator {
     }
 
     bool restore(lmdb::txn &txn_, const SavedIterator &s) {
+        SnapshotReadGuard g(snapshotRead);
+
         nodeStack.clear();
-        nodeStack.emplace_back(db, txn, db->getHeadNodeId(txn));
+        pushNode(snapshotRead ? rootNodeId : db->getHeadNodeId(txn));
 
         for (size_t i = 0; i < s.depth; i++) {
             if (!nodeStack.back().isBranch()) return false;
-            nodeStack.emplace_back(db, txn, s.path.getBit(i) ? nodeStack.back().rightNodeId : nodeStack.back().leftNodeId);
+            pushNode(s.path.getBit(i) ? nodeStack.back().rightNodeId : nodeStack.back().leftNodeId);
         }
 
         return true;
     }
+
+  private:
+    // Nodes stored in the same record as their parent (such as branches in a page) are parsed from the parent's
+    // record. Space for the deepest possible path is reserved first, so that the parent isn't moved by emplace_back().
+
+    void pushNode(uint64_t nodeId) {
+        if (nodeStack.capacity() < 257) nodeStack.reserve(257);
+        const ParsedNode *parent = nodeStack.size() ? &nodeStack.back() : nullptr;
+        nodeStack.emplace_back(db, txn, nodeId, parent);
+    }
 };
 
 Iterator iterate(lmdb::txn &txn, const Key &target, bool reverse = false) {
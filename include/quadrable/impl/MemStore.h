@@ -1,15 +1,17 @@
 public:
 
 void addMemStore(bool _writeToMemStore = true) {
+    if (memStore) throw quaderr("memStore already installed");
     memStore = new MemStore;
     memStoreOwned = true;
+    writeToMemStore = _writeToMemStore;
 }
 
 void removeMemStore() {
     if (!memStoreOwned) throw quaderr("can't remove non-owned MemStore");
     delete memStore;
     memStore = nullptr;
-    memStoreOwned = false;
+    memStoreOwned = writeToMemStore = false;
 }
 
 void withMemStore(MemStore &m, std::function<void()> cb) {
@@ -17,6 +19,32 @@ void withMemStore(MemStore &m, std::function<void()> cb) {
     cb();
 }
 
+// Copies the tree at a MemStore nodeId into the NodeStore (regardless of writeToMemStore) and returns its new root.
+// Nodes are written children-first in a single pass, so the new nodes get consecutive nodeIds. Nodes that are
+// already outside the MemStore are referenced as-is.
+//
+// Witnesses are replaced with complete sub-trees where possible: If the node at the same position in baseNodeId
+// (typically the head that the MemStore tree was forked or proved from) has the same hash, it is re-used. This
+// also avoids copying any unmodified sub-trees. With dedupNodes, WitnessLeaf nodes are also looked up in the
+// index, which has their nodeHash. Interior nodes are indexed by their record, not their nodeHash, so Witness
+// nodes can only be resolved through the base.
+
+BuiltNode flushMemStore(lmdb::txn &txn, uint64_t nodeId, uint64_t baseNodeId = 0) {
+    if (!memStore) throw quaderr("no MemStore configured");
+
+    bool origWriteToMemStore = writeToMemStore;
+    writeToMemStore = false;
+
+    try {
+        auto output = flushMemStoreAux(txn, nodeId, baseNodeId, 0);
+        writeToMemStore = origWriteToMemStore;
+        return output;
+    } catch (...) {
+        writeToMemStore = origWriteToMemStore;
+        throw;
+    }
+}
+
 private:
 
 struct MemStoreGuard {
@@ -35,3 +63,37 @@ struct MemStoreGuard {
         db->memStore = nullptr;
     }
 };
+
+BuiltNode flushMemStoreAux(lmdb::txn &txn, uint64_t nodeId, uint64_t baseNodeId, uint64_t depth) {
+    assertDepth(depth);
+
+    if (nodeId < firstMemStoreNodeId) return BuiltNode::reuse(ParsedNode(this, txn, nodeId));
+
+    ParsedNode node(this, txn, nodeId);
+    ParsedNode base(this, txn, baseNodeId);
+
+    if (node.isEmpty()) return BuiltNode::empty();
+    if (!base.isEmpty() && base.nodeHash() == node.nodeHash()) return BuiltNode::reuse(base);
+
+    if (node.isWitnessAny()) {
+        if (dedupNodes && node.isWitnessLeaf()) {
+            std::string_view existingNodeIdRaw;
+
+            if (dbi_dedup.get(txn, node.nodeHash(), existingNodeIdRaw)) {
+                ParsedNode existing(this, txn, lmdb::from_sv<uint64_t>(existingNodeIdRaw));
+                if (existing.nodeHash() == node.nodeHash()) return BuiltNode::reuse(existing);
+            }
+        }
+
+        if (node.isWitnessLeaf()) return BuiltNode::newWitnessLeaf(this, txn, Key::existing(node.leafKeyHash()), Key::existing(node.leafValHash()));
+        return BuiltNode::newWitness(this, txn, Key::existing(node.nodeHash()));
+    } else if (node.isLeaf()) {
+        return BuiltNode::newLeaf(this, txn, Key::existing(node.leafKeyHash()), node.leafVal());
+    } else if (node.isBranch()) {
+        auto leftNode = flushMemStoreAux(txn, node.leftNodeId, base.isBranch() ? base.leftNodeId : 0, depth + 1);
+        auto rightNode = flushMemStoreAux(txn, node.rightNodeId, base.isBranch() ? base.rightNodeId : 0, depth + 1);
+        return BuiltNode::newBranch(this, txn, leftNode, rightNode);
+    } else {
+        throw quaderr("unexpected node type in MemStore");
+    }
+}
@@ -11,14 +11,32 @@ class ParsedNode {
     uint64_t leftNodeId = 0;
     uint64_t rightNodeId = 0;
     uint64_t nodeId;
+    uint64_t chainOffset = 0; // level within a Chain record, side of a leaf inlined into an InlineBranch record, or position within a Page
+    bool inChain = false;
+    bool inlined = false;
+    bool inPage = false;
+    bool leafHashOmitted = false; // stored as a CompactLeaf
 
-    ParsedNode(Quadrable *db, lmdb::txn &txn, uint64_t nodeId_) : nodeId(nodeId_) {
+    // If parent is provided and nodeId is stored in the same record (a chain level, an inlined leaf, or a branch in a page), the record is not looked up again.
+    // Writing to the DB may move records that are on pages modified by this transaction, so the parent's record is only used if no nodes have been written since it was loaded.
+    // Snapshot reads always use it: Their txns don't write, and nodesWritten isn't read since another thread may be writing through the same Quadrable.
+
+    ParsedNode(Quadrable *db, lmdb::txn &txn, uint64_t nodeId_, const ParsedNode *parent = nullptr) : nodeId(nodeId_), recordNodesWritten(snapshotRead ? 0 : db->nodesWritten) {
         if (nodeId == 0) {
             nodeType = NodeType::Empty;
             return;
         }
 
-        if (!db->getNode(txn, nodeId, raw)) throw quaderr("couldn't find nodeId ", nodeId);
+        uint64_t recordNodeId = nodeId & ~chainOffsetMask;
+        chainOffset = (nodeId & chainOffsetMask) >> chainOffsetShift;
+
+        if (parent && parent->record.size() && (parent->nodeId & ~chainOffsetMask) == recordNodeId && (snapshotRead || parent->recordNodesWritten == recordNodesWritten)) {
+            record = parent->record;
+        } else if (!db->getNode(txn, recordNodeId, record)) {
+            throw quaderr("couldn't find nodeId ", nodeId);
+        }
+
+        raw = record;
 
         if (raw.size() < 8) throw quaderr("invalid node, too short");
 
@@ -26,6 +44,137 @@ class ParsedNode {
         nodeType = static_cast<NodeType>(w1Packed & 0x0F);
         uint64_t w1 = w1Packed >> 4;
 
+        if (nodeType == NodeType::Chain) {
+            if (raw.size() < 16) throw quaderr("invalid chain node, too short");
+
+            uint64_t w2 = lmdb::from_sv<uint64_t>(raw.substr(8, 8));
+            uint64_t length = w2 & 0xFF;
+
+            if (chainOffset >= length || raw.size() != 16 + 32 * length) throw quaderr("invalid chain node");
+
+            inChain = true;
+            hashOffset = 16 + 32 * chainOffset;
+
+            uint64_t next = chainOffset + 1 < length ? (recordNodeId | ((chainOffset + 1) << chainOffsetShift)) : w1;
+
+            if ((w2 >> (8 + chainOffset)) & 1) {
+                nodeType = NodeType::BranchRight;
+                rightNodeId = next;
+            } else {
+                nodeType = NodeType::BranchLeft;
+                leftNodeId = next;
+            }
+
+            return;
+        }
+
+        if (nodeType == NodeType::InlineBranch) {
+            if (raw.size() < 48) throw quaderr("invalid inline branch node, too short");
+
+            uint64_t w2 = lmdb::from_sv<uint64_t>(raw.substr(40, 8));
+            uint64_t leftLeafSize = w2 >> 8;
+            bool leftInlined = w2 & 1, rightInlined = w2 & 2;
+
+            if ((!leftInlined && !rightInlined) || (leftInlined && rightInlined && w1) || leftLeafSize > raw.size() - 48) throw quaderr("invalid inline branch node");
+
+            if (chainOffset == 0) {
+                nodeType = NodeType::BranchBoth;
+                leftNodeId = leftInlined ? (recordNodeId | inlineLeftOffset) : w1;
+                rightNodeId = rightInlined ? (recordNodeId | inlineRightOffset) : w1;
+                if (!leftNodeId) nodeType = NodeType::BranchRight;
+                if (!rightNodeId) nodeType = NodeType::BranchLeft;
+                return;
+            }
+
+            if (chainOffset == (inlineLeftOffset >> chainOffsetShift) && leftInlined) {
+                raw = raw.substr(48, leftLeafSize);
+            } else if (chainOffset == (inlineRightOffset >> chainOffsetShift) && rightInlined) {
+                raw = raw.substr(48 + leftLeafSize);
+            } else {
+                throw quaderr("invalid inline leaf nodeId");
+            }
+
+            if (raw.size() < 8) throw quaderr("invalid inline leaf, too short");
+
+            inlined = true;
+            nodeType = static_cast<NodeType>(lmdb::from_sv<uint64_t>(raw.substr(0, 8)) & 0x0F);
+
+            if (nodeType == NodeType::CompactLeaf) parseCompactLeaf();
+            else if (nodeType != NodeType::Leaf || raw.size() < 72) throw quaderr("invalid inline leaf");
+
+            return;
+        }
+
+        if (nodeType == NodeType::Page) {
+            uint64_t levels = w1;
+            if (levels < 1 || levels > maxPageLevels) throw quaderr("invalid page node");
+
+            uint64_t numPositions = (1ULL << levels) - 1;
+            size_t bitmapOffset = 8;
+            size_t hashesOffset = bitmapOffset + (numPositions + 7) / 8;
+            if (raw.size() < hashesOffset) throw quaderr("invalid page node, too short");
+
+            uint64_t bitmap[4] = {}; // bit p is set if position p is in the page
+
+            for (size_t i = 0; i < hashesOffset - bitmapOffset; i++) {
+                bitmap[i / 8] |= uint64_t(static_cast<unsigned char>(raw[bitmapOffset + i])) << (8 * (i % 8));
+            }
+
+            auto present = [&](uint64_t pos){
+                return pos < numPositions && ((bitmap[pos / 64] >> (pos % 64)) & 1);
+            };
+
+            // Number of positions before pos that are in the page
+
+            auto countBefore = [&](uint64_t pos){
+                pos = std::min(pos, numPositions);
+                uint64_t count = 0;
+                for (uint64_t w = 0; w < pos / 64; w++) count += __builtin_popcountll(bitmap[w]);
+                if (pos % 64) count += __builtin_popcountll(bitmap[pos / 64] & ((1ULL << (pos % 64)) - 1));
+                return count;
+            };
+
+            if (!present(chainOffset) || (chainOffset && !present((chainOffset - 1) / 2))) throw quaderr("invalid page nodeId");
+
+            // Children that aren't in the page have their nodeIds stored after the hashes, in position order. Every
+            // branch in the page other than the root is the child of an earlier one (see encodePage()), so the page has
+            // one more external child than branches, and the children of the branches before this one are at positions
+            // 1 to 2*chainOffset.
+
+            uint64_t numPresent = countBefore(numPositions);
+            uint64_t numExternal = numPresent + 1;
+            uint64_t rank = countBefore(chainOffset);
+            uint64_t externalIndex = 2 * rank - (countBefore(2 * chainOffset + 1) - 1);
+
+            size_t externalsOffset = hashesOffset + 32 * numPresent;
+            if (raw.size() != externalsOffset + 8 * numExternal) throw quaderr("invalid page node");
+
+            inPage = true;
+            hashOffset = hashesOffset + 32 * rank;
+
+            auto child = [&](uint64_t pos){
+                if (present(pos)) return recordNodeId | (pos << chainOffsetShift);
+                return lmdb::from_sv<uint64_t>(raw.substr(externalsOffset + 8 * externalIndex++, 8));
+            };
+
+            leftNodeId = child(2 * chainOffset + 1);
+            rightNodeId = child(2 * chainOffset + 2);
+
+            if (leftNodeId && rightNodeId) nodeType = NodeType::BranchBoth;
+            else if (leftNodeId) nodeType = NodeType::BranchLeft;
+            else if (rightNodeId) nodeType = NodeType::BranchRight;
+            else throw quaderr("invalid page node, branch has no children");
+
+            return;
+        }
+
+        if (chainOffset) throw quaderr("chain offset in nodeId of non-chain node");
+
+        if (nodeType == NodeType::CompactLeaf) {
+            parseCompactLeaf();
+            return;
+        }
+
         if (nodeType == NodeType::BranchLeft) {
             leftNodeId = w1;
         } else if (nodeType == NodeType::BranchRight) {
@@ -46,12 +195,22 @@ class ParsedNode {
     std::string_view nodeHash() const {
         static const char nullBytes[32] = {};
         if (isEmpty()) return std::string_view{nullBytes, 32};
-        return raw.substr(8, 32);
+
+        if (leafHashOmitted) {
+            // Recomputed on first use, and then kept for the lifetime of this ParsedNode
+            if (!computedHashValid) {
+                computedHash = leafNodeHash(key(), leafVal());
+                computedHashValid = true;
+            }
+            return computedHash.sv();
+        }
+
+        return raw.substr(hashOffset, 32);
     }
 
     std::string_view leafKeyHash() const {
         if (!isLeaf()) throw quaderr("node is not a Leaf/WitnessLeaf");
-        return raw.substr(8 + 32, 32);
+        return raw.substr(keyHashOffset, 32);
     }
 
     Key key() const {
@@ -60,7 +219,7 @@ class ParsedNode {
 
     std::string_view leafVal() const {
         if (nodeType != NodeType::Leaf) throw quaderr("node is not a Leaf");
-        return raw.substr(8 + 32 + 32);
+        return raw.substr(keyHashOffset + 32);
     }
 
     std::string leafValHash() const {
@@ -72,4 +231,19 @@ class ParsedNode {
 
         throw quaderr("node is not a Leaf/WitnessLeaf");
     }
+
+  private:
+    std::string_view record; // the entire record, which raw may be a sub-string of
+    uint64_t recordNodesWritten; // db->nodesWritten when record was loaded
+    size_t hashOffset = 8;
+    size_t keyHashOffset = 8 + 32;
+    mutable Key computedHash;
+    mutable bool computedHashValid = false;
+
+    void parseCompactLeaf() {
+        if (raw.size() < 8 + 32) throw quaderr("invalid compact leaf, too short");
+        nodeType = NodeType::Leaf;
+        leafHashOmitted = true;
+        keyHashOffset = 8;
+    }
 };
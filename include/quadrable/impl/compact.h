@@ -0,0 +1,195 @@
+public:
+
+// Rewrites runs of single-child branches into Chain records, which store the nodeHash of every level in
+// a single record. The logical tree (and therefore its root, proofs, etc) is unchanged. Updates to a
+// compacted tree are supported, but any modified levels will be stored as regular branches again.
+
+BuiltNode compactChains(lmdb::txn &txn) {
+    auto newNode = compactChains(txn, getHeadNodeId(txn));
+    setHeadNodeId(txn, newNode.nodeId);
+    return newNode;
+}
+
+BuiltNode compactChains(lmdb::txn &txn, uint64_t nodeId) {
+    return compactChainsAux(txn, nodeId, 0);
+}
+
+// Rewrites branches that have Leaf children with values of at most maxValSize bytes into InlineBranch records,
+// which embed the complete leaf records. As with chains, the logical tree is unchanged. Inlined leaves get new
+// (virtual) nodeIds, so leaf nodeIds obtained before inlining will no longer be valid once the old leaves are GCed.
+
+BuiltNode inlineLeaves(lmdb::txn &txn, uint64_t maxValSize) {
+    auto newNode = inlineLeaves(txn, getHeadNodeId(txn), maxValSize);
+    setHeadNodeId(txn, newNode.nodeId);
+    return newNode;
+}
+
+BuiltNode inlineLeaves(lmdb::txn &txn, uint64_t nodeId, uint64_t maxValSize) {
+    return inlineLeavesAux(txn, nodeId, maxValSize, 0);
+}
+
+// Rewrites the tree's branches into Page records, each holding a fragment of up to `levels` levels (like a
+// B-tree page), so that a lookup needs one LMDB get per page rather than one per level. The logical tree is
+// unchanged. Chains and inline branches covered by a page are replaced by it, so this is an alternative to those.
+
+BuiltNode packPages(lmdb::txn &txn, uint64_t levels) {
+    auto newNode = packPages(txn, getHeadNodeId(txn), levels);
+    setHeadNodeId(txn, newNode.nodeId);
+    return newNode;
+}
+
+BuiltNode packPages(lmdb::txn &txn, uint64_t nodeId, uint64_t levels) {
+    if (levels < 1 || levels > maxPageLevels) throw quaderr("page levels must be between 1 and ", maxPageLevels);
+    return packPagesAux(txn, nodeId, levels, 0);
+}
+
+
+private:
+
+BuiltNode compactChainsAux(lmdb::txn &txn, uint64_t nodeId, uint64_t depth) {
+    ParsedNode node(this, txn, nodeId);
+
+    if (!node.isBranch()) return BuiltNode::reuse(node);
+
+    assertDepth(depth);
+
+    if (node.nodeType == NodeType::BranchBoth) {
+        auto leftNode = compactChainsAux(txn, node.leftNodeId, depth + 1);
+        auto rightNode = compactChainsAux(txn, node.rightNodeId, depth + 1);
+
+        if (leftNode.nodeId == node.leftNodeId && rightNode.nodeId == node.rightNodeId) return BuiltNode::reuse(node);
+
+        return BuiltNode::newBranch(this, txn, leftNode, rightNode);
+    }
+
+    // Collect a run of single-child branches
+
+    uint64_t directions = 0;
+    std::vector<Key> hashes;
+    uint64_t currNodeId = nodeId;
+
+    while (hashes.size() < maxChainLength) {
+        ParsedNode curr(this, txn, currNodeId);
+        if (curr.nodeType != NodeType::BranchLeft && curr.nodeType != NodeType::BranchRight) break;
+
+        if (curr.nodeType == NodeType::BranchRight) directions |= 1ULL << hashes.size();
+        hashes.push_back(Key::existing(curr.nodeHash()));
+        currNodeId = curr.leftNodeId ? curr.leftNodeId : curr.rightNodeId;
+    }
+
+    auto childNode = compactChainsAux(txn, currNodeId, depth + hashes.size());
+
+    if (hashes.size() == 1) {
+        if (childNode.nodeId == currNodeId) return BuiltNode::reuse(node);
+        if (directions & 1) return BuiltNode::newBranch(this, txn, BuiltNode::empty(), childNode);
+        return BuiltNode::newBranch(this, txn, childNode, BuiltNode::empty());
+    }
+
+    // Already compacted
+
+    if (node.inChain && node.chainOffset == 0 && childNode.nodeId == currNodeId) {
+        uint64_t chainChildNodeId = lmdb::from_sv<uint64_t>(node.raw.substr(0, 8)) >> 4;
+        uint64_t chainLength = lmdb::from_sv<uint64_t>(node.raw.substr(8, 8)) & 0xFF;
+        if (chainLength == hashes.size() && chainChildNodeId == currNodeId) return BuiltNode::reuse(node);
+    }
+
+    return BuiltNode::newChain(this, txn, directions, hashes, childNode.nodeId);
+}
+
+BuiltNode inlineLeavesAux(lmdb::txn &txn, uint64_t nodeId, uint64_t maxValSize, uint64_t depth) {
+    ParsedNode node(this, txn, nodeId);
+
+    if (!node.isBranch()) return BuiltNode::reuse(node);
+
+    assertDepth(depth);
+
+    auto leftNode = inlineLeavesAux(txn, node.leftNodeId, maxValSize, depth + 1);
+    auto rightNode = inlineLeavesAux(txn, node.rightNodeId, maxValSize, depth + 1);
+
+    ParsedNode leftChild(this, txn, leftNode.nodeId);
+    ParsedNode rightChild(this, txn, rightNode.nodeId);
+
+    bool inlineLeft = leftChild.nodeType == NodeType::Leaf && leftChild.leafVal().size() <= maxValSize;
+    bool inlineRight = rightChild.nodeType == NodeType::Leaf && rightChild.leafVal().size() <= maxValSize;
+
+    // Already in the desired layout
+
+    if (leftNode.nodeId == node.leftNodeId && rightNode.nodeId == node.rightNodeId
+            && inlineLeft == (leftChild.inlined && (leftChild.nodeId & ~chainOffsetMask) == node.nodeId)
+            && inlineRight == (rightChild.inlined && (rightChild.nodeId & ~chainOffsetMask) == node.nodeId)) {
+        return BuiltNode::reuse(node);
+    }
+
+    if (!inlineLeft && !inlineRight) return BuiltNode::newBranch(this, txn, leftNode, rightNode);
+
+    return BuiltNode::newInlineBranch(this, txn, leftNode, rightNode, inlineLeft ? leftChild.raw : "", inlineRight ? rightChild.raw : "");
+}
+
+BuiltNode packPagesAux(lmdb::txn &txn, uint64_t nodeId, uint64_t levels, uint64_t depth) {
+    std::vector<BuiltNode::PageNode> pageNodes;
+    uint64_t numPositions = (1ULL << levels) - 1;
+    std::vector<bool> inPage(numPositions);
+
+    {
+        ParsedNode node(this, txn, nodeId);
+        if (!node.isBranch()) return BuiltNode::reuse(node);
+
+        assertDepth(depth);
+
+        std::function<void(const ParsedNode &, uint64_t)> collect = [&](const ParsedNode &n, uint64_t position){
+            pageNodes.push_back({ position, Key::existing(n.nodeHash()), n.leftNodeId, n.rightNodeId });
+            inPage[position] = true;
+
+            for (uint64_t childPosition : { 2 * position + 1, 2 * position + 2 }) {
+                uint64_t childNodeId = childPosition % 2 ? n.leftNodeId : n.rightNodeId;
+                if (childPosition >= numPositions || childNodeId == 0) continue;
+
+                ParsedNode child(this, txn, childNodeId, &n);
+                if (child.isBranch()) collect(child, childPosition);
+            }
+        };
+
+        collect(node, 0);
+    }
+
+    std::sort(pageNodes.begin(), pageNodes.end(), [](const auto &a, const auto &b){ return a.position < b.position; });
+
+    // Pack the sub-trees beneath the page. No ParsedNodes are held here, since this modifies the DB.
+
+    BuiltNode rootLeft = BuiltNode::empty(), rootRight = BuiltNode::empty();
+    bool changed = false;
+
+    for (auto &n : pageNodes) {
+        uint64_t childDepth = depth + 64 - __builtin_clzll(n.position + 1);
+
+        for (uint64_t childPosition : { 2 * n.position + 1, 2 * n.position + 2 }) {
+            if (childPosition < numPositions && inPage[childPosition]) continue;
+
+            uint64_t &childNodeId = childPosition % 2 ? n.leftNodeId : n.rightNodeId;
+            auto newChild = packPagesAux(txn, childNodeId, levels, childDepth);
+
+            if (newChild.nodeId != childNodeId) changed = true;
+            childNodeId = newChild.nodeId;
+
+            if (n.position == 0) (childPosition == 1 ? rootLeft : rootRight) = newChild;
+        }
+    }
+
+    if (pageNodes.size() == 1) {
+        if (!changed) {
+            ParsedNode node(this, txn, nodeId);
+            if (!node.inPage && !node.inChain) return BuiltNode::reuse(node);
+        }
+
+        return BuiltNode::newBranch(this, txn, rootLeft, rootRight);
+    }
+
+    // Already packed
+
+    if (!changed) {
+        ParsedNode node(this, txn, nodeId);
+        if (node.inPage && node.chainOffset == 0 && node.raw == BuiltNode::encodePage(levels, pageNodes)) return BuiltNode::reuse(node);
+    }
+
+    return BuiltNode::newPage(this, txn, levels, pageNodes);
+}
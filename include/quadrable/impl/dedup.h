@@ -0,0 +1,109 @@
+public:
+
+// Collapses identical sub-trees across all heads (and the current detached head, if any) so that they share
+// nodes, and indexes every node so that later writes re-use them. Requires dedupNodes. The duplicates that
+// are no longer referenced can then be removed with the GarbageCollector.
+
+void dedupHeads(lmdb::txn &txn) {
+    if (!dedupNodes) throw quaderr("dedupNodes not enabled");
+
+    std::unordered_map<uint64_t, BuiltNode> memo;
+    std::vector<std::pair<std::string, uint64_t>> heads;
+
+    {
+        std::string_view k, v;
+        auto cursor = lmdb::cursor::open(txn, dbi_head);
+        for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+            heads.emplace_back(std::string(k), lmdb::from_sv<uint64_t>(v));
+        }
+    }
+
+    for (auto &[headName, nodeId] : heads) {
+        auto newNode = dedupAux(txn, nodeId, memo, 0);
+        if (newNode.nodeId != nodeId) dbi_head.put(txn, headName, lmdb::to_sv<uint64_t>(newNode.nodeId));
+    }
+
+    if (detachedHead) detachedHeadNodeId = dedupAux(txn, detachedHeadNodeId, memo, 0).nodeId;
+}
+
+BuiltNode dedup(lmdb::txn &txn, uint64_t nodeId) {
+    if (!dedupNodes) throw quaderr("dedupNodes not enabled");
+
+    std::unordered_map<uint64_t, BuiltNode> memo;
+    return dedupAux(txn, nodeId, memo, 0);
+}
+
+
+private:
+
+BuiltNode dedupAux(lmdb::txn &txn, uint64_t nodeId, std::unordered_map<uint64_t, BuiltNode> &memo, uint64_t depth) {
+    auto it = memo.find(nodeId);
+    if (it != memo.end()) return it->second;
+
+    BuiltNode output;
+    uint64_t leftNodeId, rightNodeId;
+
+    {
+        ParsedNode node(this, txn, nodeId);
+        output = BuiltNode::reuse(node);
+        leftNodeId = node.leftNodeId;
+        rightNodeId = node.rightNodeId;
+    }
+
+    if (nodeId >= firstMemStoreNodeId) return output;
+
+    if (output.isBranch()) {
+        assertDepth(depth);
+
+        auto leftNode = dedupAux(txn, leftNodeId, memo, depth + 1);
+        auto rightNode = dedupAux(txn, rightNodeId, memo, depth + 1);
+
+        if (leftNode.nodeId != leftNodeId || rightNode.nodeId != rightNodeId) {
+            output = BuiltNode::newBranch(this, txn, leftNode, rightNode);
+        } else {
+            output = dedupExisting(txn, output);
+        }
+    } else if (output.nodeType == NodeType::Leaf) {
+        output = dedupExisting(txn, output);
+    }
+
+    memo.emplace(nodeId, output);
+
+    return output;
+}
+
+// Returns an identical node from the index, or else adds this node to it
+
+BuiltNode dedupExisting(lmdb::txn &txn, const BuiltNode &b) {
+    if (b.nodeId & chainOffsetMask) return b; // levels of chains/pages and inlined leaves aren't records of their own
+
+    std::string nodeRaw;
+
+    {
+        std::string_view raw;
+        if (!getNode(txn, b.nodeId, raw)) throw quaderr("couldn't find nodeId ", b.nodeId);
+        nodeRaw = raw;
+    }
+
+    auto dedupKey = dedupIndexKey(b.nodeHash, nodeRaw, b.nodeId < firstInteriorNodeId);
+    uint64_t existingNodeId = lookupDedupIndex(txn, dedupKey, nodeRaw);
+
+    if (existingNodeId) return BuiltNode{ existingNodeId, b.nodeHash, b.nodeType };
+
+    dbi_dedup.put(txn, dedupKey, lmdb::to_sv<uint64_t>(b.nodeId));
+    return b;
+}
+
+void removeFromDedupIndex(lmdb::txn &txn, uint64_t nodeId) {
+    std::string dedupKey;
+
+    {
+        ParsedNode node(this, txn, nodeId);
+        dedupKey = dedupIndexKey(Key::existing(node.nodeHash()), node.raw, nodeId < firstInteriorNodeId);
+    }
+
+    std::string_view indexedNodeIdRaw;
+    if (dbi_dedup.get(txn, dedupKey, indexedNodeIdRaw) && lmdb::from_sv<uint64_t>(indexedNodeIdRaw) == nodeId) {
+        dbi_dedup.del(txn, dedupKey);
+    }
+}
@@ -46,19 +46,19 @@ void diffWalk(lmdb::txn &txn, uint64_t nodeId, std::function<void(ParsedNode &)>
     });
 }
 
-void diffAux(lmdb::txn &txn, uint64_t nodeIdA, uint64_t nodeIdB, std::vector<Diff> &output) {
+void diffAux(lmdb::txn &txn, uint64_t nodeIdA, uint64_t nodeIdB, std::vector<Diff> &output, const ParsedNode *parentA = nullptr, const ParsedNode *parentB = nullptr) {
     if (nodeIdA == nodeIdB) return;
 
-    ParsedNode nodeA(this, txn, nodeIdA);
-    ParsedNode nodeB(this, txn, nodeIdB);
+    ParsedNode nodeA(this, txn, nodeIdA, parentA);
+    ParsedNode nodeB(this, txn, nodeIdB, parentB);
 
     if (nodeA.nodeHash() == nodeB.nodeHash()) return;
 
     if (nodeA.isWitnessAny() || nodeB.isWitnessAny()) throw quaderr("encountered witness during diff");
 
     if (nodeA.isBranch() && nodeB.isBranch()) {
-        diffAux(txn, nodeA.leftNodeId, nodeB.leftNodeId, output);
-        diffAux(txn, nodeA.rightNodeId, nodeB.rightNodeId, output);
+        diffAux(txn, nodeA.leftNodeId, nodeB.leftNodeId, output, &nodeA, &nodeB);
+        diffAux(txn, nodeA.rightNodeId, nodeB.rightNodeId, output, &nodeA, &nodeB);
     } else if (!nodeA.isBranch() && nodeB.isBranch()) {
         // All keys in B were added (except maybe if A is a leaf)
         bool foundLeaf = false;
@@ -81,8 +81,8 @@ void diffAux(lmdb::txn &txn, uint64_t nodeIdA, uint64_t nodeIdB, std::vector<Dif
             if (nodeB.isLeaf() && node.leafKeyHash() == nodeB.leafKeyHash()) {
                 foundLeaf = true;
                 if (node.leafVal() != nodeB.leafVal()) {
-                    diffPushDel(txn, nodeB, output);
-                    diffPushAdd(txn, node, output);
+                    diffPushDel(txn, node, output);
+                    diffPushAdd(txn, nodeB, output);
                 }
             } else {
                 diffPushDel(txn, node, output);
@@ -25,10 +25,31 @@ class GarbageCollector {
         }
     }
 
+    void markAllSyncSessions(lmdb::txn &txn) {
+        std::string_view k, v;
+        auto cursor = lmdb::cursor::open(txn, db.dbi_syncSession);
+        for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+            markTree(txn, decodeVarInt(v)); // nodeIdLocal
+            markTree(txn, decodeVarInt(v)); // nodeIdShadow
+        }
+    }
+
+    // Retained versions share most of their nodes with each other and with the heads, and markTree() stops
+    // at nodes already marked, so this only walks the nodes unique to each version
+
+    void markAllHeadHistory(lmdb::txn &txn) {
+        std::string_view k, v;
+        auto cursor = lmdb::cursor::open(txn, db.dbi_headHistory);
+        for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+            markTree(txn, decodeVarInt(v));
+        }
+    }
+
     void markTree(lmdb::txn &txn, uint64_t rootNodeId) {
         db.walkTree(txn, rootNodeId, [&](Quadrable::ParsedNode &node, uint64_t){
             if (markedNodes.find(node.nodeId) != markedNodes.end()) return false;
             markedNodes.insert(node.nodeId);
+            if (node.chainOffset) markedNodes.insert(node.nodeId & ~chainOffsetMask); // the chain/inline branch record itself
             return true;
         });
     }
@@ -36,33 +57,30 @@ class GarbageCollector {
     GCStats sweep(lmdb::txn &txn, std::optional<std::function<bool(uint64_t)>> cb = std::nullopt) {
         GCStats stats;
 
-        std::string_view k, v;
-
-        auto doSweep = [&](lmdb::dbi dbi){
-            auto cursor = lmdb::cursor::open(txn, dbi);
-            for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
-                stats.total++;
-                uint64_t nodeId = lmdb::from_sv<uint64_t>(k);
-                if (markedNodes.find(nodeId) == markedNodes.end() && (!cb || (*cb)(nodeId))) {
-                    garbageNodes.insert(nodeId);
-                    stats.garbage++;
-                }
+        db.nodeStore->forEach(txn, [&](uint64_t nodeId){
+            stats.total++;
+            if (markedNodes.find(nodeId) == markedNodes.end() && (!cb || (*cb)(nodeId))) {
+                garbageNodes.insert(nodeId);
+                stats.garbage++;
             }
-        };
-
-        doSweep(db.dbi_nodesInterior);
-        doSweep(db.dbi_nodesLeaf);
+        });
 
         return stats;
     }
 
     void deleteNodes(lmdb::txn &txn) {
         for (auto nodeId : garbageNodes) {
+            if (db.dedupNodes) db.removeFromDedupIndex(txn, nodeId);
+
+            db.nodeStore->del(txn, nodeId);
+
             if (nodeId < firstInteriorNodeId) {
-                db.dbi_nodesLeaf.del(txn, lmdb::to_sv<uint64_t>(nodeId));
                 if (db.trackKeys) db.dbi_key.del(txn, lmdb::to_sv<uint64_t>(nodeId));
             } else {
-                db.dbi_nodesInterior.del(txn, lmdb::to_sv<uint64_t>(nodeId));
+                if (db.trackKeys) {
+                    db.dbi_key.del(txn, lmdb::to_sv<uint64_t>(nodeId | inlineLeftOffset));
+                    db.dbi_key.del(txn, lmdb::to_sv<uint64_t>(nodeId | inlineRightOffset));
+                }
             }
         }
     }
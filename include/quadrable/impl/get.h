@@ -49,6 +49,10 @@ GetMultiQuery get(lmdb::txn &txn, std::set<std::string> keys) {
 }
 
 void getMultiRaw(lmdb::txn &txn, GetMultiQuery &queryMap) {
+    getMultiRaw(txn, getHeadNodeId(txn), queryMap);
+}
+
+void getMultiRaw(lmdb::txn &txn, uint64_t nodeId, GetMultiQuery &queryMap) {
     GetMultiInternalMap map;
 
     for (auto &[key, res] : queryMap) {
@@ -56,12 +60,15 @@ void getMultiRaw(lmdb::txn &txn, GetMultiQuery &queryMap) {
     }
 
     uint64_t depth = 0;
-    auto nodeId = getHeadNodeId(txn);
 
     getMultiAux(txn, depth, nodeId, map.begin(), map.end());
 }
 
 void getMulti(lmdb::txn &txn, GetMultiQuery &queryMap) {
+    getMulti(txn, getHeadNodeId(txn), queryMap);
+}
+
+void getMulti(lmdb::txn &txn, uint64_t nodeId, GetMultiQuery &queryMap) {
     GetMultiInternalMap map;
 
     for (auto &[key, res] : queryMap) {
@@ -69,7 +76,6 @@ void getMulti(lmdb::txn &txn, GetMultiQuery &queryMap) {
     }
 
     uint64_t depth = 0;
-    auto nodeId = getHeadNodeId(txn);
 
     getMultiAux(txn, depth, nodeId, map.begin(), map.end());
 }
@@ -77,12 +83,12 @@ void getMulti(lmdb::txn &txn, GetMultiQuery &queryMap) {
 
 private:
 
-void getMultiAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, GetMultiInternalMap::iterator begin, GetMultiInternalMap::iterator end) {
+void getMultiAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, GetMultiInternalMap::iterator begin, GetMultiInternalMap::iterator end, const ParsedNode *parent = nullptr) {
     if (begin == end) {
         return;
     }
 
-    ParsedNode node(this, txn, nodeId);
+    ParsedNode node(this, txn, nodeId, parent);
 
     if (node.isEmpty()) {
         for (auto i = begin; i != end; ++i) {
@@ -100,13 +106,12 @@ void getMultiAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, GetMultiIntern
             }
         }
     } else if (node.isBranch()) {
-        auto middle = begin;
-        while (middle != end && !middle->first.getBit(depth)) ++middle;
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.first; });
 
         assertDepth(depth);
 
-        getMultiAux(txn, depth+1, node.leftNodeId, begin, middle);
-        getMultiAux(txn, depth+1, node.rightNodeId, middle, end);
+        getMultiAux(txn, depth+1, node.leftNodeId, begin, middle, &node);
+        getMultiAux(txn, depth+1, node.rightNodeId, middle, end, &node);
     } else if (node.isWitnessAny()) {
         throw quaderr("encountered witness node: incomplete tree");
     } else {
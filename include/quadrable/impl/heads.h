@@ -69,6 +69,7 @@ void setHeadNodeId(lmdb::txn &txn, uint64_t nodeId) {
     } else {
         if (nodeId >= firstMemStoreNodeId) throw quaderr("attempted to store MemStore node into LMDB");
         dbi_head.put(txn, head, lmdb::to_sv<uint64_t>(nodeId));
+        if (keepHeadHistory) recordHeadVersion(txn, nodeId);
     }
 }
 
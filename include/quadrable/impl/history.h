@@ -0,0 +1,170 @@
+public:
+
+// Head history: When keepHeadHistory is set, every change to a (non-detached) head's nodeId is appended to
+// dbi_headHistory as a new version, numbered from 1 per head. Because of copy-on-write, a version is just the
+// root nodeId of an immutable tree, so checking one out is a single lookup, and retaining many versions only
+// costs the nodes that differ between them.
+//
+// Retained versions are protected from the GarbageCollector by markAllHeadHistory(). Versions are removed,
+// oldest first, by pruneHeadHistory().
+
+struct HeadVersion {
+    uint64_t version = 0;
+    uint64_t nodeId = 0;
+    uint64_t timestamp = 0; // seconds since the epoch when this version was recorded
+};
+
+// A version is retained if it is one of the keepLast most recent versions of its head, or if it was still
+// the head's current version at some point in the last keepSeconds. The most recent version is always retained.
+
+struct RetentionPolicy {
+    uint64_t keepLast = 0;
+    uint64_t keepSeconds = 0;
+};
+
+std::vector<HeadVersion> getHeadHistory(lmdb::txn &txn, std::string_view headName) {
+    std::vector<HeadVersion> output;
+
+    std::string prefix = headHistoryPrefix(headName);
+    std::string_view k = prefix, v;
+    auto cursor = lmdb::cursor::open(txn, dbi_headHistory);
+
+    for (bool found = cursor.get(k, v, MDB_SET_RANGE); found && hasPrefix(k, prefix); found = cursor.get(k, v, MDB_NEXT)) {
+        output.emplace_back(decodeHeadVersion(k, v));
+    }
+
+    return output;
+}
+
+std::optional<HeadVersion> getHeadVersion(lmdb::txn &txn, std::string_view headName, uint64_t version) {
+    std::string_view v;
+    std::string k = headHistoryKey(headName, version);
+    if (!dbi_headHistory.get(txn, k, v)) return std::nullopt;
+    return decodeHeadVersion(k, v);
+}
+
+// 0 if the head has no history
+
+uint64_t getLatestHeadVersion(lmdb::txn &txn, std::string_view headName) {
+    auto latest = getLatestHeadVersionAux(txn, headHistoryPrefix(headName));
+    return latest ? latest->version : 0;
+}
+
+// Checks out a retained version as a detached head
+
+void checkoutVersion(lmdb::txn &txn, std::string_view headName, uint64_t version) {
+    auto hv = getHeadVersion(txn, headName, version);
+    if (!hv) throw quaderr("version ", version, " of head '", headName, "' not found");
+    checkout(hv->nodeId);
+}
+
+// Applies the policy to all heads. Returns the number of versions removed. Run the GarbageCollector
+// afterwards to free nodes no longer reachable from any head or retained version.
+
+uint64_t pruneHeadHistory(lmdb::txn &txn, const RetentionPolicy &policy, uint64_t now = 0) {
+    if (now == 0) now = currentTimestamp();
+    uint64_t cutoff = policy.keepSeconds > now ? 0 : now - policy.keepSeconds;
+
+    uint64_t keepLast = std::max(policy.keepLast, uint64_t(1));
+
+    std::vector<std::string> toDelete;
+    std::string_view k, v;
+    auto cursor = lmdb::cursor::open(txn, dbi_headHistory);
+    bool found = cursor.get(k, v, MDB_FIRST);
+
+    while (found) {
+        std::string prefix(k.substr(0, k.size() - 8));
+        uint64_t latest = getLatestHeadVersionAux(txn, prefix)->version;
+        uint64_t firstKept = latest > keepLast ? latest - keepLast + 1 : 1;
+
+        // Versions are ordered oldest first and retention is monotonic, so stop at the first retained version.
+        // A version stopped being current when the next one was recorded.
+
+        std::optional<std::string> candidate;
+
+        for (; found && hasPrefix(k, prefix); found = cursor.get(k, v, MDB_NEXT)) {
+            auto hv = decodeHeadVersion(k, v);
+
+            if (candidate) {
+                if (policy.keepSeconds && hv.timestamp >= cutoff) break;
+                toDelete.emplace_back(std::move(*candidate));
+            }
+
+            if (hv.version >= firstKept) break;
+            candidate = std::string(k);
+        }
+
+        // Skip to the next head
+
+        std::string seek = prefix + std::string(8, '\xFF');
+        k = seek;
+        found = cursor.get(k, v, MDB_SET_RANGE);
+    }
+
+    for (auto &key : toDelete) dbi_headHistory.del(txn, key);
+
+    return toDelete.size();
+}
+
+void deleteHeadHistory(lmdb::txn &txn, std::string_view headName) {
+    std::vector<std::string> toDelete;
+
+    for (auto &hv : getHeadHistory(txn, headName)) toDelete.emplace_back(headHistoryKey(headName, hv.version));
+    for (auto &key : toDelete) dbi_headHistory.del(txn, key);
+}
+
+
+private:
+
+void recordHeadVersion(lmdb::txn &txn, uint64_t nodeId) {
+    std::string prefix = headHistoryPrefix(head);
+    auto latest = getLatestHeadVersionAux(txn, prefix);
+    if (latest && latest->nodeId == nodeId) return;
+
+    std::string v;
+    v += encodeVarInt(nodeId);
+    v += encodeVarInt(currentTimestamp());
+
+    dbi_headHistory.put(txn, headHistoryKey(head, latest ? latest->version + 1 : 1), v);
+}
+
+std::optional<HeadVersion> getLatestHeadVersionAux(lmdb::txn &txn, const std::string &prefix) {
+    std::string seek = prefix + std::string(8, '\xFF');
+    std::string_view k = seek, v;
+    auto cursor = lmdb::cursor::open(txn, dbi_headHistory);
+
+    bool found = cursor.get(k, v, MDB_SET_RANGE) ? cursor.get(k, v, MDB_PREV) : cursor.get(k, v, MDB_LAST);
+    if (!found || !hasPrefix(k, prefix)) return std::nullopt;
+
+    return decodeHeadVersion(k, v);
+}
+
+// Key: [varint: head length] [head] [8 bytes: big-endian version], so each head's versions are contiguous and in order
+
+static std::string headHistoryPrefix(std::string_view headName) {
+    return encodeVarInt(headName.size()) + std::string(headName);
+}
+
+static std::string headHistoryKey(std::string_view headName, uint64_t version) {
+    std::string o = headHistoryPrefix(headName);
+    for (int i = 7; i >= 0; i--) o += static_cast<char>((version >> (i * 8)) & 0xFF);
+    return o;
+}
+
+static HeadVersion decodeHeadVersion(std::string_view k, std::string_view v) {
+    HeadVersion output;
+
+    for (auto c : k.substr(k.size() - 8)) output.version = (output.version << 8) | static_cast<uint8_t>(c);
+    output.nodeId = decodeVarInt(v);
+    output.timestamp = decodeVarInt(v);
+
+    return output;
+}
+
+static bool hasPrefix(std::string_view k, std::string_view prefix) {
+    return k.size() >= prefix.size() && k.substr(0, prefix.size()) == prefix;
+}
+
+static uint64_t currentTimestamp() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
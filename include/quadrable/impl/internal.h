@@ -5,53 +5,82 @@ private:
 bool getNode(lmdb::txn &txn, uint64_t nodeId, std::string_view &output) {
     if (nodeId >= firstMemStoreNodeId) {
         if (!memStore) throw quaderr("tried to load MemStore node, but no MemStore attached");
-        auto it = memStore->nodes.find(nodeId);
-        if (it == memStore->nodes.end()) return false;
-        output = it->second;
-        return true;
-    } else if (nodeId >= firstInteriorNodeId) {
-        return dbi_nodesInterior.get(txn, lmdb::to_sv<uint64_t>(nodeId), output);
+        return memStore->get(nodeId, output);
+    } else if (snapshotRead) {
+        return nodeStore->get(txn, nodeId, output);
     } else {
-        return dbi_nodesLeaf.get(txn, lmdb::to_sv<uint64_t>(nodeId), output);
+        nodesRead++;
+        ApplyTimer t(applyStats, &ApplyStats::storeTimeNs);
+        return nodeStore->get(txn, nodeId, output);
     }
 }
 
-uint64_t writeNodeToDb(lmdb::txn &txn, std::string_view nodeRaw, bool isLeaf) {
+// If nodeHash is provided and dedupNodes is enabled, an existing identical record is re-used. Since interior
+// records contain their children's nodeIds, identical records always represent identical sub-trees.
+
+uint64_t writeNodeToDb(lmdb::txn &txn, std::string_view nodeRaw, bool isLeaf, const Key *nodeHash = nullptr) {
     assert(nodeRaw.size() >= 40);
 
+    std::string dedupKey;
+
+    if (nodeHash && dedupNodes && !writeToMemStore) {
+        dedupKey = dedupIndexKey(*nodeHash, nodeRaw, isLeaf);
+        uint64_t existingNodeId = lookupDedupIndex(txn, dedupKey, nodeRaw);
+        if (existingNodeId) return existingNodeId;
+    }
+
     uint64_t newNodeId;
+    ApplyTimer t(applyStats, &ApplyStats::storeTimeNs);
 
     if (writeToMemStore) {
         if (!memStore) throw quaderr("no MemStore configured");
 
-        auto it = memStore->nodes.rbegin();
-        if (it == memStore->nodes.rend()) newNodeId = firstMemStoreNodeId;
-        else newNodeId = it->first + 1;
-
-        memStore->nodes[newNodeId] = std::string(nodeRaw);
+        newNodeId = memStore->add(nodeRaw);
     } else {
-        newNodeId = getNextId(txn, isLeaf);
+        newNodeId = nodeStore->allocateId(txn, isLeaf);
+        nodeStore->put(txn, newNodeId, nodeRaw);
+        nodesWritten++;
+
+        assert(isLeaf || nodeRaw.size() == 48 || (nodeRaw[0] & 0x0F) == uint64_t(NodeType::Chain)
+                      || (nodeRaw[0] & 0x0F) == uint64_t(NodeType::InlineBranch) || (nodeRaw[0] & 0x0F) == uint64_t(NodeType::Page));
+    }
+
+    if (newNodeId & chainOffsetMask) throw quaderr("nodeId space exhausted");
 
-        auto dbi = isLeaf ? dbi_nodesLeaf : dbi_nodesInterior;
-        dbi.put(txn, lmdb::to_sv<uint64_t>(newNodeId), nodeRaw);
+    if (dedupKey.size()) dbi_dedup.put(txn, dedupKey, lmdb::to_sv<uint64_t>(newNodeId));
 
-        assert(isLeaf || nodeRaw.size() == 48);
+    if (applyStats) {
+        auto nodeType = NodeType(nodeRaw[0] & 0x0F);
+        if (nodeType == NodeType::Leaf || nodeType == NodeType::CompactLeaf) applyStats->leavesCreated++;
+        else if (nodeType == NodeType::BranchLeft || nodeType == NodeType::BranchRight || nodeType == NodeType::BranchBoth) applyStats->branchesCreated++;
+        else applyStats->otherCreated++;
+
+        applyStats->bytesWritten += nodeRaw.size();
+        applyCreated.insert(newNodeId);
     }
 
     return newNodeId;
 }
 
-uint64_t getNextId(lmdb::txn &txn, bool isLeaf) {
-    auto cursor = lmdb::cursor::open(txn, isLeaf ? dbi_nodesLeaf : dbi_nodesInterior);
-    std::string_view k, v;
+// Leaves are indexed by nodeHash, and interior nodes by a hash of their entire record (which includes the nodeHash
+// and the children's nodeIds). Chain and page records can be larger than LMDB's maximum key size, so the record itself
+// can't be used. lookupDedupIndex() compares the records, so a collision can't cause a wrong node to be re-used.
 
-    if (cursor.get(k, v, MDB_LAST)) {
-        return lmdb::from_sv<uint64_t>(k) + 1;
-    } else {
-        return isLeaf ? 1 : firstInteriorNodeId;
-    }
+std::string dedupIndexKey(const Key &nodeHash, std::string_view nodeRaw, bool isLeaf) {
+    return isLeaf ? nodeHash.str() : Key::hash(nodeRaw).str();
+}
+
+uint64_t lookupDedupIndex(lmdb::txn &txn, std::string_view dedupKey, std::string_view nodeRaw) {
+    std::string_view existingNodeIdRaw, existingRaw;
+    if (!dbi_dedup.get(txn, dedupKey, existingNodeIdRaw)) return 0;
+
+    // The index may be stale (GC'ed node), or refer to a leaf in a different format
+    uint64_t existingNodeId = lmdb::from_sv<uint64_t>(existingNodeIdRaw);
+    if (!getNode(txn, existingNodeId, existingRaw) || existingRaw != nodeRaw) return 0;
+
+    return existingNodeId;
 }
 
-void assertDepth(uint64_t depth) {
+static void assertDepth(uint64_t depth) {
     assert(depth <= 255); // should only happen on hash collision (or a bug)
 }
@@ -1,37 +1,151 @@
 private:
 
-struct ProofGenItem {
-    uint64_t nodeId;
-    uint64_t parentNodeId;
-    ProofStrand strand;
+using ProofHashes = std::map<Key, std::string>; // keyHash -> key
+
+
+// Assembles a proof while its tree is being traversed, so that no second pass over the nodes is needed to create
+// the cmds. The strands of a sub-tree form a ProofSpan: a linked list whose head is the strand that the sub-tree's
+// cmds are applied to. When a branch is finished on the way back up, its children's spans are joined with a Merge,
+// or the one span is hashed with the sibling's hash, which was loaded on the way down. Since spans are linked
+// rather than stored in order, strands and cmds can be added in any order.
+//
+// finish() numbers the strands from left to right, and orders the cmds: Each strand's cmds are grouped together
+// before the Merge that consumes it, and groups are ordered by the depth of that Merge (deepest first), then left
+// to right. Complexity: O(N + D)
+
+struct ProofSpan {
+    ssize_t head = -1;
+    ssize_t tail = -1;
+
+    bool empty() const { return head == -1; }
 };
 
-using ProofGenItems = std::vector<ProofGenItem>;
-using ProofHashes = std::map<Key, std::string>; // keyHash -> key
-using ProofReverseNodeMap = std::map<uint64_t, uint64_t>; // child -> parent
+struct ProofBuilder {
+    std::vector<ProofStrand> strands;
+    std::vector<ssize_t> next;
+    std::vector<uint64_t> mergeDepth; // depth at which the strand was merged into its left neighbour (0 if not merged)
+    std::vector<std::vector<ProofCmd>> cmds;
+
+    ProofSpan add(ProofStrand &&strand) {
+        ssize_t i = static_cast<ssize_t>(strands.size());
+
+        strands.emplace_back(std::move(strand));
+        next.push_back(-1);
+        mergeDepth.push_back(0);
+        cmds.emplace_back();
+
+        return ProofSpan{ i, i };
+    }
+
+    // Joins the spans of the children of a branch at depth. If one side has no strands, the strand from the
+    // other side is hashed with that side's node (provided, or empty).
+
+    ProofSpan join(uint64_t depth, ProofSpan left, ProofSpan right, const ParsedNode &leftNode, const ParsedNode &rightNode) {
+        return join(depth, left, right, leftNode.isEmpty() ? "" : leftNode.nodeHash(), rightNode.isEmpty() ? "" : rightNode.nodeHash());
+    }
+
+    // An empty hash means the node is empty
+
+    ProofSpan join(uint64_t depth, ProofSpan left, ProofSpan right, std::string_view leftHash, std::string_view rightHash) {
+        if (left.empty() && right.empty()) return left;
+
+        if (left.empty()) {
+            addSibling(right, leftHash);
+            return right;
+        }
+
+        if (right.empty()) {
+            addSibling(left, rightHash);
+            return left;
+        }
+
+        cmds[left.head].emplace_back(ProofCmd{ ProofCmd::Op::Merge, static_cast<uint64_t>(left.head), });
+        mergeDepth[right.head] = depth + 1;
+        next[left.tail] = right.head;
+
+        return ProofSpan{ left.head, right.tail };
+    }
+
+    Proof finish(ProofSpan span) {
+        Proof output;
+
+        if (span.empty()) return output;
+
+        std::vector<uint64_t> offsets(strands.size());
+        std::vector<std::vector<ssize_t>> merged; // by depth, left to right
+
+        for (ssize_t i = span.head; i != -1; i = next[i]) {
+            offsets[i] = output.strands.size();
+            output.strands.emplace_back(std::move(strands[i]));
+
+            if (mergeDepth[i] == 0) continue;
+            if (mergeDepth[i] >= merged.size()) merged.resize(mergeDepth[i] + 1);
+            merged[mergeDepth[i]].push_back(i);
+        }
+
+        auto emit = [&](ssize_t i){
+            for (auto &cmd : cmds[i]) {
+                cmd.nodeOffset = offsets[cmd.nodeOffset];
+                output.cmds.emplace_back(std::move(cmd));
+            }
+        };
+
+        for (size_t depth = merged.size(); depth-- > 0; ) {
+            for (auto i : merged[depth]) emit(i);
+        }
+
+        emit(span.head);
+
+        return output;
+    }
+
+  private:
+    void addSibling(ProofSpan span, std::string_view siblingHash) {
+        if (siblingHash.empty()) {
+            cmds[span.head].emplace_back(ProofCmd{ ProofCmd::Op::HashEmpty, static_cast<uint64_t>(span.head), });
+        } else {
+            cmds[span.head].emplace_back(ProofCmd{ ProofCmd::Op::HashProvided, static_cast<uint64_t>(span.head), std::string(siblingHash), });
+        }
+    }
+};
 
 public:
 
 // Export interface
 
-Proof exportProof(lmdb::txn &txn, const std::vector<std::string> &keys) {
+// If deletable is set, enough extra information is included so that any of the keys can be deleted from the
+// partial tree created by importing the proof (see "Deletion-capable proofs" in the README)
+
+Proof exportProof(lmdb::txn &txn, const std::vector<std::string> &keys, bool deletable = false) {
+    auto headNodeId = getHeadNodeId(txn);
+
+    return exportProof(txn, headNodeId, keys, deletable);
+}
+
+Proof exportProof(lmdb::txn &txn, uint64_t nodeId, const std::vector<std::string> &keys, bool deletable = false) {
     ProofHashes keyHashes;
 
     for (auto &key : keys) {
         keyHashes.emplace(Key::hash(key), key);
     }
 
-    return exportProofAux(txn, keyHashes);
+    return exportProofAux(txn, nodeId, keyHashes, deletable);
+}
+
+Proof exportProofRaw(lmdb::txn &txn, const std::vector<Key> &keys, bool deletable = false) {
+    auto headNodeId = getHeadNodeId(txn);
+
+    return exportProofRaw(txn, headNodeId, keys, deletable);
 }
 
-Proof exportProofRaw(lmdb::txn &txn, const std::vector<Key> &keys) {
+Proof exportProofRaw(lmdb::txn &txn, uint64_t nodeId, const std::vector<Key> &keys, bool deletable = false) {
     ProofHashes keyHashes;
 
     for (auto &key : keys) {
         keyHashes.emplace(key, "");
     }
 
-    return exportProofAux(txn, keyHashes);
+    return exportProofAux(txn, nodeId, keyHashes, deletable);
 }
 
 Proof exportProofRange(lmdb::txn &txn, const Key &begin, const Key &end) {
@@ -41,23 +155,15 @@ Proof exportProofRange(lmdb::txn &txn, const Key &begin, const Key &end) {
 }
 
 Proof exportProofRange(lmdb::txn &txn, uint64_t nodeId, const Key &begin, const Key &end) {
-    ProofGenItems items;
-    ProofReverseNodeMap reverseMap;
+    ProofBuilder builder;
     Key currPath = Key::null();
     uint64_t depthLimit = std::numeric_limits<uint64_t>::max();
     bool expandLeaves = true;
 
-    exportProofRangeAux(txn, 0, nodeId, 0, depthLimit, expandLeaves, currPath, begin, end, items, reverseMap);
-
-    Proof output;
-
-    output.cmds = exportProofCmds(txn, items, reverseMap, nodeId);
-
-    for (auto &item : items) {
-        output.strands.emplace_back(std::move(item.strand));
-    }
+    ParsedNode node(this, txn, nodeId);
+    auto span = exportProofRangeAux(txn, 0, node, depthLimit, expandLeaves, currPath, begin, end, builder);
 
-    return output;
+    return builder.finish(span);
 }
 
 
@@ -94,41 +200,32 @@ BuiltNode mergeProof(lmdb::txn &txn, Proof &proof) {
 private:
 
 
-Proof exportProofAux(lmdb::txn &txn, ProofHashes &keyHashes) {
-    auto headNodeId = getHeadNodeId(txn);
+Proof exportProofAux(lmdb::txn &txn, uint64_t nodeId, ProofHashes &keyHashes, bool deletable) {
+    if (keyHashes.empty()) return Proof{};
 
-    ProofGenItems items;
-    ProofReverseNodeMap reverseMap;
+    ProofBuilder builder;
+    bool emptyable;
 
-    exportProofAux(txn, 0, headNodeId, 0, keyHashes.begin(), keyHashes.end(), items, reverseMap);
-
-    Proof output;
+    ParsedNode node(this, txn, nodeId);
+    auto span = exportProofAux(txn, 0, node, keyHashes.begin(), keyHashes.end(), builder, deletable, emptyable);
 
-    output.cmds = exportProofCmds(txn, items, reverseMap, headNodeId);
+    return builder.finish(span);
+}
 
-    for (auto &item : items) {
-        output.strands.emplace_back(std::move(item.strand));
-    }
+// emptyable is set if every leaf in the sub-tree is being proved, meaning the sub-tree could become empty if they were all deleted
 
-    return output;
-}
+ProofSpan exportProofAux(lmdb::txn &txn, uint64_t depth, const ParsedNode &node, ProofHashes::iterator begin, ProofHashes::iterator end, ProofBuilder &builder, bool deletable, bool &emptyable) {
+    emptyable = node.isEmpty();
 
-void exportProofAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t parentNodeId, ProofHashes::iterator begin, ProofHashes::iterator end, ProofGenItems &items, ProofReverseNodeMap &reverseMap) {
     if (begin == end) {
-        return;
+        return ProofSpan{};
     }
 
-    ParsedNode node(this, txn, nodeId);
-
     if (node.isEmpty()) {
         Key h = begin->first;
         h.keepPrefixBits(depth);
 
-        items.emplace_back(ProofGenItem{
-            nodeId,
-            parentNodeId,
-            ProofStrand{ ProofStrand::Type::WitnessEmpty, depth, h.str(), },
-        });
+        return builder.add(ProofStrand{ ProofStrand::Type::WitnessEmpty, depth, h.str(), });
     } else if (node.isLeaf()) {
         if (std::any_of(begin, end, [&](auto &i){ return i.first == node.leafKeyHash(); })) {
             if (node.nodeType == NodeType::WitnessLeaf) {
@@ -138,32 +235,45 @@ void exportProofAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t pa
             std::string_view leafKey;
             getLeafKey(txn, node.nodeId, leafKey);
 
-            items.emplace_back(ProofGenItem{
-                nodeId,
-                parentNodeId,
-                ProofStrand{ ProofStrand::Type::Leaf, depth, std::string(node.leafKeyHash()), std::string(node.leafVal()), std::string(leafKey) },
-            });
+            emptyable = true;
+
+            return builder.add(ProofStrand{ ProofStrand::Type::Leaf, depth, std::string(node.leafKeyHash()), std::string(node.leafVal()), std::string(leafKey) });
         } else {
-            items.emplace_back(ProofGenItem{
-                nodeId,
-                parentNodeId,
-                ProofStrand{ ProofStrand::Type::WitnessLeaf, depth, std::string(node.leafKeyHash()), node.leafValHash(), },
-            });
+            return builder.add(ProofStrand{ ProofStrand::Type::WitnessLeaf, depth, std::string(node.leafKeyHash()), node.leafValHash(), });
         }
     } else if (node.isBranch()) {
-        auto middle = begin;
-        while (middle != end && !middle->first.getBit(depth)) ++middle;
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.first; });
 
         assertDepth(depth);
 
-        if (node.leftNodeId) reverseMap.emplace(node.leftNodeId, nodeId);
-        if (node.rightNodeId) reverseMap.emplace(node.rightNodeId, nodeId);
+        // Both children are needed: either to descend into, or to provide the sibling's hash
+
+        ParsedNode leftNode(this, txn, node.leftNodeId, &node);
+        ParsedNode rightNode(this, txn, node.rightNodeId, &node);
 
         // If one side is empty and the other side has strands to prove, don't go down the empty side.
         // This avoids unnecessary empty witnesses, since they will be satisfied with HashEmpty cmds from the other side.
 
-        if (node.leftNodeId || middle == end) exportProofAux(txn, depth+1, node.leftNodeId, nodeId, begin, middle, items, reverseMap);
-        if (node.rightNodeId || begin == middle) exportProofAux(txn, depth+1, node.rightNodeId, nodeId, middle, end, items, reverseMap);
+        bool leftEmptyable = true, rightEmptyable = true;
+        ProofSpan leftSpan, rightSpan;
+
+        if (node.leftNodeId || middle == end) leftSpan = exportProofAux(txn, depth+1, leftNode, begin, middle, builder, deletable, leftEmptyable);
+        if (node.rightNodeId || begin == middle) rightSpan = exportProofAux(txn, depth+1, rightNode, middle, end, builder, deletable, rightEmptyable);
+
+        // If deleting the proved keys could empty one side, then the other side would need to bubble up if it's a
+        // leaf, which a witness can't do. So instead of its hash, provide strands that reveal whether it's a leaf.
+
+        if (deletable) {
+            if (begin == middle && node.leftNodeId && rightEmptyable) {
+                leftSpan = exportProofSibling(txn, depth+1, leftNode, begin->first, false, builder);
+            } else if (middle == end && node.rightNodeId && leftEmptyable) {
+                rightSpan = exportProofSibling(txn, depth+1, rightNode, begin->first, true, builder);
+            }
+        }
+
+        emptyable = leftEmptyable && rightEmptyable;
+
+        return builder.join(depth, leftSpan, rightSpan, leftNode, rightNode);
     } else if (node.nodeType == NodeType::Witness) {
         throw quaderr("encountered witness node: incomplete tree");
     } else {
@@ -173,17 +283,57 @@ void exportProofAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t pa
 
 
 
-void exportProofRangeAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t parentNodeId, uint64_t depthLimit, bool expandLeaves, Key &currPath, const Key &begin, const Key &end, ProofGenItems &items, ProofReverseNodeMap &reverseMap) {
-    ParsedNode node(this, txn, nodeId);
+// A leaf sibling becomes a WitnessLeaf. A branch sibling is expanded by one level, so that importing creates a
+// branch node: Its children become Witnesses or WitnessLeafs (an empty child is provided by HashEmpty).
+
+ProofSpan exportProofSibling(lmdb::txn &txn, uint64_t depth, const ParsedNode &node, const Key &keyHash, bool rightSide, ProofBuilder &builder) {
+    Key path = keyHash;
+    path.keepPrefixBits(depth);
+    path.setBit(depth - 1, rightSide);
+
+    auto addWitness = [&](const ParsedNode &n, uint64_t d, const Key &p){
+        if (n.isLeaf()) {
+            return builder.add(ProofStrand{ ProofStrand::Type::WitnessLeaf, d, std::string(n.leafKeyHash()), n.leafValHash(), });
+        } else if (n.isBranch() || n.isWitness()) {
+            return builder.add(ProofStrand{ ProofStrand::Type::Witness, d, p.str(), std::string(n.nodeHash()), });
+        } else {
+            throw quaderr("unrecognized nodeType: ", int(n.nodeType));
+        }
+    };
+
+    if (node.isWitness()) {
+        throw quaderr("encountered witness node: incomplete tree");
+    } else if (node.isLeaf()) {
+        return addWitness(node, depth, path);
+    } else if (node.isBranch()) {
+        assertDepth(depth);
+
+        ParsedNode leftNode(this, txn, node.leftNodeId, &node);
+        ParsedNode rightNode(this, txn, node.rightNodeId, &node);
+
+        ProofSpan leftSpan, rightSpan;
+
+        if (!leftNode.isEmpty()) leftSpan = addWitness(leftNode, depth + 1, path);
+
+        if (!rightNode.isEmpty()) {
+            Key rightPath = path;
+            rightPath.setBit(depth, 1);
+            rightSpan = addWitness(rightNode, depth + 1, rightPath);
+        }
 
+        return builder.join(depth, leftSpan, rightSpan, leftNode, rightNode);
+    } else {
+        throw quaderr("unrecognized nodeType: ", int(node.nodeType));
+    }
+}
+
+
+
+ProofSpan exportProofRangeAux(lmdb::txn &txn, uint64_t depth, const ParsedNode &node, uint64_t depthLimit, bool expandLeaves, Key &currPath, const Key &begin, const Key &end, ProofBuilder &builder) {
     if (node.isEmpty()) {
         Key h = currPath;
 
-        items.emplace_back(ProofGenItem{
-            nodeId,
-            parentNodeId,
-            ProofStrand{ ProofStrand::Type::WitnessEmpty, depth, h.str(), },
-        });
+        return builder.add(ProofStrand{ ProofStrand::Type::WitnessEmpty, depth, h.str(), });
     } else if (node.isLeaf()) {
         if (node.nodeType == NodeType::WitnessLeaf) {
             throw quaderr("incomplete tree, missing leaf to make proof");
@@ -193,47 +343,37 @@ void exportProofRangeAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64
         getLeafKey(txn, node.nodeId, leafKey);
 
         if (expandLeaves || node.leafVal().size() <= 32) {
-            items.emplace_back(ProofGenItem{
-                nodeId,
-                parentNodeId,
-                ProofStrand{ ProofStrand::Type::Leaf, depth, std::string(node.leafKeyHash()), std::string(node.leafVal()), std::string(leafKey) },
-            });
+            return builder.add(ProofStrand{ ProofStrand::Type::Leaf, depth, std::string(node.leafKeyHash()), std::string(node.leafVal()), std::string(leafKey) });
         } else {
-            items.emplace_back(ProofGenItem{
-                nodeId,
-                parentNodeId,
-                ProofStrand{ ProofStrand::Type::WitnessLeaf, depth, std::string(node.leafKeyHash()), node.leafValHash(), },
-            });
+            return builder.add(ProofStrand{ ProofStrand::Type::WitnessLeaf, depth, std::string(node.leafKeyHash()), node.leafValHash(), });
         }
     } else if (node.isBranch()) {
         assertDepth(depth);
 
-        if (node.leftNodeId) reverseMap.emplace(node.leftNodeId, nodeId);
-        if (node.rightNodeId) reverseMap.emplace(node.rightNodeId, nodeId);
-
         if (depthLimit == 0) {
-            items.emplace_back(ProofGenItem{
-                nodeId,
-                parentNodeId,
-                ProofStrand{ ProofStrand::Type::Witness, depth, currPath.str(), std::string(node.nodeHash()), },
-            });
-
-            return;
+            return builder.add(ProofStrand{ ProofStrand::Type::Witness, depth, currPath.str(), std::string(node.nodeHash()), });
         }
 
         if (node.nodeType == NodeType::BranchBoth) depthLimit--;
 
+        ParsedNode leftNode(this, txn, node.leftNodeId, &node);
+        ParsedNode rightNode(this, txn, node.rightNodeId, &node);
+
         currPath.setBit(depth, 1);
         bool doLeft = begin < currPath;
         bool doRight = end >= currPath;
 
+        ProofSpan leftSpan, rightSpan;
+
         currPath.setBit(depth, 0);
-        if (doLeft) exportProofRangeAux(txn, depth+1, node.leftNodeId, nodeId, depthLimit, expandLeaves, currPath, begin, end, items, reverseMap);
+        if (doLeft) leftSpan = exportProofRangeAux(txn, depth+1, leftNode, depthLimit, expandLeaves, currPath, begin, end, builder);
 
         currPath.setBit(depth, 1);
-        if (doRight) exportProofRangeAux(txn, depth+1, node.rightNodeId, nodeId, depthLimit, expandLeaves, currPath, begin, end, items, reverseMap);
+        if (doRight) rightSpan = exportProofRangeAux(txn, depth+1, rightNode, depthLimit, expandLeaves, currPath, begin, end, builder);
 
         currPath.setBit(depth, 0);
+
+        return builder.join(depth, leftSpan, rightSpan, leftNode, rightNode);
     } else if (node.nodeType == NodeType::Witness) {
         throw quaderr("encountered witness node: incomplete tree");
     } else {
@@ -243,126 +383,41 @@ void exportProofRangeAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64
 
 
 
-struct GenProofItemAccum {
-    size_t index;
-    uint64_t depth;
-    uint64_t nodeId;
-    ssize_t next;
-
-    uint64_t mergedOrder = 0;
-    std::vector <ProofCmd> proofCmds;
-};
-
-std::vector<ProofCmd> exportProofCmds(lmdb::txn &txn, ProofGenItems &items, ProofReverseNodeMap &reverseMap, uint64_t headNodeId, uint64_t startDepth = 0) {
-    if (items.size() == 0) return {};
-
-    std::vector<GenProofItemAccum> accums;
-    uint64_t maxDepth = 0;
-
-    for (size_t i = 0; i < items.size(); i++) {
-        auto &item = items[i];
-        maxDepth = std::max(maxDepth, item.strand.depth);
-        accums.emplace_back(GenProofItemAccum{ i, item.strand.depth, item.nodeId, static_cast<ssize_t>(i+1), });
-    }
-
-    accums.back().next = -1;
-    uint64_t currDepth = maxDepth;
-    uint64_t currMergeOrder = 0;
-
-    // Complexity: O(N*D) = O(N*log(N))
-
-    for (; currDepth > startDepth; currDepth--) {
-        for (ssize_t i = 0; i != -1; i = accums[i].next) {
-            auto &curr = accums[i];
-            if (curr.depth != currDepth) continue;
-
-            auto currParent = curr.nodeId ? reverseMap[curr.nodeId] : items[i].parentNodeId;
-
-            if (curr.next != -1) {
-                auto &next = accums[curr.next];
-
-                auto nextParent = next.nodeId ? reverseMap[next.nodeId] : items[curr.next].parentNodeId;
-
-                if (currParent == nextParent) {
-                    curr.proofCmds.emplace_back(ProofCmd{ ProofCmd::Op::Merge, static_cast<uint64_t>(i), });
-                    next.mergedOrder = currMergeOrder++;
-                    curr.next = next.next;
-                    curr.nodeId = currParent;
-                    curr.depth--;
-                    continue;
-                }
-            }
-
-            ParsedNode parentNode(this, txn, currParent);
-            uint64_t siblingNodeId = parentNode.leftNodeId == curr.nodeId ? parentNode.rightNodeId : parentNode.leftNodeId;
-
-            if (siblingNodeId) {
-                ParsedNode siblingNode(this, txn, siblingNodeId);
-                curr.proofCmds.emplace_back(ProofCmd{ ProofCmd::Op::HashProvided, static_cast<uint64_t>(i), std::string(siblingNode.nodeHash()), });
-            } else {
-                curr.proofCmds.emplace_back(ProofCmd{ ProofCmd::Op::HashEmpty, static_cast<uint64_t>(i), });
-            }
-
-            curr.nodeId = currParent;
-            curr.depth--;
-        }
-    }
-
-    assert(accums[0].depth == startDepth);
-    assert(accums[0].nodeId == headNodeId);
-    assert(accums[0].next == -1);
-    accums[0].mergedOrder = currMergeOrder;
-
-    std::sort(accums.begin(), accums.end(), [](auto &a, auto &b){ return a.mergedOrder < b.mergedOrder; });
-
-    std::vector<ProofCmd> proofCmds;
-    for (auto &a : accums) {
-        proofCmds.insert(proofCmds.end(), a.proofCmds.begin(), a.proofCmds.end());
-    }
-
-    return proofCmds;
-}
 
 
 
 
 
 
+// Validates a proof's strands and cmds, and builds the tree they describe. Shared by importProofInternal() and
+// ProofUpdater so that both accept the same proofs. The callbacks create nodes in the caller's tree: newStrand() is
+// called for each strand (and should return the empty node for WitnessEmpty strands), newWitness() for each
+// HashProvided cmd, and newBranch() for each cmd.
 
+template<typename Node, typename StrandCb, typename WitnessCb, typename BranchCb>
+static Node buildProofTree(const Proof &proof, uint64_t expectedDepth, const Node &emptyNode, StrandCb newStrand, WitnessCb newWitness, BranchCb newBranch) {
+    struct Accum {
+        uint64_t depth;
+        Node node;
+        ssize_t next;
+        Key keyHash;
 
+        bool merged = false;
+    };
 
-struct ImportProofItemAccum {
-    uint64_t depth;
-    uint64_t nodeId;
-    ssize_t next;
-    Key keyHash;
-    Key nodeHash;
-
-    bool merged = false;
-};
-
-BuiltNode importProofInternal(lmdb::txn &txn, Proof &proof, uint64_t expectedDepth = 0) {
-    std::vector<ImportProofItemAccum> accums;
+    std::vector<Accum> accums;
 
     for (size_t i = 0; i < proof.strands.size(); i++) {
         auto &strand = proof.strands[i];
         auto keyHash = Key::existing(strand.keyHash);
         auto next = static_cast<ssize_t>(i+1);
 
-        if (strand.strandType == ProofStrand::Type::Leaf) {
-            auto info = BuiltNode::newLeaf(this, txn, keyHash, strand.val, strand.key);
-            accums.emplace_back(ImportProofItemAccum{ strand.depth, info.nodeId, next, keyHash, info.nodeHash, });
-        } else if (strand.strandType == ProofStrand::Type::WitnessLeaf) {
-            auto info = BuiltNode::newWitnessLeaf(this, txn, keyHash, Key::existing(strand.val));
-            accums.emplace_back(ImportProofItemAccum{ strand.depth, info.nodeId, next, keyHash, info.nodeHash, });
-        } else if (strand.strandType == ProofStrand::Type::WitnessEmpty) {
-            accums.emplace_back(ImportProofItemAccum{ strand.depth, 0, next, keyHash, Key::null(), });
-        } else if (strand.strandType == ProofStrand::Type::Witness) {
-            auto info = BuiltNode::newWitness(this, txn, Key::existing(strand.val));
-            accums.emplace_back(ImportProofItemAccum{ strand.depth, info.nodeId, next, keyHash, info.nodeHash, });
-        } else {
+        if (strand.strandType != ProofStrand::Type::Leaf && strand.strandType != ProofStrand::Type::WitnessLeaf &&
+            strand.strandType != ProofStrand::Type::WitnessEmpty && strand.strandType != ProofStrand::Type::Witness) {
             throw quaderr("unrecognized ProofItem type: ", int(strand.strandType));
         }
+
+        accums.emplace_back(Accum{ strand.depth, newStrand(strand, keyHash), next, keyHash, });
     }
 
     if (accums.size() == 0) throw quaderr("empty proof");
@@ -377,12 +432,12 @@ BuiltNode importProofInternal(lmdb::txn &txn, Proof &proof, uint64_t expectedDep
         if (accum.merged) throw quaderr("strand already merged");
         if (accum.depth == 0) throw quaderr("node depth underflow");
 
-        BuiltNode siblingInfo;
+        Node sibling = emptyNode;
 
         if (cmd.op == ProofCmd::Op::HashProvided) {
-            siblingInfo = BuiltNode::newWitness(this, txn, Key::existing(cmd.hash));
+            sibling = newWitness(Key::existing(cmd.hash));
         } else if (cmd.op == ProofCmd::Op::HashEmpty) {
-            siblingInfo = BuiltNode::empty();
+            sibling = emptyNode;
         } else if (cmd.op == ProofCmd::Op::Merge) {
             if (accum.next < 0) throw quaderr("no nodes left to merge with");
             auto &accumNext = accums[accum.next];
@@ -392,28 +447,38 @@ BuiltNode importProofInternal(lmdb::txn &txn, Proof &proof, uint64_t expectedDep
             accum.next = accumNext.next;
             accumNext.merged = true;
 
-            siblingInfo = BuiltNode::stubbed(accumNext.nodeId, accumNext.nodeHash);
+            sibling = accumNext.node;
         } else {
             throw quaderr("unrecognized ProofCmd op: ", int(cmd.op));
         }
 
-        BuiltNode branchInfo;
-
         if (cmd.op == ProofCmd::Op::Merge || !accum.keyHash.getBit(accum.depth - 1)) {
-            branchInfo = BuiltNode::newBranch(this, txn, BuiltNode::stubbed(accum.nodeId, accum.nodeHash), BuiltNode::stubbed(siblingInfo.nodeId, siblingInfo.nodeHash));
+            accum.node = newBranch(accum.node, sibling);
         } else {
-            branchInfo = BuiltNode::newBranch(this, txn, BuiltNode::stubbed(siblingInfo.nodeId, siblingInfo.nodeHash), BuiltNode::stubbed(accum.nodeId, accum.nodeHash));
+            accum.node = newBranch(sibling, accum.node);
         }
 
         accum.depth--;
-        accum.nodeId = branchInfo.nodeId;
-        accum.nodeHash = branchInfo.nodeHash;
     }
 
     if (accums[0].next != -1) throw quaderr("not all proof strands were merged");
     if (accums[0].depth != expectedDepth) throw quaderr("proof didn't reach expected depth");
 
-    return BuiltNode::stubbed(accums[0].nodeId, accums[0].nodeHash);
+    return accums[0].node;
+}
+
+BuiltNode importProofInternal(lmdb::txn &txn, Proof &proof, uint64_t expectedDepth = 0) {
+    auto newStrand = [&](const ProofStrand &strand, const Key &keyHash){
+        if (strand.strandType == ProofStrand::Type::Leaf) return BuiltNode::newLeaf(this, txn, keyHash, strand.val, strand.key);
+        if (strand.strandType == ProofStrand::Type::WitnessLeaf) return BuiltNode::newWitnessLeaf(this, txn, keyHash, Key::existing(strand.val));
+        if (strand.strandType == ProofStrand::Type::Witness) return BuiltNode::newWitness(this, txn, Key::existing(strand.val));
+        return BuiltNode::empty();
+    };
+
+    auto newWitness = [&](const Key &hash){ return BuiltNode::newWitness(this, txn, hash); };
+    auto newBranch = [&](const BuiltNode &left, const BuiltNode &right){ return BuiltNode::newBranch(this, txn, left, right); };
+
+    return buildProofTree(proof, expectedDepth, BuiltNode::empty(), newStrand, newWitness, newBranch);
 }
 
 BuiltNode mergeProofInternal(lmdb::txn &txn, uint64_t origNodeId, uint64_t newNodeId) {
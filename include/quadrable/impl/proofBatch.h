@@ -0,0 +1,253 @@
+public:
+
+// Batch proof export: Exports one proof for each of several key sets, all against the same tree. The tree is
+// traversed once, for the union of the key sets, so the nodes that several proofs have in common (such as the
+// upper levels of the tree and their siblings' hashes) are loaded once instead of once per proof. Each output
+// proof is identical to what exportProof() would return for its key set.
+
+std::vector<Proof> exportProofBatch(lmdb::txn &txn, const std::vector<std::vector<std::string>> &keySets, bool deletable = false) {
+    auto headNodeId = getHeadNodeId(txn);
+
+    return exportProofBatch(txn, headNodeId, keySets, deletable);
+}
+
+std::vector<Proof> exportProofBatch(lmdb::txn &txn, uint64_t nodeId, const std::vector<std::vector<std::string>> &keySets, bool deletable = false) {
+    ProofBatchEntries entries;
+
+    for (uint64_t i = 0; i < keySets.size(); i++) {
+        for (auto &key : keySets[i]) {
+            entries.emplace_back(ProofBatchEntry{ Key::hash(key), i, });
+        }
+    }
+
+    return exportProofBatchAux(txn, nodeId, entries, keySets.size(), deletable);
+}
+
+std::vector<Proof> exportProofBatchRaw(lmdb::txn &txn, const std::vector<std::vector<Key>> &keySets, bool deletable = false) {
+    auto headNodeId = getHeadNodeId(txn);
+
+    return exportProofBatchRaw(txn, headNodeId, keySets, deletable);
+}
+
+std::vector<Proof> exportProofBatchRaw(lmdb::txn &txn, uint64_t nodeId, const std::vector<std::vector<Key>> &keySets, bool deletable = false) {
+    ProofBatchEntries entries;
+
+    for (uint64_t i = 0; i < keySets.size(); i++) {
+        for (auto &key : keySets[i]) {
+            entries.emplace_back(ProofBatchEntry{ key, i, });
+        }
+    }
+
+    return exportProofBatchAux(txn, nodeId, entries, keySets.size(), deletable);
+}
+
+
+private:
+
+struct ProofBatchEntry {
+    Key keyHash;
+    uint64_t request; // index of the key set
+};
+
+using ProofBatchEntries = std::vector<ProofBatchEntry>;
+
+// A request's strands within a sub-tree. emptyable is as returned by exportProofAux().
+
+struct ProofBatchResult {
+    uint64_t request;
+    ProofSpan span;
+    bool emptyable;
+};
+
+using ProofBatchResults = std::vector<ProofBatchResult>; // ordered by request
+
+std::vector<Proof> exportProofBatchAux(lmdb::txn &txn, uint64_t nodeId, ProofBatchEntries &entries, size_t numRequests, bool deletable) {
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b){
+        return a.keyHash < b.keyHash || (a.keyHash == b.keyHash && a.request < b.request);
+    });
+
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const auto &a, const auto &b){
+        return a.keyHash == b.keyHash && a.request == b.request;
+    }), entries.end());
+
+    std::vector<ProofBuilder> builders(numRequests);
+    ProofBatchResults results;
+
+    if (entries.size()) {
+        ParsedNode node(this, txn, nodeId);
+        results = exportProofBatchAux(txn, 0, node, entries.begin(), entries.end(), builders, deletable);
+    }
+
+    std::vector<Proof> output(numRequests);
+
+    for (auto &r : results) {
+        output[r.request] = builders[r.request].finish(r.span);
+    }
+
+    return output;
+}
+
+// The same traversal as exportProofAux(), except that each node is visited once for all of the requests that have keys
+// beneath it. Strands and cmds are added to each request's ProofBuilder by following the same rules, so that the
+// proofs come out identical.
+
+ProofBatchResults exportProofBatchAux(lmdb::txn &txn, uint64_t depth, const ParsedNode &node, ProofBatchEntries::iterator begin, ProofBatchEntries::iterator end, std::vector<ProofBuilder> &builders, bool deletable) {
+    ProofBatchResults output;
+
+    if (node.isEmpty()) {
+        output = proofBatchEmpty(depth, begin, end, end, end, builders);
+    } else if (node.isLeaf()) {
+        Key leafKeyHash = node.key();
+        std::vector<uint64_t> proved;
+
+        for (auto it = begin; it != end; ++it) {
+            if (it->keyHash == leafKeyHash) proved.push_back(it->request); // contiguous and ordered by request
+        }
+
+        if (proved.size() && node.nodeType == NodeType::WitnessLeaf) {
+            throw quaderr("incomplete tree, missing leaf to make proof");
+        }
+
+        std::optional<ProofStrand> leafStrand, witnessStrand;
+        auto p = proved.begin();
+
+        for (auto r : proofBatchRequests(begin, end)) {
+            bool isProved = p != proved.end() && *p == r;
+            if (isProved) p++;
+
+            if (isProved && !leafStrand) {
+                std::string_view leafKey;
+                getLeafKey(txn, node.nodeId, leafKey);
+                leafStrand = ProofStrand{ ProofStrand::Type::Leaf, depth, std::string(node.leafKeyHash()), std::string(node.leafVal()), std::string(leafKey) };
+            } else if (!isProved && !witnessStrand) {
+                witnessStrand = ProofStrand{ ProofStrand::Type::WitnessLeaf, depth, std::string(node.leafKeyHash()), node.leafValHash(), };
+            }
+
+            auto span = builders[r].add(ProofStrand(isProved ? *leafStrand : *witnessStrand));
+            output.emplace_back(ProofBatchResult{ r, span, isProved, });
+        }
+    } else if (node.isBranch()) {
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.keyHash; });
+
+        assertDepth(depth);
+
+        ParsedNode leftNode(this, txn, node.leftNodeId, &node);
+        ParsedNode rightNode(this, txn, node.rightNodeId, &node);
+
+        // As in exportProofAux(), an empty side only gets a WitnessEmpty strand for requests with no keys on the other side
+
+        ProofBatchResults leftResults, rightResults;
+
+        if (leftNode.isEmpty()) leftResults = proofBatchEmpty(depth+1, begin, middle, middle, end, builders);
+        else if (begin != middle) leftResults = exportProofBatchAux(txn, depth+1, leftNode, begin, middle, builders, deletable);
+
+        if (rightNode.isEmpty()) rightResults = proofBatchEmpty(depth+1, middle, end, begin, middle, builders);
+        else if (middle != end) rightResults = exportProofBatchAux(txn, depth+1, rightNode, middle, end, builders, deletable);
+
+        std::optional<std::vector<ProofStrand>> leftSibling, rightSibling;
+        auto l = leftResults.begin(), r = rightResults.begin();
+
+        while (l != leftResults.end() || r != rightResults.end()) {
+            bool hasLeft = l != leftResults.end() && (r == rightResults.end() || l->request <= r->request);
+            bool hasRight = r != rightResults.end() && (l == leftResults.end() || r->request <= l->request);
+
+            uint64_t request = hasLeft ? l->request : r->request;
+            auto &builder = builders[request];
+
+            ProofSpan leftSpan, rightSpan;
+            bool leftEmptyable = leftNode.isEmpty(), rightEmptyable = rightNode.isEmpty();
+
+            if (hasLeft) {
+                leftSpan = l->span;
+                leftEmptyable = l->emptyable;
+                l++;
+            }
+
+            if (hasRight) {
+                rightSpan = r->span;
+                rightEmptyable = r->emptyable;
+                r++;
+            }
+
+            if (deletable) {
+                if (!hasLeft && !leftNode.isEmpty() && rightEmptyable) {
+                    if (!leftSibling) leftSibling = proofBatchSiblingStrands(txn, depth+1, leftNode, begin->keyHash, false);
+                    leftSpan = proofBatchAddSibling(txn, builder, depth+1, *leftSibling);
+                } else if (!hasRight && !rightNode.isEmpty() && leftEmptyable) {
+                    if (!rightSibling) rightSibling = proofBatchSiblingStrands(txn, depth+1, rightNode, begin->keyHash, true);
+                    rightSpan = proofBatchAddSibling(txn, builder, depth+1, *rightSibling);
+                }
+            }
+
+            auto span = builder.join(depth, leftSpan, rightSpan, leftNode, rightNode);
+            output.emplace_back(ProofBatchResult{ request, span, leftEmptyable && rightEmptyable, });
+        }
+    } else if (node.nodeType == NodeType::Witness) {
+        throw quaderr("encountered witness node: incomplete tree");
+    } else {
+        throw quaderr("unrecognized nodeType: ", int(node.nodeType));
+    }
+
+    return output;
+}
+
+// Distinct requests with keys in the range, in order
+
+static std::vector<uint64_t> proofBatchRequests(ProofBatchEntries::iterator begin, ProofBatchEntries::iterator end) {
+    std::vector<uint64_t> output;
+
+    for (auto it = begin; it != end; ++it) output.push_back(it->request);
+
+    std::sort(output.begin(), output.end());
+    output.erase(std::unique(output.begin(), output.end()), output.end());
+
+    return output;
+}
+
+// WitnessEmpty strands for the requests with keys in [begin, end), except those that also have keys in [otherBegin, otherEnd)
+
+ProofBatchResults proofBatchEmpty(uint64_t depth, ProofBatchEntries::iterator begin, ProofBatchEntries::iterator end, ProofBatchEntries::iterator otherBegin, ProofBatchEntries::iterator otherEnd, std::vector<ProofBuilder> &builders) {
+    ProofBatchResults output;
+
+    if (begin == end) return output;
+
+    Key h = begin->keyHash;
+    h.keepPrefixBits(depth);
+
+    auto others = proofBatchRequests(otherBegin, otherEnd);
+
+    for (auto r : proofBatchRequests(begin, end)) {
+        if (std::binary_search(others.begin(), others.end(), r)) continue;
+
+        auto span = builders[r].add(ProofStrand{ ProofStrand::Type::WitnessEmpty, depth, h.str(), });
+        output.emplace_back(ProofBatchResult{ r, span, true, });
+    }
+
+    return output;
+}
+
+// The strands exportProofSibling() would create for this sibling, in order
+
+std::vector<ProofStrand> proofBatchSiblingStrands(lmdb::txn &txn, uint64_t depth, const ParsedNode &node, const Key &keyHash, bool rightSide) {
+    ProofBuilder builder;
+
+    exportProofSibling(txn, depth, node, keyHash, rightSide, builder);
+
+    return std::move(builder.strands);
+}
+
+ProofSpan proofBatchAddSibling(lmdb::txn &txn, ProofBuilder &builder, uint64_t depth, const std::vector<ProofStrand> &strands) {
+    if (strands.size() == 1 && strands[0].depth == depth) return builder.add(ProofStrand(strands[0]));
+
+    ProofSpan left, right;
+
+    for (auto &strand : strands) {
+        auto span = builder.add(ProofStrand(strand));
+        if (Key::existing(strand.keyHash).getBit(depth)) right = span;
+        else left = span;
+    }
+
+    ParsedNode emptyNode(this, txn, 0);
+
+    return builder.join(depth, left, right, emptyNode, emptyNode);
+}
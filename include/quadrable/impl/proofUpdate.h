@@ -0,0 +1,265 @@
+public:
+
+// Applies updates to a proof without importing it: The proof is decoded into a small in-memory tree, the
+// UpdateSet is applied to that tree following the same rules as apply(), and the new root is computed. No
+// LMDB txn (or MemStore) is needed. As with a partial tree created by importProof(), only the keys that were
+// proved can be updated, and deletion may need a deletion-capable proof.
+//
+// Hashing is deferred: Nodes created by the proof or by apply() are hashed when root() or exportProof() is
+// next called, in one pass, so a node that several updates modify is only hashed once.
+
+class ProofUpdater {
+  public:
+    ProofUpdater(const Proof &proof, std::string_view expectedRoot = "") {
+        nodes.reserve(1 + proof.strands.size() + proof.cmds.size());
+        leaves.reserve(proof.strands.size());
+
+        nodes.emplace_back(); // index 0 is the empty node
+        rootIndex = importProof(proof);
+
+        if (expectedRoot.size() && root() != expectedRoot) throw quaderr("proof invalid");
+    }
+
+    std::string root() {
+        return hashNode(rootIndex).str();
+    }
+
+    // Consumes the UpdateSet. putReuse() updates are not supported, and outputNodeIds are set to 0.
+
+    void apply(UpdateSet &updatesOrig) {
+        UpdateSet updates = std::move(updatesOrig);
+
+        for (auto &u : updates.map) {
+            if (u.second.nodeIdOverride) throw quaderr("can't reuse nodes when updating a proof");
+            if (u.second.outputNodeId) *u.second.outputNodeId = 0;
+            u.second.outputNodeId = nullptr; // leafUpdateAction() would report node indexes
+        }
+
+        bool bubbleUp = false;
+
+        // Nodes are never modified in place, so if an exception is thrown the tree is unchanged
+        rootIndex = putAux(0, rootIndex, updates, updates.map.begin(), updates.map.end(), bubbleUp);
+    }
+
+    // A proof of the updated tree, containing everything known about it: Leaves (including updated and inserted
+    // ones) become Leaf strands, and witnesses are provided as in the original proof. Importing it creates a
+    // partial tree with the same shape as this one.
+
+    Proof exportProof() {
+        hashNode(rootIndex);
+
+        ProofBuilder builder;
+        Key path = Key::null();
+
+        if (rootIndex == 0) return builder.finish(builder.add(ProofStrand{ ProofStrand::Type::WitnessEmpty, 0, path.str(), }));
+        if (nodes[rootIndex].nodeType == NodeType::Witness) return builder.finish(builder.add(ProofStrand{ ProofStrand::Type::Witness, 0, path.str(), nodes[rootIndex].nodeHash.str(), }));
+
+        return builder.finish(exportProofAux(0, rootIndex, path, builder));
+    }
+
+  private:
+    struct Node {
+        NodeType nodeType = NodeType::Empty;
+        bool hashed = true;
+        uint32_t left = 0; // Leaf/WitnessLeaf: index into leaves
+        uint32_t right = 0;
+        Key nodeHash = Key::null();
+
+        bool isLeaf() const { return nodeType == NodeType::Leaf || nodeType == NodeType::WitnessLeaf; }
+        bool isBranch() const { return nodeType == NodeType::BranchLeft || nodeType == NodeType::BranchRight || nodeType == NodeType::BranchBoth; }
+    };
+
+    struct LeafData {
+        Key keyHash;
+        std::string val; // Leaf: value, WitnessLeaf: hash(value)
+        std::string key;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<LeafData> leaves;
+    uint32_t rootIndex = 0;
+
+    uint32_t addNode(Node &&node) {
+        if (nodes.size() >= std::numeric_limits<uint32_t>::max()) throw quaderr("too many nodes in ProofUpdater");
+        nodes.emplace_back(std::move(node));
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    uint32_t newLeaf(NodeType nodeType, const Key &keyHash, std::string_view val, std::string_view key) {
+        leaves.emplace_back(LeafData{ keyHash, std::string(val), std::string(key) });
+        return addNode(Node{ nodeType, false, static_cast<uint32_t>(leaves.size() - 1), 0, });
+    }
+
+    uint32_t newWitness(const Key &nodeHash) {
+        return addNode(Node{ NodeType::Witness, true, 0, 0, nodeHash, });
+    }
+
+    uint32_t newBranch(uint32_t left, uint32_t right) {
+        NodeType nodeType = right == 0 ? NodeType::BranchLeft : left == 0 ? NodeType::BranchRight : NodeType::BranchBoth;
+        return addNode(Node{ nodeType, false, left, right, });
+    }
+
+    uint32_t leftChild(uint32_t i) { return nodes[i].isBranch() ? nodes[i].left : 0; }
+    uint32_t rightChild(uint32_t i) { return nodes[i].isBranch() ? nodes[i].right : 0; }
+
+    // Hashes any nodes in the sub-tree that haven't been hashed yet, children first
+
+    const Key &hashNode(uint32_t i) {
+        if (nodes[i].hashed) return nodes[i].nodeHash;
+
+        Key output;
+
+        if (nodes[i].isLeaf()) {
+            auto &leaf = leaves[nodes[i].left];
+            Key valHash = nodes[i].nodeType == NodeType::Leaf ? Key::hash(leaf.val) : Key::existing(leaf.val);
+            unsigned char nullChar = 0;
+
+            Hash h(sizeof(output.data));
+            h.update(leaf.keyHash.sv());
+            h.update(valHash.sv());
+            h.update(&nullChar, 1);
+            h.final(output.data);
+        } else {
+            Key leftHash = hashNode(nodes[i].left);
+            Key rightHash = hashNode(nodes[i].right);
+
+            Hash h(sizeof(output.data));
+            h.update(leftHash.data, sizeof(leftHash.data));
+            h.update(rightHash.data, sizeof(rightHash.data));
+            h.final(output.data);
+        }
+
+        nodes[i].nodeHash = output;
+        nodes[i].hashed = true;
+
+        return nodes[i].nodeHash;
+    }
+
+
+    uint32_t importProof(const Proof &proof) {
+        auto newStrand = [&](const ProofStrand &strand, const Key &keyHash) -> uint32_t {
+            if (strand.strandType == ProofStrand::Type::Leaf) return newLeaf(NodeType::Leaf, keyHash, strand.val, strand.key);
+            if (strand.strandType == ProofStrand::Type::WitnessLeaf) return newLeaf(NodeType::WitnessLeaf, keyHash, Key::existing(strand.val).sv(), "");
+            if (strand.strandType == ProofStrand::Type::Witness) return newWitness(Key::existing(strand.val));
+            return 0;
+        };
+
+        auto witness = [&](const Key &hash){ return newWitness(hash); };
+        auto branch = [&](uint32_t left, uint32_t right){ return newBranch(left, right); };
+
+        return buildProofTree<uint32_t>(proof, 0, 0, newStrand, witness, branch);
+    }
+
+
+    // Same as Quadrable::putAux(), except that new nodes are added to this tree (and aren't hashed yet). The rules for
+    // leaves and bubbling are shared with it.
+
+    uint32_t putAux(uint64_t depth, uint32_t nodeIndex, UpdateSet &updates, UpdateSetMap::iterator begin, UpdateSetMap::iterator end, bool &bubbleUp) {
+        const Node node = nodes[nodeIndex];
+        bool checkBubble = false;
+
+        // recursion base cases
+
+        if (begin == end) {
+            return nodeIndex;
+        }
+
+        if (node.nodeType == NodeType::Witness) {
+            throw quaderr("encountered witness during update: partial tree");
+        } else if (node.nodeType == NodeType::Empty) {
+            updates.eraseRange(begin, end, [&](UpdateSetMap::iterator &u){ return u->second.deletion; });
+
+            if (begin == end) {
+                // All updates for this sub-tree were deletions for keys that don't exist, so do nothing.
+                return nodeIndex;
+            }
+
+            if (std::next(begin) == end) {
+                return newLeaf(begin);
+            }
+        } else if (node.isLeaf()) {
+            auto action = leafUpdateAction(updates, begin, end, leaves[node.left].keyHash, nodeIndex, bubbleUp, checkBubble);
+
+            if (action == LeafUpdate::Delete) {
+                return 0;
+            } else if (action == LeafUpdate::Unchanged) {
+                return nodeIndex;
+            } else if (action == LeafUpdate::Update) {
+                if (node.nodeType == NodeType::Leaf && begin->second.val == leaves[node.left].val) {
+                    // No change to this leaf, so do nothing. Don't do this for WitnessLeaf nodes, since we need to upgrade them to leaves.
+                    return nodeIndex;
+                }
+
+                return newLeaf(begin);
+            }
+        }
+
+
+        // Split into left and right groups of keys
+
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.first; });
+
+
+        // Recurse
+
+        assertDepth(depth);
+
+        uint32_t leftIndex = putAux(depth+1, leftChild(nodeIndex), updates, begin, middle, checkBubble);
+        uint32_t rightIndex = putAux(depth+1, rightChild(nodeIndex), updates, middle, end, checkBubble);
+
+        if (checkBubble) {
+            auto action = bubbleAction(nodes[leftIndex].nodeType, nodes[rightIndex].nodeType);
+
+            if (action != Bubble::None) {
+                bubbleUp = true;
+                return action == Bubble::Left ? leftIndex : action == Bubble::Right ? rightIndex : 0;
+            }
+        }
+
+        if (leftIndex == leftChild(nodeIndex) && rightIndex == rightChild(nodeIndex) && node.isBranch()) return nodeIndex;
+
+        return newBranch(leftIndex, rightIndex);
+    }
+
+    uint32_t newLeaf(UpdateSetMap::iterator it) {
+        if (it->second.nodeIdOverride) return static_cast<uint32_t>(it->second.nodeIdOverride); // a leaf being split
+
+        return newLeaf(NodeType::Leaf, it->first, it->second.val, it->second.key);
+    }
+
+
+    ProofSpan exportProofAux(uint64_t depth, uint32_t nodeIndex, Key &path, ProofBuilder &builder) {
+        auto &node = nodes[nodeIndex];
+
+        if (node.isLeaf()) {
+            auto &leaf = leaves[node.left];
+            return builder.add(ProofStrand{ node.nodeType == NodeType::Leaf ? ProofStrand::Type::Leaf : ProofStrand::Type::WitnessLeaf, depth, leaf.keyHash.str(), leaf.val, leaf.key, });
+        }
+
+        if (!node.isBranch()) return ProofSpan{}; // witnesses are provided by the parent, if possible
+
+        auto childSpan = [&](uint32_t childIndex, bool right){
+            path.setBit(depth, right);
+            auto span = exportProofAux(depth+1, childIndex, path, builder);
+            path.setBit(depth, 0);
+            return span;
+        };
+
+        auto leftSpan = childSpan(node.left, false);
+        auto rightSpan = childSpan(node.right, true);
+
+        // A branch with no leaves beneath it still needs a strand, so that importing recreates the branch
+
+        if (leftSpan.empty() && rightSpan.empty()) {
+            bool right = nodes[node.left].nodeType != NodeType::Witness;
+            path.setBit(depth, right);
+            auto span = builder.add(ProofStrand{ ProofStrand::Type::Witness, depth+1, path.str(), hashNode(right ? node.right : node.left).str(), });
+            path.setBit(depth, 0);
+            (right ? rightSpan : leftSpan) = span;
+        }
+
+        auto hashOf = [&](uint32_t i) -> std::string_view { return i == 0 ? std::string_view() : nodes[i].nodeHash.sv(); };
+
+        return builder.join(depth, leftSpan, rightSpan, hashOf(node.left), hashOf(node.right));
+    }
+};
@@ -0,0 +1,109 @@
+public:
+
+// Pruning: Replaces the parts of the current head that aren't needed with witnesses, leaving a partial tree
+// (like one imported from a proof) with the same root. Leaves that are kept can still be read, proved, and
+// updated. Pruned leaves become WitnessLeaf nodes, and sub-trees with nothing kept become single Witness nodes.
+//
+// The head is updated to the pruned tree. The nodes that were pruned away are freed by the next GarbageCollector
+// run, unless they are still reachable from other heads.
+
+// Keeps leaves whose keyHashes are within [begin, end]. Sub-trees entirely inside or outside of the range are
+// not traversed.
+
+BuiltNode prune(lmdb::txn &txn, const Key &begin, const Key &end) {
+    if (end < begin) throw quaderr("invalid prune range");
+
+    auto classify = [&](const Key &minKey, const Key &maxKey){
+        if (maxKey < begin || minKey > end) return PruneAction::Prune;
+        if (begin <= minKey && maxKey <= end) return PruneAction::Keep;
+        return PruneAction::Descend;
+    };
+
+    auto keepLeaf = [&](const ParsedNode &node){
+        Key keyHash = Key::existing(node.leafKeyHash());
+        return begin <= keyHash && keyHash <= end;
+    };
+
+    return pruneHead(txn, classify, keepLeaf);
+}
+
+// Keeps leaves for which keepLeaf returns true. Every leaf is visited.
+
+BuiltNode prune(lmdb::txn &txn, const std::function<bool(const ParsedNode &)> &keepLeaf) {
+    auto classify = [](const Key &, const Key &){ return PruneAction::Descend; };
+
+    return pruneHead(txn, classify, keepLeaf);
+}
+
+
+private:
+
+enum class PruneAction {
+    Keep = 0,
+    Prune = 1,
+    Descend = 2,
+};
+
+using PruneClassifier = std::function<PruneAction(const Key &minKey, const Key &maxKey)>;
+
+BuiltNode pruneHead(lmdb::txn &txn, const PruneClassifier &classify, const std::function<bool(const ParsedNode &)> &keepLeaf) {
+    uint64_t headNodeId = getHeadNodeId(txn);
+    Key path = Key::null();
+    bool kept;
+
+    auto newNode = pruneAux(txn, 0, headNodeId, path, classify, keepLeaf, kept);
+
+    if (newNode.nodeId != headNodeId) setHeadNodeId(txn, newNode.nodeId);
+
+    return newNode;
+}
+
+// kept is set if any (non-witness) leaves remain in the output
+
+BuiltNode pruneAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, Key &path, const PruneClassifier &classify, const std::function<bool(const ParsedNode &)> &keepLeaf, bool &kept, const ParsedNode *parent = nullptr) {
+    ParsedNode node(this, txn, nodeId, parent);
+
+    kept = false;
+
+    if (node.isEmpty() || node.isWitnessAny()) return BuiltNode::reuse(node);
+
+    if (node.isLeaf()) {
+        if (keepLeaf(node)) {
+            kept = true;
+            return BuiltNode::reuse(node);
+        }
+
+        return BuiltNode::newWitnessLeaf(this, txn, Key::existing(node.leafKeyHash()), Key::existing(node.leafValHash()));
+    }
+
+    if (!node.isBranch()) throw quaderr("unrecognized nodeType: ", int(node.nodeType));
+
+    assertDepth(depth);
+
+    Key maxKey = path;
+    for (size_t i = depth; i < 256; i++) maxKey.setBit(i, 1);
+
+    auto action = classify(path, maxKey);
+
+    if (action == PruneAction::Keep) {
+        kept = true;
+        return BuiltNode::reuse(node);
+    }
+
+    if (action == PruneAction::Prune) return BuiltNode::newWitness(this, txn, Key::existing(node.nodeHash()));
+
+    bool leftKept, rightKept;
+
+    auto leftNode = pruneAux(txn, depth + 1, node.leftNodeId, path, classify, keepLeaf, leftKept, &node);
+
+    path.setBit(depth, 1);
+    auto rightNode = pruneAux(txn, depth + 1, node.rightNodeId, path, classify, keepLeaf, rightKept, &node);
+    path.setBit(depth, 0);
+
+    kept = leftKept || rightKept;
+
+    if (!kept) return BuiltNode::newWitness(this, txn, Key::existing(node.nodeHash()));
+    if (leftNode.nodeId == node.leftNodeId && rightNode.nodeId == node.rightNodeId) return BuiltNode::reuse(node);
+
+    return BuiltNode::newBranch(this, txn, leftNode, rightNode);
+}
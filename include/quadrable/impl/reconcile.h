@@ -0,0 +1,189 @@
+public:
+
+// Set-reconciliation: An alternative to Sync for when the trees are large but differ by only a small
+// number of leaves. The syncer sends a StrataEstimator, the provider replies with its root and an IBLT
+// sized for the estimated difference, and the syncer then requests a regular proof for the differing keys.
+
+IBLT buildIBLT(lmdb::txn &txn, uint64_t nodeId, uint64_t subtableSize) {
+    IBLT output(subtableSize);
+
+    reconcileWalk(txn, nodeId, [&](ParsedNode &node){
+        output.insert(node.key(), Key::existing(node.nodeHash()));
+    });
+
+    return output;
+}
+
+StrataEstimator buildStrataEstimator(lmdb::txn &txn, uint64_t nodeId) {
+    StrataEstimator output;
+
+    reconcileWalk(txn, nodeId, [&](ParsedNode &node){
+        output.insert(Key::existing(node.nodeHash()));
+    });
+
+    return output;
+}
+
+// Brings an IBLT/StrataEstimator built for oldNodeId up to date with newNodeId. Only sub-trees that differ are visited.
+
+void updateIBLT(lmdb::txn &txn, IBLT &iblt, uint64_t oldNodeId, uint64_t newNodeId) {
+    for (auto &d : diff(txn, oldNodeId, newNodeId)) {
+        auto keyHash = Key::existing(d.keyHash);
+        auto nodeHash = leafNodeHash(keyHash, d.val);
+
+        if (d.deletion) iblt.erase(keyHash, nodeHash);
+        else iblt.insert(keyHash, nodeHash);
+    }
+}
+
+void updateStrataEstimator(lmdb::txn &txn, StrataEstimator &estimator, uint64_t oldNodeId, uint64_t newNodeId) {
+    for (auto &d : diff(txn, oldNodeId, newNodeId)) {
+        auto nodeHash = leafNodeHash(Key::existing(d.keyHash), d.val);
+
+        if (d.deletion) estimator.erase(nodeHash);
+        else estimator.insert(nodeHash);
+    }
+}
+
+ReconcileResponse handleReconcileRequest(lmdb::txn &txn, uint64_t nodeId, const StrataEstimator &theirs) {
+    auto ours = buildStrataEstimator(txn, nodeId);
+    uint64_t estimate = ours.estimateDifference(theirs);
+
+    return ReconcileResponse{ rootKey(txn, nodeId), buildIBLT(txn, nodeId, IBLT::subtableSizeFor(estimate)) };
+}
+
+// Same as above, but uses an estimator and an IBLT that are maintained alongside nodeId (see updateIBLT()).
+// The maintained IBLT should be large, since it will be folded down to the estimated size.
+
+ReconcileResponse handleReconcileRequest(lmdb::txn &txn, uint64_t nodeId, const StrataEstimator &theirs, const StrataEstimator &ours, const IBLT &maintained) {
+    uint64_t estimate = ours.estimateDifference(theirs);
+    uint64_t subtableSize = IBLT::subtableSizeFor(estimate);
+
+    if (subtableSize >= maintained.subtableSize()) return ReconcileResponse{ rootKey(txn, nodeId), maintained };
+
+    return ReconcileResponse{ rootKey(txn, nodeId), maintained.fold(subtableSize) };
+}
+
+
+
+class Reconcile {
+  public:
+    Quadrable *db;
+    uint64_t nodeIdLocal = std::numeric_limits<uint64_t>::max();
+    uint64_t nodeIdReconciled = 0;
+
+  private:
+    Key remoteRoot = Key::null();
+    std::set<Key> keyHashes;
+    bool decoded = false;
+
+  public:
+    Reconcile(Quadrable *db_) : db(db_) {}
+
+    void init(lmdb::txn &txn, uint64_t nodeIdLocal_) {
+        if (nodeIdLocal != std::numeric_limits<uint64_t>::max()) throw quaderr("Reconcile already init'ed");
+        nodeIdLocal = nodeIdLocal_;
+    }
+
+    StrataEstimator getEstimator(lmdb::txn &txn) {
+        if (nodeIdLocal == std::numeric_limits<uint64_t>::max()) throw quaderr("Reconcile not yet init'ed");
+        return db->buildStrataEstimator(txn, nodeIdLocal);
+    }
+
+    // Returns false if the IBLT couldn't be decoded (the difference was under-estimated). In this case
+    // the caller should fall back to Sync, or retry with a bigger IBLT.
+
+    bool addIBLT(lmdb::txn &txn, const ReconcileResponse &resp) {
+        if (nodeIdLocal == std::numeric_limits<uint64_t>::max()) throw quaderr("Reconcile not yet init'ed");
+
+        IBLT diff = resp.iblt;
+        diff.subtract(db->buildIBLT(txn, nodeIdLocal, resp.iblt.subtableSize()));
+
+        std::vector<IBLT::Element> theirs, ours;
+        if (!diff.decode(theirs, ours)) return false;
+
+        keyHashes.clear();
+        for (auto &e : theirs) keyHashes.insert(e.keyHash);
+        for (auto &e : ours) keyHashes.insert(e.keyHash);
+
+        remoteRoot = resp.root;
+        decoded = true;
+
+        return true;
+    }
+
+    // The keys that must be proved by the provider (with exportProofRaw) to complete the reconciliation
+
+    std::vector<Key> getKeys() {
+        if (!decoded) throw quaderr("IBLT not yet decoded");
+        return std::vector<Key>(keyHashes.begin(), keyHashes.end());
+    }
+
+    void addProof(lmdb::txn &txn, Proof &proof) {
+        if (!decoded) throw quaderr("IBLT not yet decoded");
+
+        if (keyHashes.size() == 0) {
+            if (db->rootKey(txn, nodeIdLocal) != remoteRoot) throw quaderr("reconciled root mismatch");
+            nodeIdReconciled = nodeIdLocal;
+            return;
+        }
+
+        auto proofRoot = db->importProofInternal(txn, proof);
+        if (proofRoot.nodeHash != remoteRoot) throw quaderr("reconcile proof invalid");
+
+        auto updates = db->change();
+        std::set<Key> deleted = keyHashes;
+
+        for (auto &strand : proof.strands) {
+            if (strand.strandType != ProofStrand::Type::Leaf) continue;
+
+            auto keyHash = Key::existing(strand.keyHash);
+            if (!keyHashes.count(keyHash)) continue;
+
+            if (strand.key.size()) updates.put(strand.key, strand.val);
+            else updates.put(keyHash, strand.val);
+
+            deleted.erase(keyHash);
+        }
+
+        for (auto &keyHash : deleted) updates.del(keyHash);
+
+        auto newNode = db->reconcileApply(txn, nodeIdLocal, updates);
+
+        // The IBLT is probabilistic, so the Merkle root is the final authority that the reconciliation is complete
+        if (newNode.nodeHash != remoteRoot) throw quaderr("reconciled root mismatch");
+
+        nodeIdReconciled = newNode.nodeId;
+    }
+};
+
+
+
+private:
+
+void reconcileWalk(lmdb::txn &txn, uint64_t nodeId, const std::function<void(ParsedNode &)> &cb) {
+    walkTree(txn, nodeId, [&](ParsedNode &node, uint64_t){
+        if (node.isWitnessAny()) throw quaderr("encountered witness node: incomplete tree");
+        if (node.isLeaf()) cb(node);
+        return true;
+    });
+}
+
+BuiltNode reconcileApply(lmdb::txn &txn, uint64_t nodeId, UpdateSet &updates) {
+    bool bubbleUp = false;
+    return putAux(txn, 0, nodeId, updates, updates.map.begin(), updates.map.end(), bubbleUp, false);
+}
+
+static Key leafNodeHash(const Key &keyHash, std::string_view val) {
+    Key valHash = Key::hash(val);
+    Key output;
+    unsigned char nullChar = 0;
+
+    Hash h(sizeof(output.data));
+    h.update(keyHash.sv());
+    h.update(valHash.sv());
+    h.update(&nullChar, 1);
+    h.final(output.data);
+
+    return output;
+}
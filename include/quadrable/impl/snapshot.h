@@ -0,0 +1,112 @@
+public:
+
+// A read-only view of one tree, pinned to its root nodeId. Unlike reading through the Quadrable object itself,
+// a Snapshot doesn't consult the current head, and reads made through it don't update nodesRead (or any other
+// member of the Quadrable), so any number of threads can share one Quadrable instance by each reading through
+// their own Snapshots. Each thread must use its own read txn, and the Quadrable's configuration must not be
+// changed (ie by setNodeStore or addMemStore) while Snapshots are being read.
+//
+// One thread may write through the same Quadrable (in its own write txn) while Snapshots are being read, as long as
+// it writes to LMDB or a NodeStore, not a MemStore. Snapshot reads don't look at any member that writing modifies.
+//
+// Creating a Snapshot does no I/O. It holds a reference to the txn, so it must not outlive it.
+
+class Snapshot {
+  public:
+    Snapshot(Quadrable *db_, lmdb::txn &txn_, uint64_t nodeId_) : db(db_), txn(txn_), nodeId(nodeId_) {}
+
+    uint64_t getNodeId() const {
+        return nodeId;
+    }
+
+    std::string root() {
+        SnapshotReadGuard g;
+        return db->root(txn, nodeId);
+    }
+
+    bool get(std::string_view key, std::string_view &val, uint64_t *outputNodeId = nullptr) {
+        GetMultiQuery query;
+
+        auto rec = query.emplace(key, GetMultiResult{});
+
+        getMulti(query);
+
+        if (outputNodeId) *outputNodeId = rec.first->second.nodeId;
+        if (rec.first->second.exists) val = rec.first->second.val;
+        return rec.first->second.exists;
+    }
+
+    GetMultiQuery get(std::set<std::string> keys) {
+        GetMultiQuery query;
+
+        for (auto &key : keys) {
+            query.emplace(key, GetMultiResult{});
+        }
+
+        getMulti(query);
+
+        return query;
+    }
+
+    void getMulti(GetMultiQuery &query) {
+        SnapshotReadGuard g;
+        db->getMulti(txn, nodeId, query);
+    }
+
+    void getMultiRaw(GetMultiQuery &query) {
+        SnapshotReadGuard g;
+        db->getMultiRaw(txn, nodeId, query);
+    }
+
+    Iterator iterate(const Key &target, bool reverse = false) {
+        return Iterator(db, txn, nodeId, target, reverse, true);
+    }
+
+    Proof exportProof(const std::vector<std::string> &keys, bool deletable = false) {
+        SnapshotReadGuard g;
+        return db->exportProof(txn, nodeId, keys, deletable);
+    }
+
+    Proof exportProofRaw(const std::vector<Key> &keys, bool deletable = false) {
+        SnapshotReadGuard g;
+        return db->exportProofRaw(txn, nodeId, keys, deletable);
+    }
+
+    std::vector<Proof> exportProofBatch(const std::vector<std::vector<std::string>> &keySets, bool deletable = false) {
+        SnapshotReadGuard g;
+        return db->exportProofBatch(txn, nodeId, keySets, deletable);
+    }
+
+    Proof exportProofRange(const Key &begin, const Key &end) {
+        SnapshotReadGuard g;
+        return db->exportProofRange(txn, nodeId, begin, end);
+    }
+
+  private:
+    Quadrable *db;
+    lmdb::txn &txn;
+    uint64_t nodeId;
+};
+
+Snapshot snapshot(lmdb::txn &txn) {
+    return Snapshot(this, txn, getHeadNodeId(txn));
+}
+
+Snapshot snapshot(lmdb::txn &txn, uint64_t nodeId) {
+    return Snapshot(this, txn, nodeId);
+}
+
+
+private:
+
+struct SnapshotReadGuard {
+    bool orig;
+
+    SnapshotReadGuard(bool enable = true) : orig(snapshotRead) {
+        snapshotRead = snapshotRead || enable;
+    }
+
+    ~SnapshotReadGuard() {
+        snapshotRead = orig;
+    }
+};
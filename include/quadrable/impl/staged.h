@@ -0,0 +1,118 @@
+public:
+
+// Staged commits: Since LMDB allows only one writer at a time, the hashing and tree building of an update can
+// instead be done ahead of time by prepare(), against a snapshot of the tree (in a read-only txn, and possibly in
+// another thread with its own Quadrable instance). The result is held in a MemStore owned by the PreparedUpdate.
+//
+// commitPrepared() then merges it into the current head in a write txn. Sub-trees that were modified only by the
+// prepared update are copied in as-is, and sub-trees modified only since the snapshot are kept, so paths are only
+// recomputed where both changed. Updates are merged as changes relative to the snapshot: An update that had no
+// effect on the snapshot (ie, deleting a key that didn't exist then) has no effect when committed.
+
+struct PreparedUpdate {
+    uint64_t baseNodeId = 0;
+    uint64_t nodeId = 0;
+    std::unique_ptr<MemStore> memStore;
+};
+
+PreparedUpdate prepare(lmdb::txn &txn, uint64_t baseNodeId, UpdateSet &updates) {
+    PreparedUpdate output;
+    output.baseNodeId = baseNodeId;
+    output.memStore = std::make_unique<MemStore>();
+
+    MemStoreGuard g(this, *output.memStore);
+    DetachedHeadGuard h(this, baseNodeId, true);
+
+    apply(txn, updates);
+    output.nodeId = detachedHeadNodeId;
+
+    return output;
+}
+
+BuiltNode commitPrepared(lmdb::txn &txn, PreparedUpdate &prepared) {
+    if (!prepared.memStore) throw quaderr("PreparedUpdate already committed");
+
+    uint64_t headNodeId = getHeadNodeId(txn);
+    BuiltNode newNode;
+
+    {
+        MemStoreGuard g(this, *prepared.memStore);
+        bool origWriteToMemStore = writeToMemStore;
+        writeToMemStore = false;
+
+        try {
+            newNode = mergePreparedAux(txn, prepared.baseNodeId, headNodeId, prepared.nodeId, 0);
+        } catch (...) {
+            writeToMemStore = origWriteToMemStore;
+            throw;
+        }
+
+        writeToMemStore = origWriteToMemStore;
+    }
+
+    prepared.memStore.reset();
+
+    if (newNode.nodeId != headNodeId) setHeadNodeId(txn, newNode.nodeId);
+
+    return newNode;
+}
+
+
+private:
+
+struct DetachedHeadGuard {
+    Quadrable *db;
+    bool origDetachedHead;
+    uint64_t origDetachedHeadNodeId;
+    bool origWriteToMemStore;
+
+    DetachedHeadGuard(Quadrable *db_, uint64_t nodeId, bool writeToMemStore) : db(db_) {
+        origDetachedHead = db->detachedHead;
+        origDetachedHeadNodeId = db->detachedHeadNodeId;
+        origWriteToMemStore = db->writeToMemStore;
+
+        db->checkout(nodeId);
+        db->writeToMemStore = writeToMemStore;
+    }
+
+    ~DetachedHeadGuard() {
+        db->detachedHead = origDetachedHead;
+        db->detachedHeadNodeId = origDetachedHeadNodeId;
+        db->writeToMemStore = origWriteToMemStore;
+    }
+};
+
+BuiltNode mergePreparedAux(lmdb::txn &txn, uint64_t baseNodeId, uint64_t oursNodeId, uint64_t theirsNodeId, uint64_t depth, const ParsedNode *parentBase = nullptr, const ParsedNode *parentOurs = nullptr, const ParsedNode *parentTheirs = nullptr) {
+    assertDepth(depth);
+
+    ParsedNode base(this, txn, baseNodeId, parentBase);
+    ParsedNode ours(this, txn, oursNodeId, parentOurs);
+    ParsedNode theirs(this, txn, theirsNodeId, parentTheirs);
+
+    if (theirs.nodeHash() == base.nodeHash() || theirs.nodeHash() == ours.nodeHash()) return BuiltNode::reuse(ours);
+    if (ours.nodeHash() == base.nodeHash()) return flushMemStoreAux(txn, theirsNodeId, oursNodeId, depth);
+
+    if (base.isBranch() && ours.isBranch() && theirs.isBranch()) {
+        auto leftNode = mergePreparedAux(txn, base.leftNodeId, ours.leftNodeId, theirs.leftNodeId, depth + 1, &base, &ours, &theirs);
+        auto rightNode = mergePreparedAux(txn, base.rightNodeId, ours.rightNodeId, theirs.rightNodeId, depth + 1, &base, &ours, &theirs);
+
+        // Deletions on both sides may leave a single leaf, which must bubble up
+        if (leftNode.isEmpty() && rightNode.isEmpty()) return BuiltNode::empty();
+        if (leftNode.isLeaf() && rightNode.isEmpty()) return leftNode;
+        if (leftNode.isEmpty() && rightNode.isLeaf()) return rightNode;
+
+        if (leftNode.nodeId == ours.leftNodeId && rightNode.nodeId == ours.rightNodeId) return BuiltNode::reuse(ours);
+        return BuiltNode::newBranch(this, txn, leftNode, rightNode);
+    }
+
+    // Both sides changed the shape of this sub-tree, so re-apply the prepared changes to it
+
+    auto updates = change();
+
+    auto changes = diff(txn, baseNodeId, theirsNodeId);
+    for (auto &d : changes) if (d.deletion) updates.del(Key::existing(d.keyHash));
+    for (auto &d : changes) if (!d.deletion) updates.put(Key::existing(d.keyHash), d.val);
+
+    bool bubbleUp = false;
+    return putAux(txn, depth, oursNodeId, updates, updates.map.begin(), updates.map.end(), bubbleUp, false);
+}
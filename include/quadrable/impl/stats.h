@@ -16,7 +16,7 @@ Stats stats(lmdb::txn &txn) {
     walkTree(txn, [&](ParsedNode &node, uint64_t depth){
         output.numNodes++;
         output.maxDepth = std::max(output.maxDepth, depth);
-        output.numBytes += node.raw.size();
+        if (node.chainOffset == 0) output.numBytes += node.raw.size();
 
         if (node.nodeType == NodeType::Leaf) {
             output.numLeafNodes++;
@@ -1,24 +1,43 @@
 public:
 
 
-SyncResponses handleSyncRequests(lmdb::txn &txn, uint64_t nodeId, SyncRequests &reqs, uint64_t bytesBudget = std::numeric_limits<uint64_t>::max()) {
+SyncResponses handleSyncRequests(lmdb::txn &txn, uint64_t nodeId, SyncRequests &reqs, uint64_t bytesBudget = std::numeric_limits<uint64_t>::max(), SyncMetrics *metrics = nullptr) {
     if (bytesBudget == 0) throw quaderr("bytesBudget can't be 0");
     if (reqs.size() == 0) throw quaderr("empty fragments request");
 
-    for (size_t i = 1; i < reqs.size() - 1; i++) {
+    for (size_t i = 1; i < reqs.size(); i++) {
         if (reqs[i].path <= reqs[i - 1].path) throw quaderr("fragments request out of order");
     }
 
+    if (!trackKeys && std::any_of(reqs.begin(), reqs.end(), [](const auto &req){ return req.fullKeys; })) {
+        throw quaderr("full keys requested, but key tracking not enabled");
+    }
+
+    std::optional<SyncPhaseTimer> timer;
+    if (metrics) timer.emplace(this, metrics->handle);
+
     SyncResponses resps;
     Key currPath = Key::null();
 
     handleSyncRequestsAux(txn, 0, nodeId, 0, currPath, reqs.begin(), reqs.end(), resps, bytesBudget);
 
+    if (metrics) {
+        metrics->roundTrips++;
+        metrics->requests += reqs.size();
+        recordSyncResps(*metrics, resps);
+    }
+
     return resps;
 }
 
 
 
+void deleteSyncSession(lmdb::txn &txn, std::string_view sessionName) {
+    dbi_syncSession.del(txn, sessionName);
+}
+
+
+
 enum class DiffType {
     Added = 0,
     Deleted = 1,
@@ -34,6 +53,9 @@ class Sync {
     uint64_t nodeIdShadow;
     uint64_t initialDepthLimit = 4;
     uint64_t laterDepthLimit = 4;
+    bool fullKeys = false; // request keys from provider so they can be stored locally (requires trackKeys on both sides)
+    bool countWitnesses = false; // getReqs() continues past the bytesBudget to count metrics.witnessesRemaining
+    SyncMetrics metrics;
 
   private:
     bool inited = false;
@@ -50,30 +72,79 @@ class Sync {
         nodeIdShadow = node.nodeId;
     }
 
+    // Persistent sessions: The local and shadow trees must be stored in LMDB (not a MemStore)
+
+    void save(lmdb::txn &txn, std::string_view sessionName) {
+        if (nodeIdLocal == std::numeric_limits<uint64_t>::max()) throw quaderr("Sync not yet init'ed");
+        if (nodeIdLocal >= firstMemStoreNodeId || nodeIdShadow >= firstMemStoreNodeId) throw quaderr("can't save sync session containing MemStore nodes");
+
+        std::string o;
+
+        o += encodeVarInt(nodeIdLocal);
+        o += encodeVarInt(nodeIdShadow);
+        o += encodeVarInt(inited ? 1 : 0);
+        o += encodeVarInt(initialDepthLimit);
+        o += encodeVarInt(laterDepthLimit);
+        o += encodeVarInt(fullKeys ? 1 : 0);
+        o += encodeNodeIdSet(finishedNodes);
+        o += encodeNodeIdSet(diffedNodes);
+
+        db->dbi_syncSession.put(txn, sessionName, o);
+    }
+
+    void resume(lmdb::txn &txn, std::string_view sessionName) {
+        if (nodeIdLocal != std::numeric_limits<uint64_t>::max()) throw quaderr("Sync already init'ed");
+
+        std::string_view encoded;
+        if (!db->dbi_syncSession.get(txn, sessionName, encoded)) throw quaderr("sync session not found: ", sessionName);
+
+        nodeIdLocal = decodeVarInt(encoded);
+        nodeIdShadow = decodeVarInt(encoded);
+        inited = decodeVarInt(encoded) != 0;
+        initialDepthLimit = decodeVarInt(encoded);
+        laterDepthLimit = decodeVarInt(encoded);
+        fullKeys = decodeVarInt(encoded) != 0;
+        finishedNodes = decodeNodeIdSet(encoded);
+        diffedNodes = decodeNodeIdSet(encoded);
+    }
+
     SyncRequests getReqs(lmdb::txn &txn, uint64_t bytesBudget = std::numeric_limits<uint64_t>::max(), std::optional<SyncedDiffCb> cb = std::nullopt) {
         if (nodeIdLocal == std::numeric_limits<uint64_t>::max()) throw quaderr("Sync not yet init'ed");
 
         if (bytesBudget == 0) throw quaderr("bytesBudget can't be 0");
 
+        SyncPhaseTimer timer(db, metrics.reconcile);
+
+        SyncRequests output;
+        metrics.witnessesRemaining = 0;
+
         if (!inited) {
-            return { SyncRequest{
+            if (countWitnesses) metrics.witnessesRemaining = 1;
+
+            output.emplace_back(SyncRequest{
                 Key::null(),
                 0,
                 initialDepthLimit,
                 false,
-            } };
+                fullKeys,
+            });
+        } else {
+            Key currPath = Key::null();
+            reconcileTrees(txn, nodeIdLocal, nodeIdShadow, 0, currPath, bytesBudget, output, cb);
         }
 
-        SyncRequests output;
-
-        Key currPath = Key::null();
-
-        reconcileTrees(txn, nodeIdLocal, nodeIdShadow, 0, currPath, bytesBudget, output, cb);
+        metrics.requests += output.size();
+        for (const auto &req : output) metrics.reqBytes += transport::encodedSizeSyncRequest(req);
 
         return output;
     }
 
     void addResps(lmdb::txn &txn, SyncRequests &reqs, SyncResponses &resps) {
+        SyncPhaseTimer timer(db, metrics.import);
+
+        metrics.roundTrips++;
+        db->recordSyncResps(metrics, resps);
+
         auto newNodeShadow = db->importSyncResponses(txn, nodeIdShadow, reqs, resps);
 
         if (inited && db->root(txn, nodeIdShadow) != db->root(txn, newNodeShadow.nodeId)) throw quaderr("hash mismatch after addResps");
@@ -86,20 +157,20 @@ class Sync {
         diffedNodes.clear();
     }
 
-    void diff(lmdb::txn &txn, uint64_t nodeIdOurs, uint64_t nodeIdTheirs, const SyncedDiffCb &cb) {
-        ParsedNode nodeOurs(db, txn, nodeIdOurs);
-        ParsedNode nodeTheirs(db, txn, nodeIdTheirs);
+    void diff(lmdb::txn &txn, uint64_t nodeIdOurs, uint64_t nodeIdTheirs, const SyncedDiffCb &cb, const ParsedNode *parentOurs = nullptr, const ParsedNode *parentTheirs = nullptr) {
+        ParsedNode nodeOurs(db, txn, nodeIdOurs, parentOurs);
+        ParsedNode nodeTheirs(db, txn, nodeIdTheirs, parentTheirs);
 
         if (nodeOurs.nodeHash() == nodeTheirs.nodeHash()) return;
         if (diffedNodes.count(nodeIdOurs)) return;
 
         if (nodeOurs.isBranch() && nodeTheirs.isBranch()) {
-            diff(txn, nodeOurs.leftNodeId, nodeTheirs.leftNodeId, cb);
-            diff(txn, nodeOurs.rightNodeId, nodeTheirs.rightNodeId, cb);
+            diff(txn, nodeOurs.leftNodeId, nodeTheirs.leftNodeId, cb, &nodeOurs, &nodeTheirs);
+            diff(txn, nodeOurs.rightNodeId, nodeTheirs.rightNodeId, cb, &nodeOurs, &nodeTheirs);
         } else if (nodeTheirs.isBranch()) {
             ParsedNode found(db, txn, 0);
-            diffAux(txn, nodeTheirs.leftNodeId, nodeOurs, found, DiffType::Added, cb);
-            diffAux(txn, nodeTheirs.rightNodeId, nodeOurs, found, DiffType::Added, cb);
+            diffAux(txn, nodeTheirs.leftNodeId, nodeOurs, found, DiffType::Added, cb, &nodeTheirs);
+            diffAux(txn, nodeTheirs.rightNodeId, nodeOurs, found, DiffType::Added, cb, &nodeTheirs);
             if (nodeOurs.nodeId) {
                 if (found.nodeId) {
                     if (found.nodeHash() != nodeOurs.nodeHash()) cb(DiffType::Changed, found);
@@ -109,8 +180,8 @@ class Sync {
             }
         } else if (nodeOurs.isBranch()) {
             ParsedNode found(db, txn, 0);
-            diffAux(txn, nodeOurs.leftNodeId, nodeTheirs, found, DiffType::Deleted, cb);
-            diffAux(txn, nodeOurs.rightNodeId, nodeTheirs, found, DiffType::Deleted, cb);
+            diffAux(txn, nodeOurs.leftNodeId, nodeTheirs, found, DiffType::Deleted, cb, &nodeOurs);
+            diffAux(txn, nodeOurs.rightNodeId, nodeTheirs, found, DiffType::Deleted, cb, &nodeOurs);
             if (nodeTheirs.nodeId) {
                 if (found.nodeId) {
                     if (found.nodeHash() != nodeTheirs.nodeHash()) cb(DiffType::Changed, nodeTheirs);
@@ -130,24 +201,52 @@ class Sync {
 
   private:
 
-    void diffAux(lmdb::txn &txn, uint64_t nodeId, ParsedNode &searchNode, ParsedNode &found, DiffType dt, const SyncedDiffCb &cb) {
-        ParsedNode node(db, txn, nodeId);
+    static std::string encodeNodeIdSet(const std::unordered_set<uint64_t> &nodeIds) {
+        std::vector<uint64_t> sorted(nodeIds.begin(), nodeIds.end());
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string o = encodeVarInt(sorted.size());
+        uint64_t prev = 0;
+
+        for (auto nodeId : sorted) {
+            o += encodeVarInt(nodeId - prev);
+            prev = nodeId;
+        }
+
+        return o;
+    }
+
+    static std::unordered_set<uint64_t> decodeNodeIdSet(std::string_view &encoded) {
+        std::unordered_set<uint64_t> nodeIds;
+        uint64_t num = decodeVarInt(encoded);
+        uint64_t prev = 0;
+
+        for (uint64_t i = 0; i < num; i++) {
+            prev += decodeVarInt(encoded);
+            nodeIds.insert(prev);
+        }
+
+        return nodeIds;
+    }
+
+    void diffAux(lmdb::txn &txn, uint64_t nodeId, ParsedNode &searchNode, ParsedNode &found, DiffType dt, const SyncedDiffCb &cb, const ParsedNode *parent = nullptr) {
+        ParsedNode node(db, txn, nodeId, parent);
 
         if (node.isBranch()) {
-            diffAux(txn, node.leftNodeId, searchNode, found, dt, cb);
-            diffAux(txn, node.rightNodeId, searchNode, found, dt, cb);
+            diffAux(txn, node.leftNodeId, searchNode, found, dt, cb, &node);
+            diffAux(txn, node.rightNodeId, searchNode, found, dt, cb, &node);
         } else {
             if (searchNode.nodeId != 0 && node.nodeId != 0 && node.leafKeyHash() == searchNode.leafKeyHash()) found = node;
             else if (node.nodeId != 0) cb(dt, node);
         }
     }
 
-    bool reconcileTrees(lmdb::txn &txn, uint64_t nodeIdOurs, uint64_t nodeIdTheirs, uint64_t depth, Key &currPath, uint64_t &bytesBudget, SyncRequests &output, std::optional<SyncedDiffCb> cb = std::nullopt) {
-        ParsedNode nodeOurs(db, txn, nodeIdOurs);
-        ParsedNode nodeTheirs(db, txn, nodeIdTheirs);
+    bool reconcileTrees(lmdb::txn &txn, uint64_t nodeIdOurs, uint64_t nodeIdTheirs, uint64_t depth, Key &currPath, uint64_t &bytesBudget, SyncRequests &output, std::optional<SyncedDiffCb> cb = std::nullopt, const ParsedNode *parentOurs = nullptr, const ParsedNode *parentTheirs = nullptr) {
+        ParsedNode nodeOurs(db, txn, nodeIdOurs, parentOurs);
+        ParsedNode nodeTheirs(db, txn, nodeIdTheirs, parentTheirs);
 
         if (nodeOurs.nodeHash() == nodeTheirs.nodeHash() || finishedNodes.count(nodeIdOurs)) return true;
-        if (!bytesBudget) return false;
+        if (!bytesBudget && !countWitnesses) return false;
 
         bool ret = true;
 
@@ -158,32 +257,30 @@ class Sync {
         };
 
         if (nodeTheirs.isBranch()) {
-            bool leftRet = reconcileTrees(txn, nodeOurs.isBranch() ? nodeOurs.leftNodeId : nodeIdOurs, nodeTheirs.leftNodeId, depth+1, currPath, bytesBudget, output, cb);
+            bool leftRet = reconcileTrees(txn, nodeOurs.isBranch() ? nodeOurs.leftNodeId : nodeIdOurs, nodeTheirs.leftNodeId, depth+1, currPath, bytesBudget, output, cb, &nodeOurs, &nodeTheirs);
             currPath.setBit(depth, 1);
-            bool rightRet = reconcileTrees(txn, nodeOurs.isBranch() ? nodeOurs.rightNodeId : nodeIdOurs, nodeTheirs.rightNodeId, depth+1, currPath, bytesBudget, output, cb);
+            bool rightRet = reconcileTrees(txn, nodeOurs.isBranch() ? nodeOurs.rightNodeId : nodeIdOurs, nodeTheirs.rightNodeId, depth+1, currPath, bytesBudget, output, cb, &nodeOurs, &nodeTheirs);
             currPath.setBit(depth, 0);
 
             ret = leftRet && rightRet;
             if (ret && nodeOurs.isBranch()) finishedNodes.insert(nodeIdOurs);
-        } else if (nodeTheirs.isWitnessLeaf()) {
-            output.emplace_back(SyncRequest{
-                currPath,
-                depth,
-                1,
-                true,
-            });
+        } else if (nodeTheirs.isWitnessAny()) {
+            if (countWitnesses) metrics.witnessesRemaining++;
 
-            reduceBytesBudget();
-            ret = false;
-        } else if (nodeTheirs.isWitness()) {
-            output.emplace_back(SyncRequest{
-                currPath,
-                depth,
-                laterDepthLimit,
-                false,
-            });
+            if (bytesBudget) {
+                bool isLeaf = nodeTheirs.isWitnessLeaf();
+
+                output.emplace_back(SyncRequest{
+                    currPath,
+                    depth,
+                    isLeaf ? 1 : laterDepthLimit,
+                    isLeaf,
+                    fullKeys,
+                });
+
+                reduceBytesBudget();
+            }
 
-            reduceBytesBudget();
             ret = false;
         }
 
@@ -201,19 +298,55 @@ class Sync {
 private:
 
 
-void handleSyncRequestsAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t parentNodeId, Key &currPath, SyncRequests::iterator begin, SyncRequests::iterator end, SyncResponses &resps, uint64_t &bytesBudget) {
+// Accumulates node reads/writes and wall time into a SyncPhaseMetrics for the lifetime of the object
+
+class SyncPhaseTimer {
+  public:
+    SyncPhaseTimer(Quadrable *db_, SyncPhaseMetrics &phase_) : db(db_), phase(phase_), nodesRead(db->nodesRead), nodesWritten(db->nodesWritten), start(std::chrono::steady_clock::now()) {}
+
+    ~SyncPhaseTimer() {
+        phase.calls++;
+        phase.nodesRead += db->nodesRead - nodesRead;
+        phase.nodesWritten += db->nodesWritten - nodesWritten;
+        phase.wallTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+  private:
+    Quadrable *db;
+    SyncPhaseMetrics &phase;
+    uint64_t nodesRead;
+    uint64_t nodesWritten;
+    std::chrono::steady_clock::time_point start;
+};
+
+void recordSyncResps(SyncMetrics &metrics, const SyncResponses &resps) {
+    metrics.fragments += resps.size();
+
+    for (const auto &resp : resps) {
+        metrics.strands += resp.strands.size();
+
+        for (const auto &cmd : resp.cmds) {
+            if (cmd.op == ProofCmd::Op::HashProvided) metrics.hashCmds++;
+        }
+
+        metrics.respBytesEstimate += estimateSizeProof(resp);
+    }
+}
+
+
+void handleSyncRequestsAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint64_t parentNodeId, Key &currPath, SyncRequests::iterator begin, SyncRequests::iterator end, SyncResponses &resps, uint64_t &bytesBudget, const ParsedNode *parent = nullptr) {
     if (begin == end || bytesBudget == 0) {
         return;
     }
 
-    ParsedNode node(this, txn, nodeId);
+    ParsedNode node(this, txn, nodeId, parent);
 
     // If a fragment ends on the path of another fragment in the SyncRequests list,
     // then the following will terminate early and the results will be incorrect. So,
     // it is important the sync requests creator not create requests like this.
 
     if (begin != end && std::next(begin) == end && begin->startDepth == depth) {
-        resps.emplace_back(exportProofFragment(txn, nodeId, currPath, *begin));
+        resps.emplace_back(exportProofFragment(txn, node, currPath, *begin));
         uint64_t estimate = estimateSizeProof(resps.back());
         if (bytesBudget > estimate) bytesBudget -= estimate;
         else bytesBudget = 0;
@@ -221,18 +354,17 @@ void handleSyncRequestsAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint
     }
 
     if (node.isBranch()) {
-        auto middle = begin;
-        while (middle != end && !middle->path.getBit(depth)) ++middle;
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.path; });
 
         assertDepth(depth);
 
         if (node.leftNodeId || middle == end) {
-            handleSyncRequestsAux(txn, depth+1, node.leftNodeId, nodeId, currPath, begin, middle, resps, bytesBudget);
+            handleSyncRequestsAux(txn, depth+1, node.leftNodeId, nodeId, currPath, begin, middle, resps, bytesBudget, &node);
         }
 
         if (node.rightNodeId || begin == middle) {
             currPath.setBit(depth, 1);
-            handleSyncRequestsAux(txn, depth+1, node.rightNodeId, nodeId, currPath, middle, end, resps, bytesBudget);
+            handleSyncRequestsAux(txn, depth+1, node.rightNodeId, nodeId, currPath, middle, end, resps, bytesBudget, &node);
             currPath.setBit(depth, 0);
         }
     } else {
@@ -240,25 +372,16 @@ void handleSyncRequestsAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, uint
     }
 }
 
-Proof exportProofFragment(lmdb::txn &txn, uint64_t nodeId, Key currPath, const SyncRequest &req) {
+Proof exportProofFragment(lmdb::txn &txn, const ParsedNode &node, Key currPath, const SyncRequest &req) {
     uint64_t depth = req.startDepth;
 
     currPath.keepPrefixBits(depth);
 
-    ProofGenItems items;
-    ProofReverseNodeMap reverseMap;
-
-    exportProofRangeAux(txn, depth, nodeId, 0, req.depthLimit, req.expandLeaves, currPath, Key::null(), Key::max(), items, reverseMap);
+    ProofBuilder builder;
 
-    Proof output;
+    auto span = exportProofRangeAux(txn, depth, node, req.depthLimit, req.expandLeaves, currPath, Key::null(), Key::max(), builder);
 
-    output.cmds = exportProofCmds(txn, items, reverseMap, nodeId, depth);
-
-    for (auto &item : items) {
-        output.strands.emplace_back(std::move(item.strand));
-    }
-
-    return output;
+    return builder.finish(span);
 }
 
 
@@ -285,8 +408,8 @@ BuiltNode importSyncResponses(lmdb::txn &txn, uint64_t nodeId, SyncRequests &req
     return importSyncResponsesAux(txn, nodeId, 0, fragItems.begin(), fragItems.end());
 }
 
-BuiltNode importSyncResponsesAux(lmdb::txn &txn, uint64_t nodeId, uint64_t depth, SyncRequestAndResponses::iterator begin, SyncRequestAndResponses::iterator end) {
-    ParsedNode origNode(this, txn, nodeId);
+BuiltNode importSyncResponsesAux(lmdb::txn &txn, uint64_t nodeId, uint64_t depth, SyncRequestAndResponses::iterator begin, SyncRequestAndResponses::iterator end, const ParsedNode *parent = nullptr) {
+    ParsedNode origNode(this, txn, nodeId, parent);
 
     if (begin != end && std::next(begin) == end && begin->req->startDepth == depth) {
         if (!origNode.isWitnessAny()) throw quaderr("import proof fragment tried to expand non-witness, ", nodeId);
@@ -302,23 +425,22 @@ BuiltNode importSyncResponsesAux(lmdb::txn &txn, uint64_t nodeId, uint64_t depth
     }
 
     if (origNode.isBranch()) {
-        auto middle = begin;
-        while (middle != end && !middle->req->path.getBit(depth)) ++middle;
+        auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.req->path; });
 
         assertDepth(depth);
 
         BuiltNode newLeftNode, newRightNode;
 
         if (origNode.leftNodeId || middle == end) {
-            newLeftNode = importSyncResponsesAux(txn, origNode.leftNodeId, depth + 1, begin, middle);
+            newLeftNode = importSyncResponsesAux(txn, origNode.leftNodeId, depth + 1, begin, middle, &origNode);
         } else {
-            newLeftNode = BuiltNode::reuse(ParsedNode(this, txn, origNode.leftNodeId));
+            newLeftNode = BuiltNode::reuse(ParsedNode(this, txn, origNode.leftNodeId, &origNode));
         }
 
         if (origNode.rightNodeId || begin == middle) {
-            newRightNode = importSyncResponsesAux(txn, origNode.rightNodeId, depth + 1, middle, end);
+            newRightNode = importSyncResponsesAux(txn, origNode.rightNodeId, depth + 1, middle, end, &origNode);
         } else {
-            newRightNode = BuiltNode::reuse(ParsedNode(this, txn, origNode.rightNodeId));
+            newRightNode = BuiltNode::reuse(ParsedNode(this, txn, origNode.rightNodeId, &origNode));
         }
 
         return BuiltNode::newBranch(this, txn, newLeftNode, newRightNode);
@@ -44,8 +44,8 @@ class UpdateSet {
         return *this;
     }
 
-    void apply(lmdb::txn &txn) {
-        db->apply(txn, this);
+    void apply(lmdb::txn &txn, ApplyStats *stats = nullptr) {
+        db->apply(txn, this, stats);
     }
 
   private:
@@ -70,11 +70,13 @@ UpdateSet change() {
 
 
 
-void apply(lmdb::txn &txn, UpdateSet *updatesOrig) {
-    apply(txn, *updatesOrig);
+void apply(lmdb::txn &txn, UpdateSet *updatesOrig, ApplyStats *stats = nullptr) {
+    apply(txn, *updatesOrig, stats);
 }
 
-void apply(lmdb::txn &txn, UpdateSet &updatesOrig) {
+// If stats is provided, the stats for this apply are added to it
+
+void apply(lmdb::txn &txn, UpdateSet &updatesOrig, ApplyStats *stats = nullptr) {
     // If exception is thrown, updatesOrig could be in inconsistent state, so ensure it's cleared by moving from it
     UpdateSet updates = std::move(updatesOrig);
 
@@ -84,10 +86,24 @@ void apply(lmdb::txn &txn, UpdateSet &updatesOrig) {
 
     uint64_t oldNodeId = getHeadNodeId(txn);
 
+    ApplyStats currStats;
+    ApplyStatsGuard g(this, stats ? &currStats : nullptr);
+    auto start = std::chrono::steady_clock::now();
+
     bool bubbleUp = false;
     auto newNode = putAux(txn, 0, oldNodeId, updates, updates.map.begin(), updates.map.end(), bubbleUp, false);
 
     if (newNode.nodeId != oldNodeId) setHeadNodeId(txn, newNode.nodeId);
+
+    if (stats) {
+        noteApplyChild(newNode.nodeId);
+        if (newNode.nodeId != oldNodeId) countOrphans(txn, oldNodeId);
+
+        currStats.applies = 1;
+        currStats.nodesReused = applyReferenced.size();
+        currStats.wallTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats->add(currStats);
+    }
 }
 
 
@@ -104,8 +120,142 @@ void del(lmdb::txn &txn, std::string_view key) {
 
 private:
 
-BuiltNode putAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, UpdateSet &updates, UpdateSetMap::iterator begin, UpdateSetMap::iterator end, bool &bubbleUp, bool deleteRightSide) {
+struct ApplyStatsGuard {
+    Quadrable *db;
+
+    ApplyStatsGuard(Quadrable *db_, ApplyStats *stats) : db(db_) {
+        db->applyStats = stats;
+    }
+
+    ~ApplyStatsGuard() {
+        db->applyStats = nullptr;
+        db->applyCreated.clear();
+        db->applyReferenced.clear();
+    }
+};
+
+// Accumulates into the ApplyStats field while in scope (if stats are being collected)
+
+struct ApplyTimer {
+    uint64_t *target = nullptr;
+    std::chrono::steady_clock::time_point start;
+
+    ApplyTimer(ApplyStats *stats, uint64_t ApplyStats::*field) {
+        if (!stats) return;
+        target = &(stats->*field);
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~ApplyTimer() {
+        if (target) *target += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+void noteApplyChild(uint64_t nodeId) {
+    if (nodeId && !applyCreated.count(nodeId)) applyReferenced.insert(nodeId);
+}
+
+// Nodes of the old tree that aren't (and don't have an ancestor) referenced by the new tree
+
+void countOrphans(lmdb::txn &txn, uint64_t nodeId) {
+    if (nodeId == 0 || applyReferenced.count(nodeId)) return;
+
     ParsedNode node(this, txn, nodeId);
+    applyStats->nodesOrphaned++;
+
+    if (node.isBranch()) {
+        countOrphans(txn, node.leftNodeId);
+        countOrphans(txn, node.rightNodeId);
+    }
+}
+
+// The rules for applying updates to a sub-tree that is a single leaf, shared by putAux() and ProofUpdater. leafRef
+// identifies the leaf in the caller's tree: It is reported as the outputNodeId when the leaf is deleted, and re-used
+// (as the nodeIdOverride) when the leaf is split.
+//   Unchanged: The updates don't affect this leaf
+//   Update:    The only update is a put for this leaf's key, at begin
+//   Delete:    The leaf was deleted, and bubbleUp is set
+//   Split:     The leaf must be split into a branch. Unless it was deleted, it has been added to the updates.
+
+enum class LeafUpdate { Unchanged, Update, Delete, Split };
+
+static LeafUpdate leafUpdateAction(UpdateSet &updates, UpdateSetMap::iterator &begin, UpdateSetMap::iterator end, const Key &leafKeyHash, uint64_t leafRef, bool &bubbleUp, bool &checkBubble) {
+    if (std::next(begin) == end && begin->first == leafKeyHash) {
+        // Update an existing record
+
+        if (begin->second.deletion) {
+            bubbleUp = true;
+            if (begin->second.outputNodeId) *begin->second.outputNodeId = leafRef;
+            return LeafUpdate::Delete;
+        }
+
+        return LeafUpdate::Update;
+    }
+
+    bool deleteThisLeaf = false;
+
+    updates.eraseRange(begin, end, [&](UpdateSetMap::iterator &u){
+        if (u->second.deletion) {
+            if (u->first == leafKeyHash) {
+                deleteThisLeaf = true;
+                if (u->second.outputNodeId) *u->second.outputNodeId = leafRef;
+            }
+            checkBubble = true; // so we check the status of this node after handling any changes further down (may require bubbling up)
+        }
+        return u->second.deletion;
+    });
+
+    if (begin == end) {
+        if (deleteThisLeaf) {
+            // The only update for this sub-tree was to delete this key
+            bubbleUp = true;
+            return LeafUpdate::Delete;
+        }
+        // All updates for this sub-tree were deletions for keys that don't exist, so do nothing.
+        return LeafUpdate::Unchanged;
+    }
+
+    // The leaf needs to get split into a branch, so add it into our update set to get added further down (unless it itself was deleted).
+
+    if (!deleteThisLeaf) {
+        // emplace() ensures that we don't overwrite any updates to this leaf already in the UpdateSet.
+        auto emplaceRes = updates.map.emplace(leafKeyHash, Update{"", "", false, nullptr, leafRef});
+
+        // If we did insert it, and it went before the start of our iterator window, back up our iterator to include it.
+        //   * This happens when the leaf we are splitting is to the left of the leaf we are adding.
+        //   * It's not necessary to do this for the right side since the end iterator will always point *past* any right-side nodes.
+        if (emplaceRes.second && emplaceRes.first->first < begin->first) begin = emplaceRes.first;
+    }
+
+    return LeafUpdate::Split;
+}
+
+// After deletions beneath a branch, whether it must be replaced by an empty node or by one of its children. Shared by
+// putAux() and ProofUpdater.
+
+enum class Bubble { None, Empty, Left, Right };
+
+static Bubble bubbleAction(NodeType leftType, NodeType rightType) {
+    auto isLeaf = [](NodeType t){ return t == NodeType::Leaf || t == NodeType::WitnessLeaf; };
+    bool leftEmpty = leftType == NodeType::Empty, rightEmpty = rightType == NodeType::Empty;
+
+    if ((leftType == NodeType::Witness && rightEmpty) || (leftEmpty && rightType == NodeType::Witness)) {
+        // We don't know if the witness is a branch (bubbling stops) or a leaf (must bubble up)
+        throw quaderr("can't bubble a witness node");
+    } else if (leftEmpty && rightEmpty) {
+        return Bubble::Empty;
+    } else if (isLeaf(leftType) && rightEmpty) {
+        return Bubble::Left;
+    } else if (leftEmpty && isLeaf(rightType)) {
+        return Bubble::Right;
+    }
+
+    // One of the nodes is a branch, or both are leaves, so bubbling can stop
+    return Bubble::None;
+}
+
+BuiltNode putAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, UpdateSet &updates, UpdateSetMap::iterator begin, UpdateSetMap::iterator end, bool &bubbleUp, bool deleteRightSide, const ParsedNode *parent = nullptr) {
+    ParsedNode node(this, txn, nodeId, parent);
     bool checkBubble = false;
 
     // recursion base cases
@@ -130,15 +280,13 @@ BuiltNode putAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, UpdateSet &upd
             return b;
         }
     } else if (node.isLeaf()) {
-        if (std::next(begin) == end && begin->first == node.leafKeyHash()) {
-            // Update an existing record
-
-            if (begin->second.deletion) {
-                bubbleUp = true;
-                if (begin->second.outputNodeId) *begin->second.outputNodeId = node.nodeId;
-                return BuiltNode::empty();
-            }
+        auto action = leafUpdateAction(updates, begin, end, Key::existing(node.leafKeyHash()), node.nodeId, bubbleUp, checkBubble);
 
+        if (action == LeafUpdate::Delete) {
+            return BuiltNode::empty();
+        } else if (action == LeafUpdate::Unchanged) {
+            return BuiltNode::reuse(node);
+        } else if (action == LeafUpdate::Update) {
             if (deleteRightSide || (node.nodeType == NodeType::Leaf && begin->second.val == node.leafVal())) {
                 // No change to this leaf, so do nothing. Don't do this for WitnessLeaf nodes, since we need to upgrade them to leaves.
                 return BuiltNode::reuse(node);
@@ -148,82 +296,39 @@ BuiltNode putAux(lmdb::txn &txn, uint64_t depth, uint64_t nodeId, UpdateSet &upd
             if (begin->second.outputNodeId) *begin->second.outputNodeId = b.nodeId;
             return b;
         }
-
-        bool deleteThisLeaf = false;
-
-        updates.eraseRange(begin, end, [&](UpdateSetMap::iterator &u){
-            if (u->second.deletion) {
-                if (u->first == node.leafKeyHash()) {
-                    deleteThisLeaf = true;
-                    if (u->second.outputNodeId) *u->second.outputNodeId = node.nodeId;
-                }
-                checkBubble = true; // so we check the status of this node after handling any changes further down (may require bubbling up)
-            }
-            return u->second.deletion;
-        });
-
-        if (begin == end) {
-            if (deleteThisLeaf) {
-                // The only update for this sub-tree was to delete this key
-                bubbleUp = true;
-                return BuiltNode::empty();
-            }
-            // All updates for this sub-tree were deletions for keys that don't exist, so do nothing.
-            return BuiltNode::reuse(node);
-        }
-
-        // The leaf needs to get split into a branch, so add it into our update set to get added further down (unless it itself was deleted).
-
-        if (!deleteThisLeaf) {
-            // emplace() ensures that we don't overwrite any updates to this leaf already in the UpdateSet.
-            auto emplaceRes = updates.map.emplace(Key::existing(node.leafKeyHash()), Update{"", "", false, nullptr, node.nodeId});
-
-            // If we did insert it, and it went before the start of our iterator window, back up our iterator to include it.
-            //   * This happens when the leaf we are splitting is to the left of the leaf we are adding.
-            //   * It's not necessary to do this for the right side since the end iterator will always point *past* any right-side nodes.
-            if (emplaceRes.second && emplaceRes.first->first < begin->first) begin = emplaceRes.first;
-        }
     }
 
 
     // Split into left and right groups of keys
 
-    auto middle = begin;
-    while (middle != end && !middle->first.getBit(depth)) ++middle;
+    auto middle = partitionByBit(begin, end, depth, [](const auto &e) -> const Key & { return e.first; });
 
 
     // Recurse
 
     assertDepth(depth);
 
-    auto leftNode = putAux(txn, depth+1, node.leftNodeId, updates, begin, middle, checkBubble, deleteRightSide);
+    auto leftNode = putAux(txn, depth+1, node.leftNodeId, updates, begin, middle, checkBubble, deleteRightSide, &node);
     auto rightNode = [&]{
         if (deleteRightSide && middle == end) {
             checkBubble = true;
             return BuiltNode::empty();
         }
 
-        return putAux(txn, depth+1, node.rightNodeId, updates, middle, end, checkBubble, deleteRightSide);
+        return putAux(txn, depth+1, node.rightNodeId, updates, middle, end, checkBubble, deleteRightSide, &node);
     }();
 
     if (checkBubble) {
-        if (leftNode.nodeType == NodeType::Witness || rightNode.nodeType == NodeType::Witness) {
-            // We don't know if one of the nodes is a branch or a leaf
-            throw quaderr("can't bubble a witness node");
-        } else if (leftNode.isEmpty() && rightNode.isEmpty()) {
+        auto action = bubbleAction(leftNode.nodeType, rightNode.nodeType);
+
+        if (action == Bubble::Empty) {
             bubbleUp = true;
             return BuiltNode::empty();
-        } else if (leftNode.isLeaf() && rightNode.isEmpty()) {
-            bubbleUp = true;
-            ParsedNode n(this, txn, leftNode.nodeId);
-            return BuiltNode::reuse(n);
-        } else if (leftNode.isEmpty() && rightNode.isLeaf()) {
+        } else if (action != Bubble::None) {
             bubbleUp = true;
-            ParsedNode n(this, txn, rightNode.nodeId);
+            ParsedNode n(this, txn, action == Bubble::Left ? leftNode.nodeId : rightNode.nodeId);
             return BuiltNode::reuse(n);
         }
-
-        // One of the nodes is a branch, or both are leaves, so bubbling can stop
     }
 
     return BuiltNode::newBranch(this, txn, leftNode, rightNode);
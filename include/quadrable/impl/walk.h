@@ -2,17 +2,17 @@ public:
 
 void walkTree(lmdb::txn &txn, std::function<bool(ParsedNode &, uint64_t)> cb) {
     auto nodeId = getHeadNodeId(txn);
-    walkTreeAux(txn, cb, nodeId, 0);
+    walkTreeAux(txn, cb, nodeId, 0, nullptr);
 }
 
 void walkTree(lmdb::txn &txn, uint64_t nodeId, std::function<bool(ParsedNode &, uint64_t)> cb) {
-    walkTreeAux(txn, cb, nodeId, 0);
+    walkTreeAux(txn, cb, nodeId, 0, nullptr);
 }
 
 private:
 
-void walkTreeAux(lmdb::txn &txn, std::function<bool(ParsedNode &, uint64_t)> cb, uint64_t nodeId, uint64_t depth) {
-    ParsedNode node(this, txn, nodeId);
+void walkTreeAux(lmdb::txn &txn, std::function<bool(ParsedNode &, uint64_t)> cb, uint64_t nodeId, uint64_t depth, const ParsedNode *parent) {
+    ParsedNode node(this, txn, nodeId, parent);
 
     if (node.isEmpty()) return;
 
@@ -21,7 +21,7 @@ void walkTreeAux(lmdb::txn &txn, std::function<bool(ParsedNode &, uint64_t)> cb,
     if (node.isBranch()) {
         assertDepth(depth);
 
-        walkTreeAux(txn, cb, node.leftNodeId, depth+1);
-        walkTreeAux(txn, cb, node.rightNodeId, depth+1);
+        walkTreeAux(txn, cb, node.leftNodeId, depth+1, &node);
+        walkTreeAux(txn, cb, node.rightNodeId, depth+1, &node);
     }
 }
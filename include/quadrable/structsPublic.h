@@ -13,6 +13,10 @@ enum class NodeType {
     Leaf = 4,
     Witness = 5,
     WitnessLeaf = 6,
+    Chain = 7, // never visible in a ParsedNode: each level is presented as a BranchLeft/BranchRight
+    InlineBranch = 8, // never visible in a ParsedNode: presented as a branch, and its inlined leaves as Leaf nodes
+    Page = 9, // never visible in a ParsedNode: each branch within the page is presented as a regular branch
+    CompactLeaf = 10, // a Leaf without the stored nodeHash: presented as a Leaf
     Invalid = 15,
 };
 
@@ -73,24 +77,162 @@ struct Proof {
 
 
 
+// Collected by apply() when an ApplyStats is passed in. Only nodes written by the apply are counted as created
+// (not de-duplicated ones), and "orphaned" nodes are those of the previous tree that are no longer reachable from
+// the new one. They may still be referenced by other heads, so they aren't necessarily garbage.
+
+struct ApplyStats {
+    uint64_t applies = 0;
+    uint64_t leavesCreated = 0;
+    uint64_t branchesCreated = 0;
+    uint64_t otherCreated = 0; // witnesses
+    uint64_t bytesWritten = 0;
+    uint64_t nodesReused = 0; // existing sub-trees referenced by the new tree
+    uint64_t nodesOrphaned = 0;
+    uint64_t hashes = 0;
+    uint64_t hashTimeNs = 0;
+    uint64_t storeTimeNs = 0; // reading and writing nodes
+    uint64_t wallTimeNs = 0;
+
+    void add(const ApplyStats &o) {
+        applies += o.applies;
+        leavesCreated += o.leavesCreated;
+        branchesCreated += o.branchesCreated;
+        otherCreated += o.otherCreated;
+        bytesWritten += o.bytesWritten;
+        nodesReused += o.nodesReused;
+        nodesOrphaned += o.nodesOrphaned;
+        hashes += o.hashes;
+        hashTimeNs += o.hashTimeNs;
+        storeTimeNs += o.storeTimeNs;
+        wallTimeNs += o.wallTimeNs;
+    }
+};
+
+
+
 struct SyncRequest {
     Key path;
     uint64_t startDepth;
     uint64_t depthLimit;
     bool expandLeaves;
+    bool fullKeys = false; // response should be encoded with FullKeys
 };
 
 using SyncRequests = std::vector<SyncRequest>;
 using SyncResponses = std::vector<Proof>;
 
+struct SyncPhaseMetrics {
+    uint64_t calls = 0;
+    uint64_t nodesRead = 0; // from LMDB, MemStore nodes not included
+    uint64_t nodesWritten = 0;
+    uint64_t wallTimeUs = 0;
+};
+
+struct SyncMetrics {
+    uint64_t roundTrips = 0;
+    uint64_t requests = 0;
+    uint64_t fragments = 0;
+    uint64_t strands = 0;
+    uint64_t hashCmds = 0; // HashProvided cmds: each one costs 32 bytes on the wire
+    uint64_t reqBytes = 0; // as encoded by transport::encodeSyncRequests()
+    uint64_t respBytesEstimate = 0;
+    uint64_t witnessesRemaining = 0; // unresolved witnesses in the shadow tree at the latest getReqs() (only if Sync::countWitnesses)
+
+    SyncPhaseMetrics reconcile; // Sync::getReqs()
+    SyncPhaseMetrics import; // Sync::addResps()
+    SyncPhaseMetrics handle; // handleSyncRequests()
+};
+
+
+
+struct ReconcileResponse {
+    Key root;
+    IBLT iblt;
+};
+
 
 
 const uint64_t firstInteriorNodeId = 288230376151711744ULL; // 2**58
 const uint64_t firstMemStoreNodeId = 576460752303423488ULL; // 2**59
 
+// Levels inside a Chain record are addressed with "virtual" nodeIds: The record's nodeId plus the level in these bits
+const uint64_t chainOffsetShift = 50;
+const uint64_t chainOffsetMask = 0xFFULL << chainOffsetShift;
+const uint64_t maxChainLength = 56;
+
+// Leaves inlined into an InlineBranch record are addressed the same way, with the side in place of the level
+const uint64_t inlineLeftOffset = 1ULL << chainOffsetShift;
+const uint64_t inlineRightOffset = 2ULL << chainOffsetShift;
+
+// ... and branches inside a Page record with their position in the page (root is 0, children of p are 2p+1 and 2p+2)
+const uint64_t maxPageLevels = 8;
+
+// MemStore nodeIds are allocated densely starting at firstMemStoreNodeId, so nodes are located with a vector
+// indexed by (nodeId - firstMemStoreNodeId). Records are copied into a bump-allocated arena of chunks that
+// never move, and are only freed all at once (when the MemStore is cleared or destroyed).
+
 struct MemStore {
-    std::map<uint64_t, std::string> nodes;
+    static const size_t chunkSize = 64 * 1024;
+
     uint64_t headNodeId = 0;
+
+    bool get(uint64_t nodeId, std::string_view &output) const {
+        uint64_t index = nodeId - firstMemStoreNodeId;
+        if (nodeId < firstMemStoreNodeId || index >= nodes.size()) return false;
+        output = nodes[index];
+        return true;
+    }
+
+    uint64_t add(std::string_view nodeRaw) {
+        char *p = alloc(nodeRaw.size());
+        memcpy(p, nodeRaw.data(), nodeRaw.size());
+        nodes.emplace_back(p, nodeRaw.size());
+        return firstMemStoreNodeId + nodes.size() - 1;
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    size_t bytesAllocated() const {
+        return allocated;
+    }
+
+    void clear() {
+        nodes.clear();
+        chunks.clear();
+        largeRecords.clear();
+        chunkUsed = chunkSize;
+        allocated = 0;
+        headNodeId = 0;
+    }
+
+  private:
+    std::vector<std::string_view> nodes;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<std::unique_ptr<char[]>> largeRecords;
+    size_t chunkUsed = chunkSize;
+    size_t allocated = 0;
+
+    char *alloc(size_t size) {
+        if (size > chunkSize / 4) {
+            // Large records get their own allocation, so as not to waste the rest of the current chunk
+            largeRecords.emplace_back(new char[size]);
+            allocated += size;
+            return largeRecords.back().get();
+        }
+
+        if (chunkUsed + size > chunkSize) {
+            chunks.emplace_back(new char[chunkSize]);
+            allocated += chunkSize;
+            chunkUsed = 0;
+        }
+
+        char *p = chunks.back().get() + chunkUsed;
+        chunkUsed += size;
+        return p;
+    }
 };
 
 
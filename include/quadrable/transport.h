@@ -7,15 +7,21 @@
 
 namespace quadrable { namespace transport {
 
-inline std::string encodeKeyHash(std::string_view keyHash) {
-    std::string o;
-
-    uint64_t numTrailingZeros = 0;
+inline uint64_t numTrailingZeros(std::string_view keyHash) {
+    uint64_t output = 0;
     for (int i = 31; i >= 0; i--) {
         if (keyHash[static_cast<size_t>(i)] != '\0') break;
-        numTrailingZeros++;
+        output++;
     }
 
+    return output;
+}
+
+inline std::string encodeKeyHash(std::string_view keyHash) {
+    std::string o;
+
+    uint64_t numTrailingZeros = transport::numTrailingZeros(keyHash);
+
     o += static_cast<unsigned char>(numTrailingZeros);
     o += keyHash.substr(0, 32 - numTrailingZeros);
 
@@ -42,21 +48,33 @@ inline std::string getKeyHash(std::string_view &encoded){
 };
 
 
+inline std::string encodeZigZag(int64_t n) {
+    return encodeVarInt((static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63));
+}
+
+inline int64_t decodeZigZag(std::string_view &encoded) {
+    uint64_t n = decodeVarInt(encoded);
+    return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+}
+
+
 enum class EncodingType {
     HashedKeys = 0,
     FullKeys = 1,
+    CompactHashedKeys = 2,
+    CompactFullKeys = 3,
 };
 
+inline bool isFullKeys(EncodingType encodingType) {
+    return encodingType == EncodingType::FullKeys || encodingType == EncodingType::CompactFullKeys;
+}
 
-inline std::string encodeProof(const Proof &p, EncodingType encodingType = EncodingType::HashedKeys) {
-    std::string o;
-
-    // Encoding type
-
-    o += static_cast<unsigned char>(encodingType);
+inline bool isCompact(EncodingType encodingType) {
+    return encodingType == EncodingType::CompactHashedKeys || encodingType == EncodingType::CompactFullKeys;
+}
 
-    // Strands
 
+inline void encodeProofStrands(std::string &o, const Proof &p, EncodingType encodingType) {
     for (auto &strand : p.strands) {
         o += static_cast<unsigned char>(strand.strandType);
         o += static_cast<unsigned char>(strand.depth);
@@ -86,10 +104,69 @@ inline std::string encodeProof(const Proof &p, EncodingType encodingType = Encod
     }
 
     o += static_cast<unsigned char>(ProofStrand::Type::Invalid); // end of strand list
+}
 
-    // Cmds
+// Column-wise layout: all the types, then all the depths, then all the keys, then all the values.
+// Sorted strands share long keyHash prefixes and have similar depths, so this is both smaller and more
+// compressible than the row-wise layout.
+
+inline void encodeProofStrandsCompact(std::string &o, const Proof &p, EncodingType encodingType) {
+    o += encodeVarInt(p.strands.size());
+
+    for (size_t i = 0; i < p.strands.size(); i += 2) {
+        unsigned char b = static_cast<unsigned char>(p.strands[i].strandType);
+        if (i + 1 < p.strands.size()) b |= static_cast<unsigned char>(p.strands[i + 1].strandType) << 4;
+        o += b;
+    }
+
+    uint64_t prevDepth = 0;
+
+    for (auto &strand : p.strands) {
+        if (strand.depth > 255) throw quaderr("strand depth too big");
+        o += encodeZigZag(static_cast<int64_t>(strand.depth) - static_cast<int64_t>(prevDepth));
+        prevDepth = strand.depth;
+    }
+
+    std::string prevKeyHash(32, '\0');
+
+    for (auto &strand : p.strands) {
+        if (strand.strandType == ProofStrand::Type::Leaf && encodingType == EncodingType::CompactFullKeys) {
+            if (strand.key.size() == 0) throw quaderr("FullKeys specified in proof encoding, but key not available");
+            o += encodeVarInt(strand.key.size());
+            o += strand.key;
+        } else {
+            if (strand.keyHash.size() != 32) throw quaderr("unexpected keyHash size when encoding proof");
+
+            size_t sharedPrefix = 0;
+            while (sharedPrefix < 32 && strand.keyHash[sharedPrefix] == prevKeyHash[sharedPrefix]) sharedPrefix++;
+
+            size_t trailingZeros = 0;
+            while (sharedPrefix + trailingZeros < 32 && strand.keyHash[31 - trailingZeros] == '\0') trailingZeros++;
+
+            // [6 bits shared prefix bytes][1 bit trailing zero count follows]
+            o += static_cast<unsigned char>(sharedPrefix | (trailingZeros ? 0b0100'0000 : 0));
+            if (trailingZeros) o += static_cast<unsigned char>(trailingZeros);
+            o += strand.keyHash.substr(sharedPrefix, 32 - sharedPrefix - trailingZeros);
+        }
+
+        prevKeyHash = strand.strandType == ProofStrand::Type::Leaf && encodingType == EncodingType::CompactFullKeys ? Key::hash(strand.key).str() : strand.keyHash;
+    }
+
+    for (auto &strand : p.strands) {
+        if (strand.strandType == ProofStrand::Type::Leaf) {
+            o += encodeVarInt(strand.val.size());
+            o += strand.val;
+        } else if (strand.strandType == ProofStrand::Type::WitnessLeaf || strand.strandType == ProofStrand::Type::Witness) {
+            if (strand.val.size() != 32) throw quaderr("unexpected hash size when encoding proof");
+            o += strand.val; // holds valHash or nodeHash
+        } else if (strand.strandType != ProofStrand::Type::WitnessEmpty) {
+            throw quaderr("unrecognized ProofStrand::Type when encoding proof: ", (int)strand.strandType);
+        }
+    }
+}
 
-    if (p.strands.size() == 0) return o;
+inline void encodeProofCmds(std::string &o, const Proof &p) {
+    if (p.strands.size() == 0) return;
 
     uint64_t currPos = p.strands.size() - 1; // starts at end
     std::vector<ProofCmd> hashQueue;
@@ -155,24 +232,29 @@ inline std::string encodeProof(const Proof &p, EncodingType encodingType = Encod
     }
 
     flushHashQueue();
-
-    return o;
 }
 
-
-inline Proof decodeProof(std::string_view encoded) {
-    Proof proof;
+inline std::string encodeProof(const Proof &p, EncodingType encodingType = EncodingType::HashedKeys) {
+    std::string o;
 
     // Encoding type
 
-    auto encodingType = static_cast<EncodingType>(getByte(encoded));
-
-    if (encodingType != EncodingType::HashedKeys && encodingType != EncodingType::FullKeys) {
-        throw quaderr("unexpected proof encoding type: ", (int)encodingType);
-    }
+    o += static_cast<unsigned char>(encodingType);
 
     // Strands
 
+    if (isCompact(encodingType)) encodeProofStrandsCompact(o, p, encodingType);
+    else encodeProofStrands(o, p, encodingType);
+
+    // Cmds
+
+    encodeProofCmds(o, p);
+
+    return o;
+}
+
+
+inline void decodeProofStrands(std::string_view &encoded, Proof &proof, EncodingType encodingType) {
     while (1) {
         auto strandType = static_cast<ProofStrand::Type>(getByte(encoded));
 
@@ -207,10 +289,61 @@ inline Proof decodeProof(std::string_view encoded) {
 
         proof.strands.emplace_back(std::move(strand));
     }
+}
 
-    // Cmds
+inline void decodeProofStrandsCompact(std::string_view &encoded, Proof &proof, EncodingType encodingType) {
+    auto numStrands = decodeVarInt(encoded);
+    if (numStrands > encoded.size() * 2) throw quaderr("proof ends prematurely");
+
+    proof.strands.resize(numStrands);
+
+    for (size_t i = 0; i < numStrands; i += 2) {
+        auto b = getByte(encoded);
+        proof.strands[i].strandType = static_cast<ProofStrand::Type>(b & 0x0F);
+        if (i + 1 < numStrands) proof.strands[i + 1].strandType = static_cast<ProofStrand::Type>(b >> 4);
+    }
+
+    int64_t depth = 0;
+
+    for (auto &strand : proof.strands) {
+        depth += decodeZigZag(encoded);
+        if (depth < 0 || depth > 255) throw quaderr("invalid strand depth when decoding proof");
+        strand.depth = static_cast<uint64_t>(depth);
+    }
+
+    std::string prevKeyHash(32, '\0');
 
-    if (proof.strands.size() == 0) return proof;
+    for (auto &strand : proof.strands) {
+        if (strand.strandType == ProofStrand::Type::Leaf && encodingType == EncodingType::CompactFullKeys) {
+            auto keySize = decodeVarInt(encoded);
+            strand.key = getBytes(encoded, keySize);
+            strand.keyHash = Key::hash(strand.key).str();
+        } else {
+            auto b = getByte(encoded);
+            size_t sharedPrefix = b & 0b0011'1111;
+            size_t trailingZeros = (b & 0b0100'0000) ? getByte(encoded) : 0;
+            if (sharedPrefix + trailingZeros > 32) throw quaderr("invalid keyHash compression when decoding proof");
+
+            strand.keyHash = prevKeyHash.substr(0, sharedPrefix) + getBytes(encoded, 32 - sharedPrefix - trailingZeros) + std::string(trailingZeros, '\0');
+        }
+
+        prevKeyHash = strand.keyHash;
+    }
+
+    for (auto &strand : proof.strands) {
+        if (strand.strandType == ProofStrand::Type::Leaf) {
+            auto valSize = decodeVarInt(encoded);
+            strand.val = getBytes(encoded, valSize);
+        } else if (strand.strandType == ProofStrand::Type::WitnessLeaf || strand.strandType == ProofStrand::Type::Witness) {
+            strand.val = getBytes(encoded, 32); // holds valHash or nodeHash
+        } else if (strand.strandType != ProofStrand::Type::WitnessEmpty) {
+            throw quaderr("unrecognized ProofStrand::Type when decoding proof: ", (int)strand.strandType);
+        }
+    }
+}
+
+inline void decodeProofCmds(std::string_view &encoded, Proof &proof) {
+    if (proof.strands.size() == 0) return;
 
     uint64_t currPos = proof.strands.size() - 1; // starts at end
 
@@ -254,11 +387,38 @@ inline Proof decodeProof(std::string_view encoded) {
             }
         }
     }
+}
+
+inline Proof decodeProof(std::string_view encoded) {
+    Proof proof;
+
+    // Encoding type
+
+    auto encodingType = static_cast<EncodingType>(getByte(encoded));
+
+    if (encodingType != EncodingType::HashedKeys && encodingType != EncodingType::FullKeys && !isCompact(encodingType)) {
+        throw quaderr("unexpected proof encoding type: ", (int)encodingType);
+    }
+
+    // Strands
+
+    if (isCompact(encodingType)) decodeProofStrandsCompact(encoded, proof, encodingType);
+    else decodeProofStrands(encoded, proof, encodingType);
+
+    // Cmds
+
+    decodeProofCmds(encoded, proof);
 
     return proof;
 }
 
 
+// Size of a request as encoded by encodeSyncRequests(), without encoding it
+
+inline uint64_t encodedSizeSyncRequest(const SyncRequest &req) {
+    return 1 + (32 - numTrailingZeros(req.path.sv())) + 3; // path, startDepth, depthLimit, flags
+}
+
 inline std::string encodeSyncRequests(const SyncRequests &reqs) {
     std::string o;
 
@@ -268,7 +428,7 @@ inline std::string encodeSyncRequests(const SyncRequests &reqs) {
         o += static_cast<unsigned char>(req.startDepth);
         if (req.depthLimit > 255) throw quaderr("depthLimit too big");
         o += static_cast<unsigned char>(req.depthLimit);
-        o += static_cast<unsigned char>(req.expandLeaves ? 1 : 0); // 7 bits unused, available for future extensions
+        o += static_cast<unsigned char>((req.expandLeaves ? 1 : 0) | (req.fullKeys ? 2 : 0)); // 6 bits unused, available for future extensions
     }
 
     return o;
@@ -283,7 +443,9 @@ inline SyncRequests decodeSyncRequests(std::string_view encoded) {
         req.path = Key::existing(getKeyHash(encoded));
         req.startDepth = getByte(encoded);
         req.depthLimit = getByte(encoded);
-        req.expandLeaves = getByte(encoded) & 1;
+        auto flags = getByte(encoded);
+        req.expandLeaves = flags & 1;
+        req.fullKeys = flags & 2;
 
         reqs.emplace_back(req);
     }
@@ -295,7 +457,30 @@ inline std::string encodeSyncResponses(const SyncResponses &resps, EncodingType
     std::string o;
 
     for (const auto &resp : resps) {
-        std::string proof = encodeProof(resp);
+        std::string proof = encodeProof(resp, encodingType);
+        o += encodeVarInt(proof.size());
+        o += proof;
+    }
+
+    return o;
+}
+
+// Uses FullKeys for the responses to requests that asked for them (each proof records its own encoding type)
+
+inline std::string encodeSyncResponses(const SyncRequests &reqs, const SyncResponses &resps, EncodingType encodingType = EncodingType::HashedKeys) {
+    std::string o;
+
+    if (resps.size() > reqs.size()) throw quaderr("more sync responses than requests");
+
+    for (size_t i = 0; i < resps.size(); i++) {
+        auto respEncodingType = encodingType;
+
+        if (reqs[i].fullKeys) {
+            if (encodingType == EncodingType::HashedKeys) respEncodingType = EncodingType::FullKeys;
+            else if (encodingType == EncodingType::CompactHashedKeys) respEncodingType = EncodingType::CompactFullKeys;
+        }
+
+        std::string proof = encodeProof(resps[i], respEncodingType);
         o += encodeVarInt(proof.size());
         o += proof;
     }
@@ -314,4 +499,118 @@ inline SyncResponses decodeSyncResponses(std::string_view encoded) {
     return resps;
 }
 
+
+// Set-reconciliation
+
+inline std::string encodeWord(uint64_t n) {
+    std::string o;
+    for (int i = 0; i < 8; i++) o += static_cast<unsigned char>((n >> (i * 8)) & 0xFF);
+    return o;
+}
+
+inline uint64_t getWord(std::string_view &encoded) {
+    auto b = getBytes(encoded, 8);
+    uint64_t n = 0;
+    for (int i = 7; i >= 0; i--) n = (n << 8) | static_cast<unsigned char>(b[static_cast<size_t>(i)]);
+    return n;
+}
+
+inline std::string encodeStrataEstimator(const StrataEstimator &se) {
+    std::string o;
+
+    for (const auto &c : se.cells) {
+        if (c.isEmpty()) {
+            o += '\0'; // most cells in the higher strata are empty
+            continue;
+        }
+
+        o += '\x01';
+        o += encodeZigZag(c.count);
+        o += encodeWord(c.idSum);
+        o += encodeWord(c.checkSum);
+    }
+
+    return o;
+}
+
+inline StrataEstimator decodeStrataEstimator(std::string_view encoded) {
+    StrataEstimator se;
+
+    for (auto &c : se.cells) {
+        if (getByte(encoded) == 0) continue;
+
+        c.count = decodeZigZag(encoded);
+        c.idSum = getWord(encoded);
+        c.checkSum = getWord(encoded);
+    }
+
+    if (encoded.size()) throw quaderr("trailing bytes after StrataEstimator");
+
+    return se;
+}
+
+inline std::string encodeReconcileResponse(const ReconcileResponse &resp) {
+    std::string o;
+
+    o += resp.root.sv();
+    o += encodeVarInt(resp.iblt.subtableSize());
+
+    for (const auto &c : resp.iblt.cells) {
+        if (c.isEmpty()) {
+            o += '\0';
+            continue;
+        }
+
+        o += '\x01';
+        o += encodeZigZag(c.count);
+        o += c.keyHashSum.sv();
+        o += c.nodeHashSum.sv();
+        o += encodeWord(c.checkSum);
+    }
+
+    return o;
+}
+
+inline ReconcileResponse decodeReconcileResponse(std::string_view encoded) {
+    auto root = Key::existing(getBytes(encoded, 32));
+
+    auto subtableSize = decodeVarInt(encoded);
+    if (subtableSize > encoded.size()) throw quaderr("IBLT too large for encoded size");
+
+    ReconcileResponse resp{ root, IBLT(subtableSize) };
+
+    for (auto &c : resp.iblt.cells) {
+        if (getByte(encoded) == 0) continue;
+
+        c.count = decodeZigZag(encoded);
+        c.keyHashSum = Key::existing(getBytes(encoded, 32));
+        c.nodeHashSum = Key::existing(getBytes(encoded, 32));
+        c.checkSum = getWord(encoded);
+    }
+
+    if (encoded.size()) throw quaderr("trailing bytes after ReconcileResponse");
+
+    return resp;
+}
+
+inline std::string encodeReconcileKeys(const std::vector<Key> &keyHashes) {
+    std::string o;
+
+    for (const auto &keyHash : keyHashes) {
+        o += keyHash.sv();
+    }
+
+    return o;
+}
+
+inline std::vector<Key> decodeReconcileKeys(std::string_view encoded) {
+    std::vector<Key> keyHashes;
+
+    while (encoded.size()) {
+        keyHashes.emplace_back(Key::existing(getBytes(encoded, 32)));
+    }
+
+    return keyHashes;
+}
+
 }}
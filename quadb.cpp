@@ -36,10 +36,14 @@ R"(
       quadb [options] patch [--sep=<sep>]
       quadb [options] head
       quadb [options] head rm [<head>]
-      quadb [options] checkout [<head>]
+      quadb [options] checkout [<head>] [--version=<version>]
       quadb [options] fork [<head>] [--from=<from>]
+      quadb [options] history prune [--keep=<n>] [--seconds=<seconds>]
+      quadb [options] history [<head>]
       quadb [options] gc
-      quadb [options] exportProof [--format=(HashedKeys|FullKeys)] [--hex] [--dump] [--int] [--stdin] [--] [<keys>...]
+      quadb [options] compact [--inline=<maxValSize>] [--pages=<levels>]
+      quadb [options] dedup
+      quadb [options] exportProof [--format=(HashedKeys|FullKeys|CompactHashedKeys|CompactFullKeys)] [--hex] [--dump] [--int] [--stdin] [--deletable] [--] [<keys>...]
       quadb [options] importProof [--root=<root>] [--hex] [--dump]
       quadb [options] mergeProof [--hex]
       quadb [options] dumpTree
@@ -48,6 +52,8 @@ R"(
     Options:
       --db=<dir>     Database directory (default $ENV{QUADB_DIR} || "./quadb-dir/")
       --noTrackKeys  Don't store keys in DB (default $ENV{QUADB_NOTRACKKEYS} || false)
+      --dedup        Re-use identical nodes when writing (default $ENV{QUADB_DEDUP} || false)
+      --history      Record every version of heads (default $ENV{QUADB_HISTORY} || false)
       --int          Keys are in integer format
       -h --help      Show this screen.
       --version      Show version.
@@ -73,6 +79,34 @@ static std::string slurpStdin() {
 }
 
 
+static std::vector<uint64_t quadrable::ApplyStats::*> applyStatsFields = {
+    &quadrable::ApplyStats::applies,
+    &quadrable::ApplyStats::leavesCreated,
+    &quadrable::ApplyStats::branchesCreated,
+    &quadrable::ApplyStats::otherCreated,
+    &quadrable::ApplyStats::bytesWritten,
+    &quadrable::ApplyStats::nodesReused,
+    &quadrable::ApplyStats::nodesOrphaned,
+    &quadrable::ApplyStats::hashes,
+    &quadrable::ApplyStats::hashTimeNs,
+    &quadrable::ApplyStats::storeTimeNs,
+    &quadrable::ApplyStats::wallTimeNs,
+};
+
+static std::string encodeApplyStats(const quadrable::ApplyStats &stats) {
+    std::string o;
+    for (auto field : applyStatsFields) o += quadrable::encodeVarInt(stats.*field);
+    return o;
+}
+
+static quadrable::ApplyStats decodeApplyStats(std::string_view encoded) {
+    quadrable::ApplyStats stats;
+    for (auto field : applyStatsFields) stats.*field = quadrable::decodeVarInt(encoded);
+    return stats;
+}
+
+
+
 void run(int argc, char **argv) {
     std::map<std::string, docopt::value> args = docopt::docopt(USAGE, { argv + 1, argv + argc }, true, "quadb " QUADRABLE_VERSION);
 
@@ -132,6 +166,8 @@ void run(int argc, char **argv) {
     quadrable::Quadrable db;
 
     db.trackKeys = !noTrackKeys;
+    db.dedupNodes = args["--dedup"].asBool() || getenv("QUADB_DEDUP") || args["dedup"].asBool();
+    db.keepHeadHistory = args["--history"].asBool() || getenv("QUADB_HISTORY");
 
 
 
@@ -140,6 +176,8 @@ void run(int argc, char **argv) {
     db.init(txn);
     lmdb::dbi dbi_quadb_state = lmdb::dbi::open(txn, "quadrable_quadb_state", MDB_CREATE);
 
+    quadrable::ApplyStats applyStats; // added to the totals in quadb_state on commit
+
 
 
     {
@@ -168,7 +206,7 @@ void run(int argc, char **argv) {
 
         changes.put(k, v);
 
-        changes.apply(txn);
+        changes.apply(txn, &applyStats);
     } else if (args["del"].asBool()) {
         std::string k = args["<key>"].asString();
 
@@ -176,7 +214,7 @@ void run(int argc, char **argv) {
 
         changes.del(k);
 
-        changes.apply(txn);
+        changes.apply(txn, &applyStats);
     } else if (args["get"].asBool()) {
         std::string k = args["<key>"].asString();
         std::string_view v;
@@ -193,11 +231,13 @@ void run(int argc, char **argv) {
         if (args["rm"].asBool()) {
             if (args["<head>"]) {
                 db.dbi_head.del(txn, args["<head>"].asString());
+                db.deleteHeadHistory(txn, args["<head>"].asString());
             } else {
                 if (isDetachedHead) {
                     db.checkout();
                 } else {
                     db.dbi_head.del(txn, currHead);
+                    db.deleteHeadHistory(txn, currHead);
                 }
             }
         } else {
@@ -275,9 +315,13 @@ void run(int argc, char **argv) {
             else changes.put(k, v);
         }
 
-        changes.apply(txn);
+        changes.apply(txn, &applyStats);
     } else if (args["checkout"].asBool()) {
-        if (args["<head>"]) {
+        if (args["--version"]) {
+            std::string headName = args["<head>"] ? args["<head>"].asString() : db.getHead();
+            db.checkoutVersion(txn, headName, std::stoull(args["--version"].asString()));
+            dbi_quadb_state.del(txn, "currHead");
+        } else if (args["<head>"]) {
             std::string newHead = args["<head>"].asString();
             db.checkout(newHead);
             dbi_quadb_state.put(txn, "currHead", newHead);
@@ -302,6 +346,12 @@ void run(int argc, char **argv) {
         std::cout << to_hex(db.root(txn), true) << std::endl;
     } else if (args["stats"].asBool()) {
         quadrable::dumpStats(db, txn);
+
+        std::string_view v;
+        if (dbi_quadb_state.get(txn, "applyStats", v)) {
+            std::cout << "\nTotals for all updates:\n";
+            quadrable::dumpApplyStats(decodeApplyStats(v));
+        }
     } else if (args["status"].asBool()) {
         if (db.isDetachedHead()) {
             std::cout << "Detached head" << std::endl;
@@ -354,11 +404,31 @@ void run(int argc, char **argv) {
             else throw quaderr("unexpected line in patch");
         }
 
-        changes.apply(txn);
+        changes.apply(txn, &applyStats);
+    } else if (args["history"].asBool()) {
+        if (args["prune"].asBool()) {
+            quadrable::Quadrable::RetentionPolicy policy;
+            if (args["--keep"]) policy.keepLast = std::stoull(args["--keep"].asString());
+            if (args["--seconds"]) policy.keepSeconds = std::stoull(args["--seconds"].asString());
+
+            uint64_t pruned = db.pruneHeadHistory(txn, policy);
+
+            std::cout << "Pruned " << pruned << " versions. Run gc to remove the unreferenced nodes." << std::endl;
+        } else {
+            std::string headName = args["<head>"] ? args["<head>"].asString() : db.getHead();
+
+            for (auto &hv : db.getHeadHistory(txn, headName)) {
+                std::cout << hv.version << " : " << hv.timestamp << " : " << quadrable::renderNode(db, txn, hv.nodeId) << "\n";
+            }
+
+            std::cout << std::flush;
+        }
     } else if (args["gc"].asBool()) {
         quadrable::Quadrable::GarbageCollector gc(db);
 
         gc.markAllHeads(txn);
+        gc.markAllSyncSessions(txn);
+        gc.markAllHeadHistory(txn);
 
         if (db.isDetachedHead()) gc.markTree(txn, db.getHeadNodeId(txn));
 
@@ -367,6 +437,18 @@ void run(int argc, char **argv) {
         std::cout << "Collected " << stats.garbage << "/" << stats.total << " nodes" << std::endl;
 
         gc.deleteNodes(txn);
+    } else if (args["compact"].asBool()) {
+        auto before = db.stats(txn);
+        if (args["--inline"]) db.inlineLeaves(txn, std::stoull(args["--inline"].asString()));
+        if (args["--pages"]) db.packPages(txn, std::stoull(args["--pages"].asString()));
+        else db.compactChains(txn);
+        auto after = db.stats(txn);
+
+        std::cout << "Compacted " << before.numBytes << " -> " << after.numBytes << " bytes" << std::endl;
+    } else if (args["dedup"].asBool()) {
+        db.dedupHeads(txn);
+
+        std::cout << "De-duplicated all heads. Run gc to remove the duplicate nodes." << std::endl;
     } else if (args["exportProof"].asBool()) {
         quadrable::Proof proof;
 
@@ -391,7 +473,7 @@ void run(int argc, char **argv) {
                 keys.push_back(quadrable::Key::fromInteger(std::stoi(key)));
             }
 
-            proof = db.exportProofRaw(txn, keys);
+            proof = db.exportProofRaw(txn, keys, args["--deletable"].asBool());
         } else {
             std::vector<std::string> keys;
 
@@ -399,7 +481,7 @@ void run(int argc, char **argv) {
                 keys.push_back(key);
             }
 
-            proof = db.exportProof(txn, keys);
+            proof = db.exportProof(txn, keys, args["--deletable"].asBool());
         }
 
         std::string format = "HashedKeys";
@@ -414,6 +496,10 @@ void run(int argc, char **argv) {
                 encoded = quadrable::transport::encodeProof(proof, quadrable::transport::EncodingType::HashedKeys);
             } else if (format == "FullKeys") {
                 encoded = quadrable::transport::encodeProof(proof, quadrable::transport::EncodingType::FullKeys);
+            } else if (format == "CompactHashedKeys") {
+                encoded = quadrable::transport::encodeProof(proof, quadrable::transport::EncodingType::CompactHashedKeys);
+            } else if (format == "CompactFullKeys") {
+                encoded = quadrable::transport::encodeProof(proof, quadrable::transport::EncodingType::CompactFullKeys);
             } else {
                 throw quaderr("unknown proof format");
             }
@@ -489,6 +575,14 @@ void run(int argc, char **argv) {
         dbi_quadb_state.put(txn, "detachedHead", lmdb::to_sv<uint64_t>(db.getHeadNodeId(txn)));
     }
 
+    if (applyStats.applies) {
+        std::string_view v;
+        quadrable::ApplyStats totals;
+        if (dbi_quadb_state.get(txn, "applyStats", v)) totals = decodeApplyStats(v);
+        totals.add(applyStats);
+        dbi_quadb_state.put(txn, "applyStats", encodeApplyStats(totals));
+    }
+
 
     txn.commit();
 }
@@ -0,0 +1,154 @@
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include "quadrable.h"
+#include "quadrable/transport.h"
+#include "quadrable/debug.h"
+
+
+
+
+namespace quadrable {
+
+// Compares regular leaves against CompactLeaf records (Quadrable::omitLeafHashes), which don't store
+// the leaf's nodeHash and instead recompute it whenever it's needed (proofs, updates of neighbouring keys).
+
+static uint64_t usSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Value sizes: mostly tiny values, with a tail of larger ones
+
+static uint64_t randomValSize(std::mt19937 &rnd) {
+    auto r = rnd() % 100;
+    if (r < 40) return rnd() % 9;
+    if (r < 80) return 9 + rnd() % 24;
+    if (r < 95) return 33 + rnd() % 32;
+    return 65 + rnd() % 192;
+}
+
+void doIt() {
+    ::system("mkdir -p testdb/ ; rm testdb/*.mdb");
+    std::string dbDir = "testdb/";
+
+
+    lmdb::env lmdb_env = lmdb::env::create();
+
+    lmdb_env.set_max_dbs(64);
+    lmdb_env.set_mapsize(1UL * 1024UL * 1024UL * 1024UL * 1024UL);
+
+    lmdb_env.open(dbDir.c_str(), MDB_CREATE, 0664);
+
+    lmdb_env.reader_check();
+
+    quadrable::Quadrable db;
+
+    {
+        auto txn = lmdb::txn::begin(lmdb_env, nullptr, 0);
+        db.init(txn);
+        txn.commit();
+    }
+
+
+
+    auto txn = lmdb::txn::begin(lmdb_env, nullptr, 0);
+
+    uint64_t numElems = 200'000;
+    uint64_t numProofKeys = 1'000;
+    uint64_t numUpdates = 10'000;
+
+    std::cout << "mode,leafBytes,totalBytes,insertUs,getUs,proofUs,updateUs" << std::endl;
+
+    for (bool omitLeafHashes : { false, true }) {
+        std::mt19937 rnd;
+        rnd.seed(0);
+
+        db.omitLeafHashes = omitLeafHashes;
+        db.checkout();
+
+        auto start = std::chrono::steady_clock::now();
+
+        {
+            auto c = db.change();
+            for (uint64_t i = 0; i < numElems; i++) c.put(quadrable::Key::fromInteger(i), std::string(randomValSize(rnd), 'x'));
+            c.apply(txn);
+        }
+
+        uint64_t insertUs = usSince(start);
+
+        uint64_t leafBytes = 0;
+        auto stats = db.stats(txn);
+
+        db.walkTree(txn, [&](Quadrable::ParsedNode &node, uint64_t){
+            if (node.isLeaf()) leafBytes += node.raw.size();
+            return true;
+        });
+
+        // Lookups don't need leaf hashes
+
+        start = std::chrono::steady_clock::now();
+
+        {
+            GetMultiQuery query;
+            for (uint64_t i = 0; i < numElems; i += 7) query.emplace(std::string(quadrable::Key::fromInteger(i).sv()), GetMultiResult{});
+            db.getMultiRaw(txn, query);
+            for (auto &[k, v] : query) if (!v.exists) throw quaderr("missing key");
+        }
+
+        uint64_t getUs = usSince(start);
+
+        // Proofs need the hashes of the leaves adjacent to the proved keys
+
+        start = std::chrono::steady_clock::now();
+
+        {
+            std::vector<Key> keys;
+            for (uint64_t i = 0; i < numProofKeys; i++) keys.push_back(quadrable::Key::fromInteger(rnd() % (numElems * 2)));
+            auto proof = db.exportProofRaw(txn, keys);
+            if (transport::encodeProof(proof).size() == 0) throw quaderr("empty proof");
+        }
+
+        uint64_t proofUs = usSince(start);
+
+        // Updates need the hashes of the unmodified siblings
+
+        start = std::chrono::steady_clock::now();
+
+        {
+            db.fork(txn);
+            auto c = db.change();
+            for (uint64_t i = 0; i < numUpdates; i++) c.put(quadrable::Key::fromInteger(rnd() % numElems), "updated");
+            c.apply(txn);
+        }
+
+        uint64_t updateUs = usSince(start);
+
+        std::cout << (omitLeafHashes ? "compact" : "regular") << "," << leafBytes << "," << stats.numBytes << ","
+                  << insertUs << "," << getUs << "," << proofUs << "," << updateUs << std::endl;
+    }
+
+
+
+    txn.abort();
+}
+
+
+}
+
+
+
+int main() {
+    try {
+        quadrable::doIt();
+    } catch (const std::runtime_error& error) {
+        std::cerr << "Test failure: " << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
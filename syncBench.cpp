@@ -85,10 +85,12 @@ void doIt() {
 
         Quadrable::Sync sync(&db);
         sync.init(txn, origNodeId);
+        sync.countWitnesses = true;
 
         uint64_t bytesDown = 0;
         uint64_t bytesUp = 0;
         uint64_t roundTrips = 0;
+        SyncMetrics providerMetrics;
 
         while(1) {
             auto reqs = sync.getReqs(txn, 10000);
@@ -96,20 +98,54 @@ void doIt() {
             bytesUp += reqSize;
             if (reqs.size() == 0) break;
 
-            auto resps = db.handleSyncRequests(txn, newNodeId, reqs, 100000);
+            auto resps = db.handleSyncRequests(txn, newNodeId, reqs, 100000, &providerMetrics);
             uint64_t respSize = transport::encodeSyncResponses(resps).size();
             bytesDown += respSize;
             sync.addResps(txn, reqs, resps);
 
             roundTrips++;
 
-            std::cout << "RT: " << roundTrips << " up: " << reqSize << " down: " << respSize << std::endl;
+            std::cout << "RT: " << roundTrips << " up: " << reqSize << " down: " << respSize << " unresolved witnesses: " << sync.metrics.witnessesRemaining << std::endl;
         }
 
+        std::cout << "  reqs: " << sync.metrics.requests << " frags: " << sync.metrics.fragments << " strands: " << sync.metrics.strands << " hashes: " << sync.metrics.hashCmds << std::endl;
+        std::cout << "  reconcile: " << sync.metrics.reconcile.wallTimeUs << "us (" << sync.metrics.reconcile.nodesRead << " reads)"
+                  << " import: " << sync.metrics.import.wallTimeUs << "us (" << sync.metrics.import.nodesRead << " reads, " << sync.metrics.import.nodesWritten << " writes)"
+                  << " handle: " << providerMetrics.handle.wallTimeUs << "us (" << providerMetrics.handle.nodesRead << " reads)" << std::endl;
+
         db.checkout(sync.nodeIdShadow);
         if (db.rootKey(txn) != newKey) throw quaderr("NOT EQUAL AFTER IMPORT");
 
-        std::cout << loopVar << "," << roundTrips << "," << bytesUp << "," << bytesDown << std::endl;
+        // Same transfer, using IBLT set-reconciliation
+
+        uint64_t reconcileBytesUp = 0;
+        uint64_t reconcileBytesDown = 0;
+
+        {
+            Quadrable::Reconcile reconcile(&db);
+            reconcile.init(txn, origNodeId);
+
+            auto estimator = transport::encodeStrataEstimator(reconcile.getEstimator(txn));
+            reconcileBytesUp += estimator.size();
+
+            auto resp = transport::encodeReconcileResponse(db.handleReconcileRequest(txn, newNodeId, transport::decodeStrataEstimator(estimator)));
+            reconcileBytesDown += resp.size();
+
+            if (!reconcile.addIBLT(txn, transport::decodeReconcileResponse(resp))) throw quaderr("IBLT DECODE FAILED");
+
+            auto keys = transport::encodeReconcileKeys(reconcile.getKeys());
+            reconcileBytesUp += keys.size();
+
+            auto proof = transport::encodeProof(db.exportProofRaw(txn, newNodeId, transport::decodeReconcileKeys(keys)));
+            reconcileBytesDown += proof.size();
+
+            auto decodedProof = transport::decodeProof(proof);
+            reconcile.addProof(txn, decodedProof);
+
+            if (db.rootKey(txn, reconcile.nodeIdReconciled) != newKey) throw quaderr("NOT EQUAL AFTER RECONCILE");
+        }
+
+        std::cout << loopVar << "," << roundTrips << "," << bytesUp << "," << bytesDown << "," << reconcileBytesUp << "," << reconcileBytesDown << std::endl;
     }
 
 